@@ -4,62 +4,327 @@
 #include <fstream>
 #include <math.h>
 #include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <deque>
+#include <sstream>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "igtlOSUtil.h"
 #include "igtlStringMessage.h"
+#include "igtlImageMessage.h"
+#include "igtlStatusMessage.h"
 #include "igtlClientSocket.h"
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+#include "MatlabCommanderGeometryTransfer.h"
+#include "MatlabCommanderImageTransfer.h"
+#include "MatlabCommanderParameterTransfer.h"
+#include "MatlabCommanderResultCache.h"
+#include "MatlabCommanderStringTransfer.h"
+#include "MatlabCommanderWorkerPool.h"
 
 #include "vtksys/SystemTools.hxx"
 #include "vtksys/Process.h"
 
 const std::string CALL_MATLAB_FUNCTION_ARG="--call-matlab-function";
 const std::string EXIT_MATLAB_ARG="--exit-matlab";
+const std::string START_MATLAB_ARG="--start-matlab";
+const std::string SUBMIT_JOB_ARG="--submit";
+const std::string JOB_STATUS_ARG="--status";
+const std::string JOB_RESULT_ARG="--result";
+const std::string CANCEL_JOB_ARG="--cancel";
+const std::string RELOAD_MATLAB_FUNCTIONS_ARG="--reload";
+const std::string BATCH_ARG="--batch";
 const std::string MATLAB_DEFAULT_HOST="127.0.0.1";
 const int MATLAB_DEFAULT_PORT=4100;
 
 const int MAX_MATLAB_STARTUP_TIME_SEC=60; // maximum time allowed for Matlab to start
+// While waiting for Matlab startup, connection is retried with exponentially increasing delay
+// (so that the server is found soon after it is ready, without flooding it with connection requests)
+const unsigned int MIN_MATLAB_STARTUP_RETRY_DELAY_MSEC=50;
+const unsigned int MAX_MATLAB_STARTUP_RETRY_DELAY_MSEC=1000;
+// Device name of the readiness check (GET_STATUS) message
+const std::string READINESS_CHECK_DEVICE_NAME="CMD_READY";
+// The server appends this to the status string of the readiness check reply if it sends messages with 0 body CRC
+// (it does not compute the CRC because crc64_mex is not available or CRC is skipped on loopback connections)
+const char CRC_DISABLED_STATUS_STRING[]="CRC off";
+
+// If this environment variable is set to IMAGE_TRANSFER_MESSAGE then images are sent to/received from
+// Matlab in OpenIGTLink IMAGE messages instead of having Matlab read/write the NRRD files.
+// If it is set to IMAGE_TRANSFER_SHARED_MEMORY then the IMAGE messages only contain the image geometry
+// and the voxels are exchanged through memory-mapped files (Matlab has to run on the same computer).
+const char IMAGE_TRANSFER_ENV_VAR_NAME[]="SLICER_MATLAB_IMAGE_TRANSFER";
+
+// If this environment variable is set (to any value other than 0) then the CRC of messages is not checked
+// on loopback connections (the Matlab command server does not compute it either, which saves time for large messages).
+// The Matlab command server never computes or checks the CRC if crc64_mex is not available (it would be too slow).
+// The server tells in the readiness check if it does not compute the CRC.
+const char SKIP_LOOPBACK_CRC_ENV_VAR_NAME[]="SLICER_MATLAB_SKIP_LOOPBACK_CRC";
+const std::string IMAGE_TRANSFER_MESSAGE="message";
+const std::string IMAGE_TRANSFER_SHARED_MEMORY="sharedmemory";
+
+// If this environment variable is set to GEOMETRY_TRANSFER_MESSAGE then meshes (PLY and STL files) are sent to/received from
+// Matlab in OpenIGTLink POLYDATA messages instead of having Matlab read/write the files.
+const char GEOMETRY_TRANSFER_ENV_VAR_NAME[]="SLICER_MATLAB_GEOMETRY_TRANSFER";
+const std::string GEOMETRY_TRANSFER_MESSAGE="message";
+
+// Matlab functions are executed by a pool of Matlab processes (workers). The number of workers
+// is specified by this environment variable (default: 1). Workers listen on consecutive ports,
+// starting from MATLAB_DEFAULT_PORT.
+const char NUMBER_OF_WORKERS_ENV_VAR_NAME[]="SLICER_MATLAB_NUMBER_OF_WORKERS";
+// Selection of the worker that executes a Matlab function: "leastloaded" (default) or "roundrobin"
+const char WORKER_SCHEDULING_ENV_VAR_NAME[]="SLICER_MATLAB_WORKER_SCHEDULING";
+// Before a command is dispatched to a worker, the worker has to pass the readiness check in this time
+// (an idle worker replies immediately, a worker that does not reply is hung or busy with a command of another client)
+const int WORKER_HEALTH_CHECK_TIMEOUT_MSEC=2000;
 
-// If the Matlab function response string starts with this string then it means
-// the function execution failed
-const std::string RESPONSE_ERROR_PREFIX="ERROR:";
+// Timing of command execution phases is printed to the standard output as a JSON line.
+// If this environment variable is set then the JSON line is also appended to the specified file.
+const char TIMING_LOG_FILE_ENV_VAR_NAME[]="SLICER_MATLAB_TIMING_LOG_FILE";
+
+// If this environment variable is set then results of Matlab function calls are stored in this directory
+// and calling the same function again with the same parameters and input file contents restores
+// the results from the cache instead of executing the function in Matlab.
+const char RESULT_CACHE_DIR_ENV_VAR_NAME[]="SLICER_MATLAB_RESULT_CACHE_DIR";
+// Maximum size of the result cache in MB (default: DEFAULT_RESULT_CACHE_SIZE_MB).
+// Least recently used results are removed from the cache if it grows larger.
+const char RESULT_CACHE_SIZE_ENV_VAR_NAME[]="SLICER_MATLAB_RESULT_CACHE_SIZE_MB";
+const unsigned long long DEFAULT_RESULT_CACHE_SIZE_MB=1024;
+
+// Output of Matlab commands is returned in the reply according to the reply policy:
+//   full: complete output (default)
+//   truncate: only the first maxlength characters of the output
+//   tail: only the last maxlength characters of the output (error messages are returned from the beginning)
+//   file: the output is written to a file by the server and the reply is the file path
+//     (the file is not removed, the caller has to delete it when it is not needed anymore)
+//   none: the output is not captured (it is printed on the Matlab console only)
+// Reply policy of commands is specified by the module parameters, reply policy of Matlab function calls
+// is specified by this environment variable in the form mode[:maxlength] (e.g., tail:10000).
+const char REPLY_POLICY_ENV_VAR_NAME[]="SLICER_MATLAB_REPLY_POLICY";
+const std::string REPLY_POLICY_FULL="full";
+const std::string REPLY_POLICY_TRUNCATE="truncate";
+const std::string REPLY_POLICY_TAIL="tail";
+const std::string REPLY_POLICY_FILE="file";
+const std::string REPLY_POLICY_NONE="none";
+const size_t DEFAULT_MAX_REPLY_LENGTH=65536;
+
+// In batch mode this many function calls are sent to the server before the reply of the first one is received.
+// The server queues the calls, so the next call is already waiting when the previous one completes.
+const size_t BATCH_PIPELINE_DEPTH=4;
 
 enum ExecuteMatlabCommandStatus
 {
   COMMAND_STATUS_FAILED=0,
-  COMMAND_STATUS_SUCCESS=1
+  COMMAND_STATUS_SUCCESS=1,
+  COMMAND_STATUS_CONNECTION_FAILED=2 // the command was not sent, because the server could not be started or connected to
 };
 
-std::string ReceiveString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header)
+// Connections to Matlab command servers are kept open and reused by all the commands
+// that are executed by this process (keep-alive session). Key is "hostname:port".
+typedef std::map<std::string, igtl::ClientSocket::Pointer> ConnectionMapType;
+ConnectionMapType OpenConnections;
+
+// Duration of the phases of command execution (in seconds), for performance monitoring.
+// Times are accumulated if the command is sent multiple times (e.g., because the connection was lost).
+struct CommandTimingInfo
 {
-  // Create a message buffer to receive transform data
-  igtl::StringMessage::Pointer stringMsg;
-  stringMsg = igtl::StringMessage::New();
-  stringMsg->SetMessageHeader(header);
-  stringMsg->AllocatePack();
+  CommandTimingInfo()
+    : QueueWaitSec(0), ConnectSec(0), LaunchWaitSec(0), SendSec(0), InputReadSec(0), ReceiveSec(0), OutputWriteSec(0)
+  {
+  }
+  double QueueWaitSec; // waiting for an idle Matlab worker
+  double ConnectSec; // connecting to the server (including launch wait)
+  double LaunchWaitSec; // starting Matlab and waiting for the server to be ready
+  double SendSec; // sending input data objects and the command (including input read)
+  double InputReadSec; // reading input data objects from files
+  double ReceiveSec; // waiting for and receiving the reply (including server processing and output write)
+  double OutputWriteSec; // writing received output data objects to files
+  std::string ServerTimingJson; // phases measured by the server (JSON object)
+};
+CommandTimingInfo CommandTiming;
 
-  // Receive transform data from the socket
-  bool receiveTimedOut = false;
-  int received=socket->Receive(stringMsg->GetPackBodyPointer(), stringMsg->GetPackBodySize(), receiveTimedOut);
-  if (received!=stringMsg->GetPackBodySize())
+// Time when this process started the Matlab server, for reporting Matlab startup time. Key is "hostname:port".
+std::map<std::string, double> ServerStartTimes;
+
+// Identifier of the last sent command. Replies are matched to commands by device name:
+// command is sent to device CMD_uid and the reply is received from device ACK_uid.
+unsigned int LastCommandUid=0;
+
+// CRC of the messages received from the server is checked, unless it is disabled for loopback connections
+bool CheckMessageCrc=true;
+// Connections (keys of OpenConnections) on which the server announced in the readiness check that it does not compute the CRC
+std::set<std::string> ConnectionsWithoutCrc;
+// The server of the connection that is being used announced that it does not compute the CRC
+bool ServerCrcDisabled=false;
+
+struct ReplyPolicyInfo
+{
+  ReplyPolicyInfo() : Mode(REPLY_POLICY_FULL), MaxLength(DEFAULT_MAX_REPLY_LENGTH) {}
+  // Returns true if only a part of the output is returned (truncate or tail policy)
+  bool IsLengthLimited() const
+  {
+    return this->Mode==REPLY_POLICY_TRUNCATE || this->Mode==REPLY_POLICY_TAIL;
+  }
+  std::string Mode;
+  size_t MaxLength;
+};
+// Reply policy of the commands that are executed by this process
+ReplyPolicyInfo ReplyPolicy;
+
+// Device names of the messages that contain the input and return parameters of Matlab functions
+const char PARAMETERS_INPUT_DEVICE_NAME[]="PRM_IN";
+const std::string PARAMETERS_OUTPUT_DEVICE_NAME="PRM_OUT";
+
+// Data objects that are transferred through the connection instead of files.
+// Key is the device name that sends the data object, value is the file name that the Matlab function uses.
+struct DataTransferInfo
+{
+  DataTransferInfo() : SendInputParameters(false) {}
+  // Appended to the device names of images and return parameters, so that the outputs of commands
+  // that are executed at the same time (pipelined commands) can be told apart
+  std::string DeviceNameSuffix;
+  // Function parameters that are sent in a PARAMS message (from device PARAMETERS_INPUT_DEVICE_NAME)
+  // instead of in the command string
+  bool SendInputParameters;
+  MatlabParameterList InputParameters;
+  // Return parameter files that are written from the PARAMS message received from the device
+  std::map<std::string, std::string> OutputParameterFiles;
+  std::map<std::string, std::string> InputImageFiles;
+  std::map<std::string, std::string> OutputImageFiles;
+  // Memory-mapped files that contain the voxels of the images (only used in shared memory transfer mode)
+  std::map<std::string, std::string> MappedImageFiles;
+  std::map<std::string, std::string> InputGeometryFiles;
+  std::map<std::string, std::string> OutputGeometryFiles;
+};
+
+// Commands that have been sent without waiting for the reply of the previous command (pipelined commands).
+// The server may complete them in a different order than they were sent, so replies and outputs of other
+// pending commands that arrive while waiting for a reply are stored. Key is the reply device name.
+struct PendingCommandInfo
+{
+  PendingCommandInfo() : DataTransfer(NULL), ReplyReceived(false) {}
+  const DataTransferInfo* DataTransfer;
+  bool ReplyReceived;
+  std::string Reply;
+  std::string ServerTimingJson;
+};
+typedef std::map<std::string, PendingCommandInfo> PendingCommandMapType;
+PendingCommandMapType PendingCommands;
+
+// Returns true if the CRC of messages received from the host has to be checked
+bool IsMessageCrcCheckRequired(const std::string& hostname)
+{
+  const char* skipLoopbackCrcEnvValue=getenv(SKIP_LOOPBACK_CRC_ENV_VAR_NAME);
+  if (skipLoopbackCrcEnvValue==NULL || strlen(skipLoopbackCrcEnvValue)==0 || strcmp(skipLoopbackCrcEnvValue, "0")==0)
   {
-    std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+    return true;
   }
-  if (receiveTimedOut)
+  bool loopbackHost=(hostname=="localhost" || hostname=="::1" || hostname.compare(0, 4, "127.")==0);
+  static bool warningReported=false;
+  if (loopbackHost && !warningReported)
   {
-    std::cerr << "WARNING: receiving timed out" << std::endl;
+    std::cout << "WARNING: CRC of messages received from the Matlab server is not checked (" << SKIP_LOOPBACK_CRC_ENV_VAR_NAME << " is set)" << std::endl;
+    warningReported=true;
   }
+  return !loopbackHost;
+}
+
+// The Matlab command server sends 0 as body CRC if it does not compute the CRC, which it announces in the readiness check.
+// 0 CRC is only accepted without checking from such a server, otherwise it has to match the CRC of the body, as any other value.
+// Returns true if the body CRC of a received message has to be checked.
+bool IsBodyCrcCheckRequired(igtlUint64 bodyCrc)
+{
+  return CheckMessageCrc && !(ServerCrcDisabled && bodyCrc==0);
+}
+
+// Receive the reply of a command. Only the part of the reply that the reply policy allows is kept
+// (the server shortens the reply already, this makes sure that a very long reply is not stored in memory in any case).
+std::string ReceiveReplyString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc)
+{
+  return ReceiveString(socket, header, bodyCrc, IsBodyCrcCheckRequired(bodyCrc), ReplyPolicy.IsLengthLimited() ? ReplyPolicy.MaxLength : 0,
+    ReplyPolicy.Mode==REPLY_POLICY_TAIL);
+}
+
+// Receive an IMAGE message body and write the image to file
+bool ReceiveImageToFile(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, const std::string& filename,
+  const std::string& mappedFilename)
+{
+  igtl::ImageMessage::Pointer imageMsg;
+  imageMsg = igtl::ImageMessage::New();
+  imageMsg->SetMessageHeader(header);
+  imageMsg->AllocatePack();
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = stringMsg->Unpack();
+  bool receiveTimedOut = false;
+  igtlUint64 received=socket->Receive(imageMsg->GetPackBodyPointer(), imageMsg->GetPackBodySize(), receiveTimedOut);
+  if (received!=imageMsg->GetPackBodySize() || receiveTimedOut)
+  {
+    std::cerr << "ERROR: failed to receive complete image message body" << std::endl;
+    return false;
+  }
+  if (!(imageMsg->Unpack(IsBodyCrcCheckRequired(bodyCrc) ? 1 : 0) & igtl::MessageHeader::UNPACK_BODY))
+  {
+    std::cerr << "ERROR: failed to unpack image message" << std::endl;
+    return false;
+  }
+  return WriteImageMessageToFile(imageMsg, filename, mappedFilename);
+}
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+// Receive a PARAMS message body and write the parameters to a return parameter file
+bool ReceiveParametersToFile(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, const std::string& filename)
+{
+  std::vector<char> body(header->GetBodySizeToRead());
+  bool receiveTimedOut = false;
+  if (!body.empty())
+  {
+    igtlUint64 received=socket->Receive(&body[0], body.size(), receiveTimedOut);
+    if (received!=body.size() || receiveTimedOut)
+    {
+      std::cerr << "ERROR: failed to receive complete parameters message body" << std::endl;
+      return false;
+    }
+  }
+  if (IsBodyCrcCheckRequired(bodyCrc) && crc64(body.empty() ? NULL : reinterpret_cast<unsigned char*>(&body[0]), body.size(), 0)!=bodyCrc)
+  {
+    std::cerr << "ERROR: CRC check failed for parameters message" << std::endl;
+    return false;
+  }
+  MatlabParameterList parameters;
+  if (!UnpackParametersMessageBody(body, parameters))
   {
-    return stringMsg->GetString();
+    std::cerr << "ERROR: failed to unpack parameters message" << std::endl;
+    return false;
   }
+  return WriteReturnParameterFile(filename, parameters);
+}
 
-  // error
-  return "";
+// Receive a POLYDATA message body and write the mesh to file
+bool ReceiveGeometryToFile(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, const std::string& filename)
+{
+  std::vector<char> body(header->GetBodySizeToRead());
+  bool receiveTimedOut = false;
+  if (!body.empty())
+  {
+    igtlUint64 received=socket->Receive(&body[0], body.size(), receiveTimedOut);
+    if (received!=body.size() || receiveTimedOut)
+    {
+      std::cerr << "ERROR: failed to receive complete mesh message body" << std::endl;
+      return false;
+    }
+  }
+  if (IsBodyCrcCheckRequired(bodyCrc) && crc64(body.empty() ? NULL : reinterpret_cast<unsigned char*>(&body[0]), body.size(), 0)!=bodyCrc)
+  {
+    std::cerr << "ERROR: CRC check failed for mesh message" << std::endl;
+    return false;
+  }
+  return WritePolyDataMessageBodyToFile(body, filename);
 }
 
 void SetReturnValues(const std::string &returnParameterFile,const char* reply, bool completed)
@@ -72,8 +337,54 @@ void SetReturnValues(const std::string &returnParameterFile,const char* reply, b
   rts.close(); 
 }
 
+// Writes the return parameters the same way as SetReturnValues, but the reply is written block by block
+// while it is received (and printed on the standard output), so that a long reply is never stored in memory
+class ReturnValuesWriter : public StringBlockWriter
+{
+public:
+  ReturnValuesWriter(const std::string &returnParameterFile)
+  {
+    this->ReturnParameterStream.open(returnParameterFile.c_str());
+    this->ReturnParameterStream << "reply = ";
+  }
+
+  virtual void Write(const char* block, size_t size)
+  {
+    std::cout.write(block, size);
+    this->WriteReply(block, size);
+  }
+
+  // Write the rest of the return parameters. If the command failed then the error message is added to the reply
+  // (it is printed on the standard error instead of the standard output).
+  void Finish(bool completed, const std::string& errorReply)
+  {
+    std::cout << std::endl;
+    if (!errorReply.empty())
+    {
+      std::cerr << errorReply << std::endl;
+      this->WriteReply(errorReply.data(), errorReply.size());
+    }
+    this->ReturnParameterStream << std::endl;
+    this->ReturnParameterStream << "completed = " << (completed?"true":"false") << std::endl;
+    this->ReturnParameterStream.close();
+  }
+
+private:
+  void WriteReply(const char* block, size_t size)
+  {
+    // Remove newline characters, as it would confuse the return parameter file
+    this->Block.assign(block, size);
+    std::replace(this->Block.begin(), this->Block.end(), '\r', ' ');
+    std::replace(this->Block.begin(), this->Block.end(), '\n', ' ');
+    this->ReturnParameterStream << this->Block;
+  }
+
+  std::ofstream ReturnParameterStream;
+  std::string Block;
+};
+
 // Returns true if execution is successful. Matlab start may take an additional minute after this function returns.
-bool StartMatlabServer()
+bool StartMatlabServer(int port)
 {
   const char* matlabExecutablePath=getenv("SLICER_MATLAB_EXECUTABLE_PATH");
   const char* matlabCommandServerScriptPath=getenv("SLICER_MATLAB_COMMAND_SERVER_SCRIPT_PATH");
@@ -110,7 +421,11 @@ bool StartMatlabServer()
     std::cout << " -automation"; 
     command.push_back("-automation");
 
-    // script directory (-sd) option does not work with the automation option, so need to use the run command to specify full script path
+    // script directory (-sd) option does not work with the automation option, so need to change to the script directory
+    // before starting the server (the server adds the current directory to the path)
+    std::ostringstream serverStartCommand;
+    serverStartCommand << "cd('" << vtksys::SystemTools::GetFilenamePath(matlabCommandServerScriptPath) << "'); "
+      << vtksys::SystemTools::GetFilenameWithoutLastExtension(matlabCommandServerScriptPath) << "(" << port << ");";
 
     // run script after startup
 #if defined( _WIN32 ) && !defined(__CYGWIN__) 
@@ -118,12 +433,12 @@ bool StartMatlabServer()
     std::string startupCommand1=std::string("-r");
     std::cout << " " << startupCommand1;
     command.push_back(startupCommand1.c_str());
-    std::string startupCommand2=std::string("\"run('")+matlabCommandServerScriptPath+"');\"";
+    std::string startupCommand2=std::string("\"")+serverStartCommand.str()+"\"";
     std::cout << " " << startupCommand2;
     command.push_back(startupCommand2.c_str());
 #else
     // Linux/Mac OS X requires parameter and script name as one argument
-    std::string startupCommand=std::string("-r \"run('")+matlabCommandServerScriptPath+"');\"";
+    std::string startupCommand=std::string("-r \"")+serverStartCommand.str()+"\"";
     std::cout << " " << startupCommand; 
     command.push_back(startupCommand.c_str());
 #endif
@@ -211,243 +526,1458 @@ bool StartMatlabServer()
   return success;
 }
 
-ExecuteMatlabCommandStatus ExecuteMatlabCommand(const std::string& hostname, int port, const std::string &cmd, std::string &reply, int receiveTimeoutMsec = 0)
+std::string GetConnectionKey(const std::string& hostname, int port)
+{
+  std::ostringstream key;
+  key << hostname << ":" << port;
+  return key.str();
+}
+
+// Readiness handshake: the server replies to a GET_STATUS message with an OK STATUS message
+// when it is ready to execute commands. The status string tells if the server computes the CRC of the messages,
+// which is recorded for the connection. Returns true if the server is ready.
+bool CheckMatlabServerReady(igtl::Socket * socket, const std::string& hostname, int port, int timeoutMsec)
+{
+  igtl::GetStatusMessage::Pointer getStatusMsg=igtl::GetStatusMessage::New();
+  getStatusMsg->SetDeviceName(READINESS_CHECK_DEVICE_NAME.c_str());
+  getStatusMsg->Pack();
+  if (!socket->Send(getStatusMsg->GetPackPointer(), getStatusMsg->GetPackSize()))
+  {
+    return false;
+  }
+
+  bool ready=false;
+  socket->SetReceiveTimeout(timeoutMsec>0 ? timeoutMsec : 1);
+  igtl::MessageHeader::Pointer headerMsg=igtl::MessageHeader::New();
+  headerMsg->InitPack();
+  bool receiveTimedOut=false;
+  int receivedBytes=socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize(), receiveTimedOut);
+  if (receivedBytes==static_cast<int>(headerMsg->GetPackSize()) && !receiveTimedOut)
+  {
+    headerMsg->Unpack();
+    if (strcmp(headerMsg->GetDeviceType(), "STATUS")==0 && READINESS_CHECK_DEVICE_NAME.compare(headerMsg->GetDeviceName())==0)
+    {
+      igtl::StatusMessage::Pointer statusMsg=igtl::StatusMessage::New();
+      statusMsg->SetMessageHeader(headerMsg);
+      statusMsg->AllocatePack();
+      igtlUint64 received=socket->Receive(statusMsg->GetPackBodyPointer(), statusMsg->GetPackBodySize(), receiveTimedOut);
+      ready=(received==statusMsg->GetPackBodySize() && !receiveTimedOut
+        && (statusMsg->Unpack() & igtl::MessageHeader::UNPACK_BODY)
+        && statusMsg->GetCode()==igtl::StatusMessage::STATUS_OK);
+      if (ready)
+      {
+        const std::string connectionKey=GetConnectionKey(hostname, port);
+        ServerCrcDisabled=(strstr(statusMsg->GetStatusString(), CRC_DISABLED_STATUS_STRING)!=NULL);
+        if (!ServerCrcDisabled)
+        {
+          ConnectionsWithoutCrc.erase(connectionKey);
+        }
+        else if (ConnectionsWithoutCrc.insert(connectionKey).second)
+        {
+          std::cout << "WARNING: Matlab server at port " << port << " does not compute message CRC"
+            << " (crc64_mex is not available or CRC is skipped on loopback connections), CRC of its messages is not checked" << std::endl;
+        }
+      }
+    }
+  }
+  // Restore the default (blocking) receive mode
+  socket->SetReceiveTimeout(0);
+  return ready;
+}
+
+// Wait until the started Matlab server accepts connections and passes the readiness check.
+// Returns true if the socket is connected to the server that is ready to execute commands.
+bool WaitForMatlabServer(igtl::ClientSocket * socket, const std::string& hostname, int port, double serverStartTime)
+{
+  unsigned int retryDelayMsec=MIN_MATLAB_STARTUP_RETRY_DELAY_MSEC;
+  while (true)
+  {
+    double remainingTimeSec=MAX_MATLAB_STARTUP_TIME_SEC-(vtksys::SystemTools::GetTime()-serverStartTime);
+    if (socket->ConnectToServer(hostname.c_str(), port)==0)
+    {
+      if (CheckMatlabServerReady(socket, hostname, port, static_cast<int>(remainingTimeSec*1000)))
+      {
+        std::cout << "Matlab server at port " << port << " is ready after "
+          << vtksys::SystemTools::GetTime()-serverStartTime << "sec" << std::endl;
+        return true;
+      }
+      socket->CloseSocket();
+      remainingTimeSec=MAX_MATLAB_STARTUP_TIME_SEC-(vtksys::SystemTools::GetTime()-serverStartTime);
+    }
+    if (remainingTimeSec<=0)
+    {
+      std::cerr << "ERROR: Matlab server at port " << port << " did not become ready in " << MAX_MATLAB_STARTUP_TIME_SEC << "sec" << std::endl;
+      return false;
+    }
+    // Failed to connect, wait some more and retry
+    std::cerr << "Waiting for Matlab startup ... " << static_cast<int>(vtksys::SystemTools::GetTime()-serverStartTime) << "sec" << std::endl;
+    vtksys::SystemTools::Delay(retryDelayMsec);
+    retryDelayMsec=std::min(2*retryDelayMsec, MAX_MATLAB_STARTUP_RETRY_DELAY_MSEC);
+  }
+}
+
+// Returns a socket that is connected to the Matlab command server.
+// An open connection to the same server is reused (keep-alive session).
+// If startServer is enabled and the server is not running then the Matlab process is started.
+// A new connection has to pass the readiness check in handshakeTimeoutMsec (the server may be busy with
+// a command of another client), which also tells if the server computes the CRC of the messages.
+// Returns a null pointer if the connection cannot be established.
+igtl::ClientSocket::Pointer GetConnection(const std::string& hostname, int port, bool startServer, bool &reusedConnection,
+  int handshakeTimeoutMsec = MAX_MATLAB_STARTUP_TIME_SEC*1000)
 {
+  reusedConnection=false;
+  std::string connectionKey=GetConnectionKey(hostname, port);
+  ConnectionMapType::iterator connectionIt=OpenConnections.find(connectionKey);
+  if (connectionIt!=OpenConnections.end())
+  {
+    if (connectionIt->second->GetConnected())
+    {
+      reusedConnection=true;
+      ServerCrcDisabled=(ConnectionsWithoutCrc.count(connectionKey)>0);
+      return connectionIt->second;
+    }
+    // connection has been lost, remove it from the list of open connections
+    OpenConnections.erase(connectionIt);
+  }
+
   //------------------------------------------------------------
   // Establish Connection
   igtl::ClientSocket::Pointer socket = igtl::ClientSocket::New();
   int connectErrorCode = socket->ConnectToServer(hostname.c_str(), port);
-  if (connectErrorCode!=0)
+  if (connectErrorCode==0 && !CheckMatlabServerReady(socket, hostname, port, handshakeTimeoutMsec))
+  {
+    std::cerr << "ERROR: Matlab server at port " << port << " did not respond to the readiness check" << std::endl;
+    socket->CloseSocket();
+    return NULL;
+  }
+  if (connectErrorCode!=0 && startServer)
   {
     // Maybe Matlab server has not been started, try to start it
-    if (StartMatlabServer())
+    double serverStartTime=vtksys::SystemTools::GetTime();
+    if (StartMatlabServer(port))
     {
-      // process start requested, try to connect
-      for (int retryAttempts=0; retryAttempts<MAX_MATLAB_STARTUP_TIME_SEC; retryAttempts++)
+      // process start requested, wait until it is ready
+      if (WaitForMatlabServer(socket, hostname, port, serverStartTime))
       {
-        connectErrorCode = socket->ConnectToServer(hostname.c_str(), port);
-        if (connectErrorCode==0)
-        {
-          // success
-          break;
-        }
-        // Failed to connect, wait some more and retry
-        vtksys::SystemTools::Delay(1000); // msec
-        std::cerr << "Waiting for Matlab startup ... " << retryAttempts << "sec" << std::endl;
+        connectErrorCode=0;
+        ServerStartTimes[connectionKey]=serverStartTime;
       }
     }
     else
     {
       std::cerr << "ERROR: Failed to start Matlab process" << std::endl;
     }
+    CommandTiming.LaunchWaitSec+=vtksys::SystemTools::GetTime()-serverStartTime;
   }
   if (connectErrorCode != 0)
-  {        
-    reply="ERROR: Cannot connect to the server";
-    return COMMAND_STATUS_FAILED;
+  {
+    return NULL;
   }
 
-  //------------------------------------------------------------
-  // Send command
-  igtl::StringMessage::Pointer stringMsg;
-  stringMsg = igtl::StringMessage::New();
-  stringMsg->SetDeviceName("CMD");
-  std::cout << "Sending string: " << cmd << std::endl;
-  stringMsg->SetString(cmd.c_str());
-  stringMsg->Pack();
   socket->SetSendTimeout(5000); // timeout in msec
-  if (!socket->Send(stringMsg->GetPackPointer(), stringMsg->GetPackSize()))
+  OpenConnections[connectionKey]=socket;
+  return socket;
+}
+
+void CloseConnection(const std::string& hostname, int port)
+{
+  ConnectionMapType::iterator connectionIt=OpenConnections.find(GetConnectionKey(hostname, port));
+  if (connectionIt==OpenConnections.end())
   {
-    // Failed to send the message
-    std::cerr << "Failed to send message to Matlab process" << std::endl;
-    socket->CloseSocket();
-    return COMMAND_STATUS_FAILED;
+    // not connected
+    return;
   }
+  connectionIt->second->CloseSocket();
+  OpenConnections.erase(connectionIt);
+}
 
-  //------------------------------------------------------------
-  // Receive reply
-  // Create a message buffer to receive header
-  igtl::MessageHeader::Pointer headerMsg;
-  headerMsg = igtl::MessageHeader::New();
-  // Initialize receive buffer
-  headerMsg->InitPack();
-  // Receive generic header from the socket
-  if (receiveTimeoutMsec>0)
+// Returns a connection to the worker if it passes the readiness check (the worker is started if it is not running).
+// Returns a null pointer if the worker cannot be connected to or it does not respond.
+igtl::ClientSocket::Pointer GetHealthyWorkerConnection(int port)
+{
+  bool reusedConnection=true;
+  while (reusedConnection)
   {
-    socket->SetReceiveTimeout(receiveTimeoutMsec); // timeout in msec
+    // A new connection is checked when it is established
+    igtl::ClientSocket::Pointer socket=GetConnection(MATLAB_DEFAULT_HOST, port, true, reusedConnection, WORKER_HEALTH_CHECK_TIMEOUT_MSEC);
+    if (socket.IsNull())
+    {
+      return NULL;
+    }
+    if (!reusedConnection || CheckMatlabServerReady(socket, MATLAB_DEFAULT_HOST, port, WORKER_HEALTH_CHECK_TIMEOUT_MSEC))
+    {
+      return socket;
+    }
+    // The reply may still arrive later, so this connection cannot be used anymore.
+    // If it was a reused connection then the worker may have closed it, so retry with a new connection.
+    CloseConnection(MATLAB_DEFAULT_HOST, port);
   }
+  return NULL;
+}
 
-  bool receiveTimedOut = false;
-  int receivedBytes = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize(), receiveTimedOut);
-  if (receivedBytes == 0)
+// Send the reply policy of the command (as "mode maxlength") to device RPL_uid before the command.
+// Nothing is sent if the complete output is returned. Returns false if the connection is broken.
+bool SendReplyPolicy(igtl::Socket * socket, const std::string &commandUid)
+{
+  if (ReplyPolicy.Mode==REPLY_POLICY_FULL)
   {
-    reply="No reply";
-    socket->CloseSocket();
-    return COMMAND_STATUS_FAILED;
+    return true;
   }
-  if (receivedBytes != headerMsg->GetPackSize() || receiveTimedOut)
+  std::ostringstream policy;
+  policy << ReplyPolicy.Mode;
+  if (ReplyPolicy.IsLengthLimited())
   {
-    reply = "Bad reply";
-    socket->CloseSocket();
-    return COMMAND_STATUS_FAILED;
+    policy << " " << ReplyPolicy.MaxLength;
   }
-  // Deserialize the header
-  headerMsg->Unpack();
-  if (strcmp(headerMsg->GetDeviceType(), "STRING") != 0)
+  return SendString(socket, std::string("RPL_")+commandUid, policy.str());
+}
+
+// Returns the memory-mapped file name of the image that is sent by the device (empty if voxels are sent in the message)
+std::string GetMappedImageFile(const DataTransferInfo* dataTransfer, const std::string& deviceName)
+{
+  std::map<std::string, std::string>::const_iterator mappedImageIt=dataTransfer->MappedImageFiles.find(deviceName);
+  if (mappedImageIt==dataTransfer->MappedImageFiles.end())
   {
-    reply = std::string("Receiving unsupported message type: ") + headerMsg->GetDeviceType();
-    socket->Skip(headerMsg->GetBodySizeToRead(), 0);
-    socket->CloseSocket();
-    return COMMAND_STATUS_FAILED;
+    return "";
   }
-  // Get the reply string
-  reply=ReceiveString(socket, headerMsg);
-
-  //------------------------------------------------------------
-  // Close connection
-  socket->CloseSocket();
-
-  return COMMAND_STATUS_SUCCESS;
+  return mappedImageIt->second;
 }
 
-int ExitMatlab()
+// Write progress reported by the Matlab function to the standard output in the format
+// that Slicer displays on the module's progress bar.
+// Progress string contains the completed fraction (or '-' if not known), a space, and the status message.
+void ReportProgress(const std::string &progress)
 {
-  igtl::ClientSocket::Pointer socket = igtl::ClientSocket::New();
-  int connectErrorCode = socket->ConnectToServer(MATLAB_DEFAULT_HOST.c_str(), MATLAB_DEFAULT_PORT);
-  if (connectErrorCode!=0)
+  std::string::size_type separatorPos=progress.find(' ');
+  std::string fraction=progress.substr(0, separatorPos);
+  std::string message=(separatorPos==std::string::npos ? "" : progress.substr(separatorPos+1));
+  if (!fraction.empty() && fraction!="-")
   {
-    // The server has not been started, nothing to do
-    std::cout << "Matlab process is already stopped" << std::endl;
-    return EXIT_SUCCESS;
+    std::cout << "<filter-progress>" << fraction << "</filter-progress>" << std::endl;
   }
-
-  std::string cmd = "exit";
-
-  //------------------------------------------------------------
-  // Send command
-  igtl::StringMessage::Pointer stringMsg;
-  stringMsg = igtl::StringMessage::New();
-  stringMsg->SetDeviceName("CMD");
-  std::cout << "Sending string: " << cmd << std::endl;
-  stringMsg->SetString(cmd.c_str());
-  stringMsg->Pack();
-  socket->SetSendTimeout(5000); // timeout in msec
-  if (!socket->Send(stringMsg->GetPackPointer(), stringMsg->GetPackSize()))
+  if (!message.empty())
   {
-    // Failed to send the message
-    std::cerr << "Failed to send message to Matlab process" << std::endl;
-    socket->CloseSocket();
-    return COMMAND_STATUS_FAILED;
+    // Comment has to be in a single line
+    std::replace( message.begin(), message.end(), '\r', ' ');
+    std::replace( message.begin(), message.end(), '\n', ' ');
+    std::cout << "<filter-comment>" << message << "</filter-comment>" << std::endl;
   }
-
-  // Close connection
-  socket->CloseSocket();
-
-  std::cout << "Matlab process exit requested" << std::endl;
-  return EXIT_SUCCESS;  
 }
 
-
-int CallMatlabFunction(int argc, char * argv [])
+// Returns the output files of the command that are received in messages of the device type
+// (output images, meshes, or return parameters). Returns NULL if the device type is not used for outputs.
+const std::map<std::string, std::string>* GetOutputFiles(const DataTransferInfo* dataTransfer, const std::string& deviceType)
 {
-  // Search for the --returnparameterfile argument. If it is present then arguments shall be returned.
-  const std::string returnParameterFileArgName="--returnparameterfile";
-  std::string returnParameterFileArgValue;
-  for (int argvIndex=3; argvIndex<argc; argvIndex++)
+  if (deviceType=="IMAGE")
   {
-    if (returnParameterFileArgName.compare(argv[argvIndex])==0)
-    {
-      // found the return parameter file name
-      if (argvIndex+1>=argc)
-      {
-        std::cerr << "ERROR: --returnparameterfile value is not defined" << std::endl;
-        break;
-      }
-      returnParameterFileArgValue=argv[argvIndex+1];
-      if ( returnParameterFileArgValue.at(0) == '"' ) 
-      {
-        // this is a quoted string => remove the quotes (Matlab uses different quotes anyway)
-        returnParameterFileArgValue.erase( 0, 1 ); // erase the first character
-        returnParameterFileArgValue.erase( returnParameterFileArgValue.size() - 1 ); // erase the last character
-      }
-      break;
-    }
+    return &dataTransfer->OutputImageFiles;
   }
-
-  std::string cmd;
-
-  // Change directory to the current working directory (where the Matlab function .m file is located)
-  cmd += "cd('"+vtksys::SystemTools::GetCurrentWorkingDirectory()+"'); "; 
-
-  // No return value:
-  //   myfunction( cli_argsread({"--paramName1","paramValue1",...}) );
-  // With return value:
-  //   cli_argswrite( myfunction( cli_argsread({"--paramName1","paramValue1",...}) ) );
-
-  if (!returnParameterFileArgValue.empty())
+  if (deviceType==POLYDATA_MESSAGE_TYPE)
   {
-    // with return value
-    cmd+="cli_argswrite('"+returnParameterFileArgValue+"',";
+    return &dataTransfer->OutputGeometryFiles;
   }
-  std::string functionName=argv[2];
-  cmd+=functionName+"(cli_argsread({";
+  if (deviceType==PARAMETERS_MESSAGE_TYPE)
+  {
+    return &dataTransfer->OutputParameterFiles;
+  }
+  return NULL;
+}
 
-  for (int argvIndex=3; argvIndex<argc; argvIndex++)
+// Returns the data transfer info of the command (the current one or another pending command) that expects
+// an output data object of the device type from the device. Returns NULL if no command expects it.
+const DataTransferInfo* FindOutputDataTransfer(const DataTransferInfo* dataTransfer, const std::string& deviceName, const std::string& deviceType)
+{
+  std::vector<const DataTransferInfo*> dataTransfers(1, dataTransfer);
+  for (PendingCommandMapType::iterator pendingCommandIt=PendingCommands.begin(); pendingCommandIt!=PendingCommands.end(); ++pendingCommandIt)
   {
-    std::string arg=argv[argvIndex];
-    if ( arg.at(0) == '"' ) 
+    dataTransfers.push_back(pendingCommandIt->second.DataTransfer);
+  }
+  for (std::vector<const DataTransferInfo*>::iterator dataTransferIt=dataTransfers.begin(); dataTransferIt!=dataTransfers.end(); ++dataTransferIt)
+  {
+    if (*dataTransferIt==NULL)
     {
-      // this is a quoted string => remove the quotes (Matlab uses different quotes anyway)
-      arg.erase( 0, 1 ); // erase the first character
-      arg.erase( arg.size() - 1 ); // erase the last character
+      continue;
     }
-    cmd+=std::string("'")+arg+"'";
-    if (argvIndex+1<argc)
+    const std::map<std::string, std::string>* outputFiles=GetOutputFiles(*dataTransferIt, deviceType);
+    if (outputFiles!=NULL && outputFiles->find(deviceName)!=outputFiles->end())
     {
-      // not the last argument, so add a separator
-      cmd+=",";
+      return *dataTransferIt;
     }
   }
-  cmd+="}))";
-  if (!returnParameterFileArgValue.empty())
-  {
-    // with return value
-    cmd+=")";
-  }
-  cmd+=";";
-
-  std::cout << "Command: " << cmd << std::endl;
+  return NULL;
+}
 
-  std::string reply;
-  ExecuteMatlabCommandStatus status=ExecuteMatlabCommand(MATLAB_DEFAULT_HOST, MATLAB_DEFAULT_PORT, cmd, reply);
-  if (status!=COMMAND_STATUS_SUCCESS)
+// Receive messages until the STRING message with the requested device name arrives.
+// Progress messages (sent from the PRG_uid device while the command is running) are reported on the standard output.
+// Output data objects that are sent before the reply are written to the requested files.
+// Replies and outputs of other pending commands are stored (the server may complete pipelined commands in any order).
+// Messages sent to other devices (e.g., replies to earlier, abandoned commands) are skipped.
+// connectionLost is set to true if the connection was closed before any reply was received.
+// If replyWriter is specified then the reply is passed to it while it is received (reply is set to an empty string),
+// so that a long reply is not stored in memory.
+ExecuteMatlabCommandStatus ReceiveReply(igtl::Socket * socket, const std::string &replyDeviceName, std::string &reply, int receiveTimeoutMsec, bool &connectionLost,
+  const DataTransferInfo* dataTransfer, StringBlockWriter* replyWriter = NULL)
+{
+  connectionLost=false;
+  PendingCommandMapType::iterator pendingCommandIt=PendingCommands.find(replyDeviceName);
+  if (pendingCommandIt!=PendingCommands.end())
   {
-    std::cerr << reply << std::endl;
-    return EXIT_FAILURE;
+    bool replyReceived=pendingCommandIt->second.ReplyReceived;
+    reply=pendingCommandIt->second.Reply;
+    CommandTiming.ServerTimingJson=pendingCommandIt->second.ServerTimingJson;
+    PendingCommands.erase(pendingCommandIt);
+    if (replyReceived)
+    {
+      // the reply arrived while waiting for the reply of another command
+      if (replyWriter!=NULL)
+      {
+        replyWriter->Write(reply.data(), reply.size());
+        reply.clear();
+      }
+      return COMMAND_STATUS_SUCCESS;
+    }
   }
-  // Response is usually 'OK' (if the function did not have any output) or some printouts.
-  // In case of an error, the response starts with ERROR:...
-  if (reply.size()>RESPONSE_ERROR_PREFIX.size() && reply.compare(0,RESPONSE_ERROR_PREFIX.size(),RESPONSE_ERROR_PREFIX)==0)
+  // Reply device name is ACK_uid, progress device name is PRG_uid, server timing device name is TIM_uid
+  const std::string progressDeviceName=std::string("PRG")+replyDeviceName.substr(3);
+  const std::string timingDeviceName=std::string("TIM")+replyDeviceName.substr(3);
+  if (receiveTimeoutMsec>0)
   {
-    // the response starts with "ERROR:", so the execution failed
-    std::cerr << "Failed to execute Matlab function: " << functionName << ", received the following error message: " << std::endl;
-    std::cerr << reply << std::endl;
-    return EXIT_FAILURE;
+    socket->SetReceiveTimeout(receiveTimeoutMsec); // timeout in msec
+  }
+  while (true)
+  {
+    // Create a message buffer to receive header
+    igtl::MessageHeader::Pointer headerMsg;
+    headerMsg = igtl::MessageHeader::New();
+    // Initialize receive buffer
+    headerMsg->InitPack();
+    // Receive generic header from the socket
+    bool receiveTimedOut = false;
+    int receivedBytes = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize(), receiveTimedOut);
+    if (receivedBytes == 0)
+    {
+      reply="No reply";
+      connectionLost=true;
+      return COMMAND_STATUS_FAILED;
+    }
+    if (receivedBytes != static_cast<int>(headerMsg->GetPackSize()) || receiveTimedOut)
+    {
+      reply = "Bad reply";
+      return COMMAND_STATUS_FAILED;
+    }
+    // Deserialize the header
+    igtlUint64 bodyCrc=GetPackedHeaderBodyCrc(headerMsg);
+    headerMsg->Unpack();
+    const std::string deviceName=headerMsg->GetDeviceName();
+    if (strcmp(headerMsg->GetDeviceType(), "IMAGE") == 0)
+    {
+      const DataTransferInfo* outputDataTransfer=FindOutputDataTransfer(dataTransfer, deviceName, "IMAGE");
+      if (outputDataTransfer!=NULL)
+      {
+        std::map<std::string, std::string>::const_iterator outputImageIt=outputDataTransfer->OutputImageFiles.find(deviceName);
+        std::cout << "Receiving image: " << outputImageIt->second << std::endl;
+        double outputWriteStartTime=vtksys::SystemTools::GetTime();
+        bool outputWriteSuccess=ReceiveImageToFile(socket, headerMsg, bodyCrc, outputImageIt->second, GetMappedImageFile(outputDataTransfer, outputImageIt->first));
+        CommandTiming.OutputWriteSec+=vtksys::SystemTools::GetTime()-outputWriteStartTime;
+        if (!outputWriteSuccess)
+        {
+          reply = "ERROR: Failed to receive output image " + outputImageIt->second;
+          return COMMAND_STATUS_FAILED;
+        }
+        continue;
+      }
+    }
+    if (strcmp(headerMsg->GetDeviceType(), POLYDATA_MESSAGE_TYPE) == 0)
+    {
+      const DataTransferInfo* outputDataTransfer=FindOutputDataTransfer(dataTransfer, deviceName, POLYDATA_MESSAGE_TYPE);
+      if (outputDataTransfer!=NULL)
+      {
+        std::map<std::string, std::string>::const_iterator outputGeometryIt=outputDataTransfer->OutputGeometryFiles.find(deviceName);
+        std::cout << "Receiving mesh: " << outputGeometryIt->second << std::endl;
+        double outputWriteStartTime=vtksys::SystemTools::GetTime();
+        bool outputWriteSuccess=ReceiveGeometryToFile(socket, headerMsg, bodyCrc, outputGeometryIt->second);
+        CommandTiming.OutputWriteSec+=vtksys::SystemTools::GetTime()-outputWriteStartTime;
+        if (!outputWriteSuccess)
+        {
+          reply = "ERROR: Failed to receive output mesh " + outputGeometryIt->second;
+          return COMMAND_STATUS_FAILED;
+        }
+        continue;
+      }
+    }
+    if (strcmp(headerMsg->GetDeviceType(), PARAMETERS_MESSAGE_TYPE) == 0)
+    {
+      const DataTransferInfo* outputDataTransfer=FindOutputDataTransfer(dataTransfer, deviceName, PARAMETERS_MESSAGE_TYPE);
+      if (outputDataTransfer!=NULL)
+      {
+        std::map<std::string, std::string>::const_iterator outputParameterIt=outputDataTransfer->OutputParameterFiles.find(deviceName);
+        if (!ReceiveParametersToFile(socket, headerMsg, bodyCrc, outputParameterIt->second))
+        {
+          reply = "ERROR: Failed to receive return parameters " + outputParameterIt->second;
+          return COMMAND_STATUS_FAILED;
+        }
+        continue;
+      }
+    }
+    if (progressDeviceName.compare(headerMsg->GetDeviceName())==0 && IsStringMessage(headerMsg))
+    {
+      ReportProgress(ReceiveString(socket, headerMsg, bodyCrc, IsBodyCrcCheckRequired(bodyCrc)));
+      continue;
+    }
+    if (timingDeviceName.compare(headerMsg->GetDeviceName())==0 && IsStringMessage(headerMsg))
+    {
+      CommandTiming.ServerTimingJson=ReceiveString(socket, headerMsg, bodyCrc, IsBodyCrcCheckRequired(bodyCrc));
+      continue;
+    }
+    // Device names of other pending commands are ACK_uid, PRG_uid, TIM_uid
+    PendingCommandMapType::iterator otherCommandIt=PendingCommands.end();
+    if (deviceName.size()>3 && IsStringMessage(headerMsg))
+    {
+      otherCommandIt=PendingCommands.find("ACK"+deviceName.substr(3));
+    }
+    if (otherCommandIt!=PendingCommands.end())
+    {
+      bool isReply=(deviceName.compare(0, 3, "ACK")==0);
+      std::string str=(isReply ? ReceiveReplyString(socket, headerMsg, bodyCrc) : ReceiveString(socket, headerMsg, bodyCrc, IsBodyCrcCheckRequired(bodyCrc)));
+      if (isReply)
+      {
+        otherCommandIt->second.Reply=str;
+        otherCommandIt->second.ReplyReceived=true;
+      }
+      else if (deviceName.compare(0, 3, "TIM")==0)
+      {
+        otherCommandIt->second.ServerTimingJson=str;
+      }
+      else if (deviceName.compare(0, 3, "PRG")==0)
+      {
+        ReportProgress(str);
+      }
+      continue;
+    }
+    if (replyDeviceName.compare(headerMsg->GetDeviceName())!=0)
+    {
+      std::cerr << "WARNING: Ignoring message received from device " << headerMsg->GetDeviceName()
+        << " while waiting for reply from " << replyDeviceName << std::endl;
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      continue;
+    }
+    if (!IsStringMessage(headerMsg))
+    {
+      reply = std::string("Receiving unsupported message type: ") + headerMsg->GetDeviceType();
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      return COMMAND_STATUS_FAILED;
+    }
+    // Get the reply string
+    if (replyWriter!=NULL)
+    {
+      reply.clear();
+      if (!ReceiveString(socket, headerMsg, bodyCrc, IsBodyCrcCheckRequired(bodyCrc), *replyWriter))
+      {
+        reply="ERROR: Failed to receive the reply";
+        return COMMAND_STATUS_FAILED;
+      }
+      return COMMAND_STATUS_SUCCESS;
+    }
+    reply=ReceiveReplyString(socket, headerMsg, bodyCrc);
+    return COMMAND_STATUS_SUCCESS;
+  }
+}
+
+// Returns the command argument list that specifies the file name (and memory-mapped file name) of a transferred image
+std::string GetDataTransferArgs(const DataTransferInfo* dataTransfer, const std::string& deviceName, const std::string& filename)
+{
+  std::string args="'"+deviceName+"','"+filename+"'";
+  std::string mappedFilename=GetMappedImageFile(dataTransfer, deviceName);
+  if (!mappedFilename.empty())
+  {
+    args+=",'"+mappedFilename+"'";
+  }
+  return args;
+}
+
+// Send input images and meshes and build the command prefix that tells the server which files are transferred through the connection.
+// Returns false if the connection is broken.
+bool SendDataObjects(igtl::Socket * socket, const DataTransferInfo* dataTransfer, std::string &cmdPrefix)
+{
+  cmdPrefix.clear();
+  if (dataTransfer==NULL)
+  {
+    return true;
+  }
+  if (dataTransfer->SendInputParameters)
+  {
+    std::vector<char> parametersMsg=PackParametersMessage(PARAMETERS_INPUT_DEVICE_NAME, dataTransfer->InputParameters);
+    if (!socket->Send(&parametersMsg[0], parametersMsg.size()))
+    {
+      return false;
+    }
+    cmdPrefix+=std::string("cli_datatransfer('input','")+PARAMETERS_INPUT_DEVICE_NAME+"','"+PARAMETERS_INPUT_DEVICE_NAME+"'); ";
+  }
+  for (std::map<std::string, std::string>::const_iterator outputParameterIt=dataTransfer->OutputParameterFiles.begin();
+    outputParameterIt!=dataTransfer->OutputParameterFiles.end(); ++outputParameterIt)
+  {
+    cmdPrefix+="cli_datatransfer('output','"+outputParameterIt->first+"','"+outputParameterIt->second+"'); ";
+  }
+  for (std::map<std::string, std::string>::const_iterator inputImageIt=dataTransfer->InputImageFiles.begin();
+    inputImageIt!=dataTransfer->InputImageFiles.end(); ++inputImageIt)
+  {
+    double inputReadStartTime=vtksys::SystemTools::GetTime();
+    igtl::ImageMessage::Pointer imageMsg=ReadImageMessageFromFile(inputImageIt->second, inputImageIt->first,
+      GetMappedImageFile(dataTransfer, inputImageIt->first));
+    CommandTiming.InputReadSec+=vtksys::SystemTools::GetTime()-inputReadStartTime;
+    if (imageMsg.IsNull())
+    {
+      // Image cannot be sent in a message, Matlab will read it from the file
+      std::cout << "Image is passed to Matlab as file: " << inputImageIt->second << std::endl;
+      continue;
+    }
+    std::cout << "Sending image: " << inputImageIt->second << std::endl;
+    if (!socket->Send(imageMsg->GetPackPointer(), imageMsg->GetPackSize()))
+    {
+      return false;
+    }
+    cmdPrefix+="cli_datatransfer('input',"+GetDataTransferArgs(dataTransfer, inputImageIt->first, inputImageIt->second)+"); ";
+  }
+  for (std::map<std::string, std::string>::const_iterator outputImageIt=dataTransfer->OutputImageFiles.begin();
+    outputImageIt!=dataTransfer->OutputImageFiles.end(); ++outputImageIt)
+  {
+    cmdPrefix+="cli_datatransfer('output',"+GetDataTransferArgs(dataTransfer, outputImageIt->first, outputImageIt->second)+"); ";
+  }
+  for (std::map<std::string, std::string>::const_iterator inputGeometryIt=dataTransfer->InputGeometryFiles.begin();
+    inputGeometryIt!=dataTransfer->InputGeometryFiles.end(); ++inputGeometryIt)
+  {
+    double inputReadStartTime=vtksys::SystemTools::GetTime();
+    std::vector<char> polyDataMsg=ReadPolyDataMessageFromFile(inputGeometryIt->second, inputGeometryIt->first);
+    CommandTiming.InputReadSec+=vtksys::SystemTools::GetTime()-inputReadStartTime;
+    if (polyDataMsg.empty())
+    {
+      // Mesh cannot be sent in a message, Matlab will read it from the file
+      std::cout << "Mesh is passed to Matlab as file: " << inputGeometryIt->second << std::endl;
+      continue;
+    }
+    std::cout << "Sending mesh: " << inputGeometryIt->second << std::endl;
+    if (!socket->Send(&polyDataMsg[0], polyDataMsg.size()))
+    {
+      return false;
+    }
+    cmdPrefix+="cli_datatransfer('input','"+inputGeometryIt->first+"','"+inputGeometryIt->second+"'); ";
+  }
+  for (std::map<std::string, std::string>::const_iterator outputGeometryIt=dataTransfer->OutputGeometryFiles.begin();
+    outputGeometryIt!=dataTransfer->OutputGeometryFiles.end(); ++outputGeometryIt)
+  {
+    cmdPrefix+="cli_datatransfer('output','"+outputGeometryIt->first+"','"+outputGeometryIt->second+"'); ";
+  }
+  return true;
+}
+
+// Remove the memory-mapped files that were used for exchanging voxels with Matlab
+void RemoveMappedImageFiles(const DataTransferInfo& dataTransfer)
+{
+  for (std::map<std::string, std::string>::const_iterator mappedImageIt=dataTransfer.MappedImageFiles.begin();
+    mappedImageIt!=dataTransfer.MappedImageFiles.end(); ++mappedImageIt)
+  {
+    if (vtksys::SystemTools::FileExists(mappedImageIt->second.c_str(), true))
+    {
+      vtksys::SystemTools::RemoveFile(mappedImageIt->second);
+    }
+  }
+}
+
+// If replyWriter is specified then the reply is passed to it while it is received, instead of returning it in reply.
+ExecuteMatlabCommandStatus ExecuteMatlabCommand(const std::string& hostname, int port, const std::string &cmd, std::string &reply, int receiveTimeoutMsec = 0,
+  const DataTransferInfo* dataTransfer = NULL, bool startServer = true, StringBlockWriter* replyWriter = NULL)
+{
+  // Commands are sent to CMD_uid device, the server sends the reply from ACK_uid device
+  std::ostringstream commandUid;
+  commandUid << ++LastCommandUid;
+  const std::string commandDeviceName=std::string("CMD_")+commandUid.str();
+  const std::string replyDeviceName=std::string("ACK_")+commandUid.str();
+  CheckMessageCrc=IsMessageCrcCheckRequired(hostname);
+
+  // If a previously opened connection is reused then the server may have closed it since the
+  // last command (e.g., because of keep-alive timeout). In this case we reconnect and send the command again.
+  const int maxNumberOfAttempts=2;
+  for (int attempt=0; attempt<maxNumberOfAttempts; attempt++)
+  {
+    bool reusedConnection=false;
+    double phaseStartTime=vtksys::SystemTools::GetTime();
+    igtl::ClientSocket::Pointer socket=GetConnection(hostname, port, startServer, reusedConnection);
+    CommandTiming.ConnectSec+=vtksys::SystemTools::GetTime()-phaseStartTime;
+    if (socket.IsNull())
+    {
+      reply="ERROR: Cannot connect to the server";
+      return COMMAND_STATUS_CONNECTION_FAILED;
+    }
+
+    //------------------------------------------------------------
+    // Send command
+    phaseStartTime=vtksys::SystemTools::GetTime();
+    std::string cmdPrefix;
+    bool sendSuccess=SendDataObjects(socket, dataTransfer, cmdPrefix) && SendReplyPolicy(socket, commandUid.str());
+    if (sendSuccess)
+    {
+      std::cout << "Sending string: " << cmdPrefix << cmd << std::endl;
+      sendSuccess=SendString(socket, commandDeviceName, cmdPrefix+cmd);
+    }
+    CommandTiming.SendSec+=vtksys::SystemTools::GetTime()-phaseStartTime;
+    if (!sendSuccess)
+    {
+      CloseConnection(hostname, port);
+      if (reusedConnection)
+      {
+        continue;
+      }
+      // Failed to send the message
+      std::cerr << "Failed to send message to Matlab process" << std::endl;
+      return COMMAND_STATUS_FAILED;
+    }
+
+    //------------------------------------------------------------
+    // Receive reply
+    bool connectionLost=false;
+    phaseStartTime=vtksys::SystemTools::GetTime();
+    ExecuteMatlabCommandStatus status=ReceiveReply(socket, replyDeviceName, reply, receiveTimeoutMsec, connectionLost, dataTransfer, replyWriter);
+    CommandTiming.ReceiveSec+=vtksys::SystemTools::GetTime()-phaseStartTime;
+    std::map<std::string, double>::iterator serverStartTimeIt=ServerStartTimes.find(GetConnectionKey(hostname, port));
+    if (serverStartTimeIt!=ServerStartTimes.end())
+    {
+      std::cout << "Matlab startup to first command completion: "
+        << vtksys::SystemTools::GetTime()-serverStartTimeIt->second << "sec" << std::endl;
+      ServerStartTimes.erase(serverStartTimeIt);
+    }
+    if (status!=COMMAND_STATUS_SUCCESS)
+    {
+      // The connection is in an unknown state, do not reuse it
+      CloseConnection(hostname, port);
+      if (connectionLost && reusedConnection)
+      {
+        continue;
+      }
+    }
+    return status;
+  }
+
+  reply="ERROR: Cannot connect to the server";
+  return COMMAND_STATUS_FAILED;
+}
+
+int ExitMatlab(const std::string& hostname=MATLAB_DEFAULT_HOST, int port=MATLAB_DEFAULT_PORT)
+{
+  bool reusedConnection=false;
+  igtl::ClientSocket::Pointer socket=GetConnection(hostname, port, false, reusedConnection);
+  if (socket.IsNull())
+  {
+    // The server has not been started, nothing to do
+    std::cout << "Matlab process is already stopped" << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  std::string cmd = "exit";
+
+  //------------------------------------------------------------
+  // Send command
+  std::cout << "Sending string: " << cmd << std::endl;
+  if (!SendString(socket, "CMD", cmd))
+  {
+    // Failed to send the message
+    std::cerr << "Failed to send message to Matlab process" << std::endl;
+    CloseConnection(hostname, port);
+    return COMMAND_STATUS_FAILED;
+  }
+
+  // Close connection
+  CloseConnection(hostname, port);
+
+  std::cout << "Matlab process exit requested" << std::endl;
+  return EXIT_SUCCESS;  
+}
+
+int GetNumberOfMatlabWorkers()
+{
+  const char* numberOfWorkersEnvValue=getenv(NUMBER_OF_WORKERS_ENV_VAR_NAME);
+  if (numberOfWorkersEnvValue==NULL)
+  {
+    return 1;
+  }
+  int numberOfWorkers=atoi(numberOfWorkersEnvValue);
+  if (numberOfWorkers<1)
+  {
+    std::cerr << "WARNING: Invalid number of Matlab workers: " << numberOfWorkersEnvValue << ", use 1 worker" << std::endl;
+    return 1;
+  }
+  return numberOfWorkers;
+}
+
+MatlabWorkerPool::SchedulingPolicy GetMatlabWorkerSchedulingPolicy()
+{
+  MatlabWorkerPool::SchedulingPolicy policy=MatlabWorkerPool::SCHEDULING_LEAST_LOADED;
+  const char* schedulingEnvValue=getenv(WORKER_SCHEDULING_ENV_VAR_NAME);
+  if (schedulingEnvValue!=NULL && !MatlabWorkerPool::GetSchedulingPolicyFromString(schedulingEnvValue, policy))
+  {
+    std::cerr << "WARNING: Invalid Matlab worker scheduling policy: " << schedulingEnvValue << ", use leastloaded" << std::endl;
+  }
+  return policy;
+}
+
+// Start all the Matlab workers of the pool (that are not running yet) and wait until they are ready to execute commands.
+// Workers are started at the same time, so total startup time is about the same as starting a single worker.
+int StartMatlabWorkers(const std::string& hostname=MATLAB_DEFAULT_HOST, int port=MATLAB_DEFAULT_PORT)
+{
+  int result=EXIT_SUCCESS;
+  std::map<int, double> startedWorkers; // port, start time
+  const int numberOfWorkers=GetNumberOfMatlabWorkers();
+  for (int workerIndex=0; workerIndex<numberOfWorkers; workerIndex++)
+  {
+    igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+    if (socket->ConnectToServer(hostname.c_str(), port+workerIndex)==0)
+    {
+      std::cout << "Matlab server at port " << port+workerIndex << " is already running" << std::endl;
+      socket->CloseSocket();
+      continue;
+    }
+    double serverStartTime=vtksys::SystemTools::GetTime();
+    if (!StartMatlabServer(port+workerIndex))
+    {
+      std::cerr << "ERROR: Failed to start Matlab process" << std::endl;
+      result=EXIT_FAILURE;
+      continue;
+    }
+    startedWorkers[port+workerIndex]=serverStartTime;
+  }
+  for (std::map<int, double>::iterator startedWorkerIt=startedWorkers.begin(); startedWorkerIt!=startedWorkers.end(); ++startedWorkerIt)
+  {
+    igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+    if (!WaitForMatlabServer(socket, hostname, startedWorkerIt->first, startedWorkerIt->second))
+    {
+      result=EXIT_FAILURE;
+      continue;
+    }
+    socket->CloseSocket();
+  }
+  return result;
+}
+
+// Exit all the Matlab workers of the pool that starts at the specified port
+int ExitMatlabWorkers(const std::string& hostname=MATLAB_DEFAULT_HOST, int port=MATLAB_DEFAULT_PORT)
+{
+  int result=EXIT_SUCCESS;
+  const int numberOfWorkers=GetNumberOfMatlabWorkers();
+  for (int workerIndex=0; workerIndex<numberOfWorkers; workerIndex++)
+  {
+    if (ExitMatlab(hostname, port+workerIndex)!=EXIT_SUCCESS)
+    {
+      result=EXIT_FAILURE;
+    }
+  }
+  return result;
+}
+
+
+// Returns true if the argument is a volume file name that Slicer passes to the CLI module
+bool IsImageFileName(const std::string& arg)
+{
+  std::string extension=vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(arg));
+  return (extension==".nrrd" || extension==".nhdr");
+}
+
+// Returns true if the argument is a mesh file name that Slicer passes to the CLI module
+bool IsGeometryFileName(const std::string& arg)
+{
+  std::string extension=vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(arg));
+  return (extension==".ply" || extension==".stl");
+}
+
+// Returns the name of the file that is used for exchanging voxels of an image with Matlab through shared memory.
+// On Linux the file is created in /dev/shm, so it is kept in memory and never written to disk,
+// on other systems the file is created next to the image file and the mapped pages are
+// shared through the file system cache.
+// The name contains the process ID and the image device name (argument index and command uid in batch mode),
+// so that concurrent MatlabCommander processes and images of the same command never use the same file.
+std::string GetMappedImageFileName(const std::string& imageFilename, const std::string& deviceName)
+{
+  std::string directory="/dev/shm";
+  if (!vtksys::SystemTools::FileIsDirectory(directory))
+  {
+    directory=vtksys::SystemTools::GetFilenamePath(imageFilename);
+  }
+#ifdef _WIN32
+  int processId=_getpid();
+#else
+  int processId=static_cast<int>(getpid());
+#endif
+  std::ostringstream filename;
+  filename << directory << "/MatlabCommander_" << processId << "_" << deviceName << ".raw";
+  return filename.str();
+}
+
+// Returns the value of the --returnparameterfile argument of a Matlab function call
+// (MatlabCommander arguments: --call-matlab-function function_name parameter1 parameter2 ...).
+// Returns empty string if the argument is not present.
+std::string GetReturnParameterFileName(int argc, char * argv [])
+{
+  // Search for the --returnparameterfile argument
+  const std::string returnParameterFileArgName="--returnparameterfile";
+  std::string returnParameterFileArgValue;
+  for (int argvIndex=3; argvIndex<argc; argvIndex++)
+  {
+    if (returnParameterFileArgName.compare(argv[argvIndex])==0)
+    {
+      // found the return parameter file name
+      if (argvIndex+1>=argc)
+      {
+        std::cerr << "ERROR: --returnparameterfile value is not defined" << std::endl;
+        break;
+      }
+      returnParameterFileArgValue=argv[argvIndex+1];
+      if ( returnParameterFileArgValue.at(0) == '"' ) 
+      {
+        // this is a quoted string => remove the quotes (Matlab uses different quotes anyway)
+        returnParameterFileArgValue.erase( 0, 1 ); // erase the first character
+        returnParameterFileArgValue.erase( returnParameterFileArgValue.size() - 1 ); // erase the last character
+      }
+      break;
+    }
+  }
+  return returnParameterFileArgValue;
+}
+
+// Returns the arguments of a Matlab function call that determine its results (all arguments, except the
+// return parameter file), for computing the result cache key
+std::vector<std::string> GetResultCacheArguments(int argc, char * argv [])
+{
+  const std::string returnParameterFileArgName="--returnparameterfile";
+  std::vector<std::string> args;
+  for (int argvIndex=3; argvIndex<argc; argvIndex++)
+  {
+    if (returnParameterFileArgName.compare(argv[argvIndex])==0)
+    {
+      // skip the argument name and value
+      argvIndex++;
+      continue;
+    }
+    std::string arg=argv[argvIndex];
+    if (!arg.empty() && arg.at(0) == '"')
+    {
+      // this is a quoted string => remove the quotes
+      arg=arg.substr(1, arg.size()-2);
+    }
+    args.push_back(arg);
+  }
+  return args;
+}
+
+// Returns the maximum size of the result cache in bytes
+unsigned long long GetResultCacheSize()
+{
+  unsigned long long cacheSizeMB=DEFAULT_RESULT_CACHE_SIZE_MB;
+  const char* cacheSizeEnvValue=getenv(RESULT_CACHE_SIZE_ENV_VAR_NAME);
+  if (cacheSizeEnvValue!=NULL)
+  {
+    std::istringstream cacheSizeStream(cacheSizeEnvValue);
+    if (!(cacheSizeStream >> cacheSizeMB))
+    {
+      std::cerr << "WARNING: Invalid result cache size: " << cacheSizeEnvValue << ". Using default size." << std::endl;
+      cacheSizeMB=DEFAULT_RESULT_CACHE_SIZE_MB;
+    }
+  }
+  return cacheSizeMB*1024*1024;
+}
+
+// Get the reply policy of Matlab function calls from the environment variable (mode[:maxlength]).
+// If it is not set or invalid then the complete output is returned.
+ReplyPolicyInfo GetReplyPolicyFromEnvironment()
+{
+  ReplyPolicyInfo policy;
+  const char* policyEnvValue=getenv(REPLY_POLICY_ENV_VAR_NAME);
+  if (policyEnvValue==NULL || strlen(policyEnvValue)==0)
+  {
+    return policy;
+  }
+  std::string policyStr=policyEnvValue;
+  size_t separatorPosition=policyStr.find(':');
+  policy.Mode=policyStr.substr(0, separatorPosition);
+  bool valid=(policy.Mode==REPLY_POLICY_FULL || policy.Mode==REPLY_POLICY_TRUNCATE || policy.Mode==REPLY_POLICY_TAIL
+    || policy.Mode==REPLY_POLICY_FILE || policy.Mode==REPLY_POLICY_NONE);
+  if (valid && separatorPosition!=std::string::npos)
+  {
+    std::istringstream maxLengthStream(policyStr.substr(separatorPosition+1));
+    valid=((maxLengthStream >> policy.MaxLength) && policy.MaxLength>0);
+  }
+  if (!valid)
+  {
+    std::cerr << "WARNING: Invalid reply policy: " << policyEnvValue << ". Complete output is returned." << std::endl;
+    return ReplyPolicyInfo();
+  }
+  return policy;
+}
+
+// Returns the Matlab command that calls a Matlab function with the arguments specified in argv
+// (MatlabCommander arguments: --call-matlab-function function_name parameter1 parameter2 ...).
+// If dataTransfer is specified then the parameters are sent in a PARAMS message instead of the command string
+// and images that can be transferred through the connection are added to it.
+std::string GetMatlabFunctionCommand(int argc, char * argv [], DataTransferInfo* dataTransfer)
+{
+  // If the --returnparameterfile argument is present then arguments shall be returned.
+  std::string returnParameterFileArgValue=GetReturnParameterFileName(argc, argv);
+
+  std::string cmd;
+
+  // Change directory to the current working directory (where the Matlab function .m file is located)
+  // and reload the functions that have been modified since they were last used
+  const std::string workingDirectory=vtksys::SystemTools::GetCurrentWorkingDirectory();
+  cmd += "cd('"+workingDirectory+"'); "; 
+  cmd += "cli_reload('update','"+workingDirectory+"'); ";
+
+  // No return value:
+  //   myfunction( cli_argsread({"--paramName1","paramValue1",...}) );
+  // With return value:
+  //   cli_argswrite( myfunction( cli_argsread({"--paramName1","paramValue1",...}) ) );
+  // If parameters are transferred in messages then the argument list is replaced by the input parameters device name
+  // and the return values are sent back in a message from the output parameters device:
+  //   cli_argswrite( myfunction( cli_argsread('PRM_IN') ) );
+
+  if (!returnParameterFileArgValue.empty())
+  {
+    // with return value
+    cmd+="cli_argswrite('"+returnParameterFileArgValue+"',";
+  }
+  std::string functionName=argv[2];
+  cmd+=functionName+"(cli_argsread(";
+  std::string argsList="{";
+  std::vector<std::string> args;
+
+  // Images may be transferred in messages instead of files
+  const char* imageTransferEnvValue=(dataTransfer!=NULL ? getenv(IMAGE_TRANSFER_ENV_VAR_NAME) : NULL);
+  bool transferImagesInSharedMemory=(imageTransferEnvValue!=NULL && IMAGE_TRANSFER_SHARED_MEMORY.compare(imageTransferEnvValue)==0);
+  bool transferImagesInMessages=transferImagesInSharedMemory
+    || (imageTransferEnvValue!=NULL && IMAGE_TRANSFER_MESSAGE.compare(imageTransferEnvValue)==0);
+  // Meshes may be transferred in messages instead of files
+  const char* geometryTransferEnvValue=(dataTransfer!=NULL ? getenv(GEOMETRY_TRANSFER_ENV_VAR_NAME) : NULL);
+  bool transferGeometryInMessages=(geometryTransferEnvValue!=NULL && GEOMETRY_TRANSFER_MESSAGE.compare(geometryTransferEnvValue)==0);
+
+  for (int argvIndex=3; argvIndex<argc; argvIndex++)
+  {
+    std::string arg=argv[argvIndex];
+    if ( arg.at(0) == '"' ) 
+    {
+      // this is a quoted string => remove the quotes (Matlab uses different quotes anyway)
+      arg.erase( 0, 1 ); // erase the first character
+      arg.erase( arg.size() - 1 ); // erase the last character
+    }
+    if (transferImagesInMessages && IsImageFileName(arg))
+    {
+      // Existing files are inputs, others are outputs that the module will create
+      std::ostringstream deviceName;
+      deviceName << "IMG_" << argvIndex << dataTransfer->DeviceNameSuffix;
+      if (vtksys::SystemTools::FileExists(arg.c_str(), true))
+      {
+        dataTransfer->InputImageFiles[deviceName.str()]=arg;
+      }
+      else
+      {
+        dataTransfer->OutputImageFiles[deviceName.str()]=arg;
+      }
+      if (transferImagesInSharedMemory)
+      {
+        dataTransfer->MappedImageFiles[deviceName.str()]=GetMappedImageFileName(arg, deviceName.str());
+      }
+    }
+    if (transferGeometryInMessages && IsGeometryFileName(arg))
+    {
+      // Existing files are inputs, others are outputs that the module will create
+      std::ostringstream deviceName;
+      deviceName << "MDL_" << argvIndex << dataTransfer->DeviceNameSuffix;
+      if (vtksys::SystemTools::FileExists(arg.c_str(), true))
+      {
+        dataTransfer->InputGeometryFiles[deviceName.str()]=arg;
+      }
+      else
+      {
+        dataTransfer->OutputGeometryFiles[deviceName.str()]=arg;
+      }
+    }
+    args.push_back(arg);
+    argsList+=std::string("'")+arg+"'";
+    if (argvIndex+1<argc)
+    {
+      // not the last argument, so add a separator
+      argsList+=",";
+    }
+  }
+  argsList+="}";
+  if (dataTransfer!=NULL)
+  {
+    dataTransfer->SendInputParameters=true;
+    dataTransfer->InputParameters=ParseMatlabFunctionArguments(args);
+    cmd+=std::string("'")+PARAMETERS_INPUT_DEVICE_NAME+"'";
+    if (!returnParameterFileArgValue.empty())
+    {
+      dataTransfer->OutputParameterFiles[PARAMETERS_OUTPUT_DEVICE_NAME+dataTransfer->DeviceNameSuffix]=returnParameterFileArgValue;
+    }
+  }
+  else
+  {
+    cmd+=argsList;
+  }
+  cmd+="))";
+  if (!returnParameterFileArgValue.empty())
+  {
+    // with return value
+    cmd+=")";
+  }
+  cmd+=";";
+  return cmd;
+}
+
+// Execute the command on a worker of the pool. If the worker cannot be started or connected to then try another one.
+// workerPort is set to the port of the worker that executed the command.
+ExecuteMatlabCommandStatus ExecuteMatlabCommandOnWorker(const std::string &cmd, std::string &reply, const DataTransferInfo* dataTransfer, int &workerPort)
+{
+  reply="ERROR: No Matlab worker is available";
+  ExecuteMatlabCommandStatus status=COMMAND_STATUS_FAILED;
+  MatlabWorkerPool workerPool(MATLAB_DEFAULT_PORT, GetNumberOfMatlabWorkers(), GetMatlabWorkerSchedulingPolicy());
+  double queueWaitStartTime=vtksys::SystemTools::GetTime();
+  for (workerPort=workerPool.ReserveWorker(); workerPort>=0; workerPort=workerPool.ReserveWorker())
+  {
+    CommandTiming.QueueWaitSec+=vtksys::SystemTools::GetTime()-queueWaitStartTime;
+    std::cout << "Execute command on Matlab worker at port " << workerPort << std::endl;
+    double connectStartTime=vtksys::SystemTools::GetTime();
+    bool workerHealthy=GetHealthyWorkerConnection(workerPort).IsNotNull();
+    CommandTiming.ConnectSec+=vtksys::SystemTools::GetTime()-connectStartTime;
+    if (workerHealthy)
+    {
+      workerPool.SetWorkerHealthy(workerPort);
+      // the command is sent on the connection that passed the health check
+      status=ExecuteMatlabCommand(MATLAB_DEFAULT_HOST, workerPort, cmd, reply, 0, dataTransfer);
+      if (status!=COMMAND_STATUS_CONNECTION_FAILED)
+      {
+        break;
+      }
+    }
+    std::cerr << "WARNING: Matlab worker at port " << workerPort << " is not available" << std::endl;
+    workerPool.SetWorkerUnhealthy(workerPort);
+    queueWaitStartTime=vtksys::SystemTools::GetTime();
+  }
+  workerPool.ReleaseWorker();
+  return status;
+}
+
+// Print the duration of the command execution phases as a JSON line (and append it to the timing log file, if specified)
+void ReportCommandTiming(double totalSec, bool success)
+{
+  std::ostringstream timingJson;
+  timingJson << "{\"success\":" << (success ? "true" : "false")
+    << ",\"total\":" << totalSec
+    << ",\"queueWait\":" << CommandTiming.QueueWaitSec
+    << ",\"connect\":" << CommandTiming.ConnectSec
+    << ",\"launchWait\":" << CommandTiming.LaunchWaitSec
+    << ",\"send\":" << CommandTiming.SendSec
+    << ",\"inputRead\":" << CommandTiming.InputReadSec
+    << ",\"receive\":" << CommandTiming.ReceiveSec
+    << ",\"outputWrite\":" << CommandTiming.OutputWriteSec;
+  if (!CommandTiming.ServerTimingJson.empty())
+  {
+    timingJson << ",\"server\":" << CommandTiming.ServerTimingJson;
+  }
+  timingJson << "}";
+  std::cout << "Timing: " << timingJson.str() << std::endl;
+
+  const char* timingLogFileName=getenv(TIMING_LOG_FILE_ENV_VAR_NAME);
+  if (timingLogFileName!=NULL)
+  {
+    std::ofstream timingLogFile(timingLogFileName, std::ios::app);
+    timingLogFile << timingJson.str() << std::endl;
+  }
+}
+
+// Make all the running Matlab workers of the pool re-read all the Matlab functions
+int ReloadMatlabFunctions(const std::string& hostname=MATLAB_DEFAULT_HOST, int port=MATLAB_DEFAULT_PORT)
+{
+  int result=EXIT_SUCCESS;
+  const int numberOfWorkers=GetNumberOfMatlabWorkers();
+  for (int workerIndex=0; workerIndex<numberOfWorkers; workerIndex++)
+  {
+    std::string reply;
+    ExecuteMatlabCommandStatus status=ExecuteMatlabCommand(hostname, port+workerIndex, "cli_reload('force');", reply, 0, NULL, false);
+    if (status==COMMAND_STATUS_CONNECTION_FAILED)
+    {
+      // The worker is not running, it will read the functions when it is started
+      continue;
+    }
+    if (status!=COMMAND_STATUS_SUCCESS || IsErrorResponse(reply))
+    {
+      std::cerr << "Failed to reload Matlab functions in the worker at port " << port+workerIndex << ": " << reply << std::endl;
+      result=EXIT_FAILURE;
+      continue;
+    }
+    std::cout << "Matlab functions reloaded in the worker at port " << port+workerIndex << std::endl;
+  }
+  return result;
+}
+
+int CallMatlabFunction(int argc, char * argv [])
+{
+  double startTime=vtksys::SystemTools::GetTime();
+  ReplyPolicy=GetReplyPolicyFromEnvironment();
+
+  // Restore the results from the cache, if the function has been called with the same inputs already
+  const char* resultCacheDirectory=getenv(RESULT_CACHE_DIR_ENV_VAR_NAME);
+  bool useResultCache=(resultCacheDirectory!=NULL && strlen(resultCacheDirectory)>0);
+  MatlabResultCache resultCache(useResultCache ? resultCacheDirectory : "", GetResultCacheSize());
+  std::string resultCacheKey;
+  std::vector<std::string> outputFiles;
+  std::string returnParameterFile=GetReturnParameterFileName(argc, argv);
+  if (useResultCache)
+  {
+    std::string functionName=argv[2];
+    std::string functionFile=vtksys::SystemTools::GetCurrentWorkingDirectory()+"/"+functionName+".m";
+    resultCacheKey=resultCache.ComputeKey(functionName, functionFile, GetResultCacheArguments(argc, argv), outputFiles);
+    std::string cachedReply;
+    bool cacheHit=resultCache.Restore(resultCacheKey, outputFiles, returnParameterFile, cachedReply);
+    unsigned long long cacheHits=0;
+    unsigned long long cacheMisses=0;
+    resultCache.UpdateStatistics(cacheHit, cacheHits, cacheMisses);
+    std::cout << "Result cache " << (cacheHit ? "hit" : "miss") << ": " << resultCacheKey
+      << " (hits: " << cacheHits << ", misses: " << cacheMisses << ")" << std::endl;
+    if (cacheHit)
+    {
+      // The reply may have been stored with a different reply policy
+      if (ReplyPolicy.IsLengthLimited())
+      {
+        LimitStringLength(cachedReply, ReplyPolicy.MaxLength, ReplyPolicy.Mode==REPLY_POLICY_TAIL);
+      }
+      ReportCommandTiming(vtksys::SystemTools::GetTime()-startTime, true);
+      std::cout << cachedReply << std::endl;
+      return EXIT_SUCCESS;
+    }
+  }
+
+  DataTransferInfo dataTransfer;
+  std::string cmd=GetMatlabFunctionCommand(argc, argv, &dataTransfer);
+  std::cout << "Command: " << cmd << std::endl;
+
+  std::string reply;
+  int workerPort=-1;
+  ExecuteMatlabCommandStatus status=ExecuteMatlabCommandOnWorker(cmd, reply, &dataTransfer, workerPort);
+  RemoveMappedImageFiles(dataTransfer);
+  ReportCommandTiming(vtksys::SystemTools::GetTime()-startTime, status==COMMAND_STATUS_SUCCESS && !IsErrorResponse(reply));
+  if (status!=COMMAND_STATUS_SUCCESS)
+  {
+    std::cerr << reply << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (IsErrorResponse(reply))
+  {
+    // the response starts with "ERROR:", so the execution failed
+    std::cerr << "Failed to execute Matlab function: " << argv[2] << ", received the following error message: " << std::endl;
+    std::cerr << reply << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (useResultCache && !resultCache.Store(resultCacheKey, outputFiles, returnParameterFile, reply))
+  {
+    std::cerr << "WARNING: Failed to store the results in the result cache" << std::endl;
   }
 
   std::cout << reply << std::endl;
   return EXIT_SUCCESS;  
 }
 
+// Batch mode: many Matlab function calls are executed by one MatlabCommander process over one connection
+// (MatlabCommander arguments: --batch manifest_file).
+// Each line of the manifest file is a function call: the function name followed by the parameters, separated by tabs
+// (the same as the arguments after --call-matlab-function). Empty lines and lines starting with # are ignored. Example:
+//   myfunction<TAB>--threshold<TAB>12.5<TAB>--inputvolume<TAB>/data/case001.nrrd<TAB>--returnparameterfile<TAB>/data/case001.txt
+// Functions are searched in the current working directory. The result cache is not used in batch mode.
+
+struct BatchItem
+{
+  BatchItem() : LineNumber(0), Status(COMMAND_STATUS_FAILED) {}
+  int LineNumber;
+  // Function name and parameters
+  std::vector<std::string> Args;
+  std::string ReplyDeviceName;
+  DataTransferInfo DataTransfer;
+  ExecuteMatlabCommandStatus Status;
+  std::string Reply;
+};
+
+// Read the function calls from the batch manifest file. Returns false if the file cannot be read.
+bool ReadBatchManifest(const std::string& manifestFilename, std::vector<BatchItem>& items)
+{
+  std::ifstream manifestFile(manifestFilename.c_str());
+  if (!manifestFile)
+  {
+    return false;
+  }
+  std::string line;
+  for (int lineNumber=1; std::getline(manifestFile, line); lineNumber++)
+  {
+    if (!line.empty() && line[line.size()-1]=='\r')
+    {
+      // manifest file was written with Windows line endings
+      line.erase(line.size()-1);
+    }
+    if (line.find_first_not_of(" \t")==std::string::npos || line[0]=='#')
+    {
+      // empty line or comment
+      continue;
+    }
+    BatchItem item;
+    item.LineNumber=lineNumber;
+    std::istringstream lineStream(line);
+    std::string arg;
+    while (std::getline(lineStream, arg, '\t'))
+    {
+      // empty values are passed as quoted empty strings
+      item.Args.push_back(arg.empty() ? "\"\"" : arg);
+    }
+    items.push_back(item);
+  }
+  return true;
+}
+
+// Send the function call of a batch item (input data objects and the command) to the server.
+// Returns false if the connection is broken.
+bool SendBatchItem(igtl::Socket * socket, BatchItem& item)
+{
+  // Arguments in the same layout as in a --call-matlab-function call
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(BATCH_ARG.c_str()));
+  argv.push_back(const_cast<char*>(CALL_MATLAB_FUNCTION_ARG.c_str()));
+  for (std::vector<std::string>::iterator argIt=item.Args.begin(); argIt!=item.Args.end(); ++argIt)
+  {
+    argv.push_back(const_cast<char*>(argIt->c_str()));
+  }
+  std::ostringstream commandUid;
+  commandUid << ++LastCommandUid;
+  item.ReplyDeviceName=std::string("ACK_")+commandUid.str();
+  item.DataTransfer.DeviceNameSuffix="_"+commandUid.str();
+  std::string cmd=GetMatlabFunctionCommand(static_cast<int>(argv.size()), &argv[0], &item.DataTransfer);
+  PendingCommands[item.ReplyDeviceName].DataTransfer=&item.DataTransfer;
+
+  double sendStartTime=vtksys::SystemTools::GetTime();
+  std::string cmdPrefix;
+  bool sendSuccess=SendDataObjects(socket, &item.DataTransfer, cmdPrefix) && SendReplyPolicy(socket, commandUid.str());
+  if (sendSuccess)
+  {
+    std::cout << "Sending string: " << cmdPrefix << cmd << std::endl;
+    sendSuccess=SendString(socket, std::string("CMD_")+commandUid.str(), cmdPrefix+cmd);
+  }
+  CommandTiming.SendSec+=vtksys::SystemTools::GetTime()-sendStartTime;
+  return sendSuccess;
+}
+
+// Print the result of a batch item. Returns true if the function call succeeded.
+bool ReportBatchItem(const BatchItem& item)
+{
+  bool success=(item.Status==COMMAND_STATUS_SUCCESS && !IsErrorResponse(item.Reply));
+  std::cout << "Batch item at line " << item.LineNumber << " (" << item.Args[0] << ") "
+    << (success ? "completed" : "failed") << std::endl;
+  (success ? std::cout : std::cerr) << item.Reply << std::endl;
+  return success;
+}
+
+int ExecuteMatlabBatch(const std::string& manifestFilename)
+{
+  double startTime=vtksys::SystemTools::GetTime();
+  std::vector<BatchItem> items;
+  if (!ReadBatchManifest(manifestFilename, items))
+  {
+    std::cerr << "ERROR: Failed to read batch manifest file " << manifestFilename << std::endl;
+    return EXIT_FAILURE;
+  }
+  CheckMessageCrc=IsMessageCrcCheckRequired(MATLAB_DEFAULT_HOST);
+  ReplyPolicy=GetReplyPolicyFromEnvironment();
+
+  // Images and meshes that are transferred in messages have to be classified as inputs or outputs (by checking if the file exists)
+  // when the call is sent, so the call must not be sent before the previous call (that may create the file) is completed.
+  // This also avoids both sides blocking while sending large messages to each other.
+  size_t pipelineDepth=((getenv(IMAGE_TRANSFER_ENV_VAR_NAME)!=NULL || getenv(GEOMETRY_TRANSFER_ENV_VAR_NAME)!=NULL) ? 1 : BATCH_PIPELINE_DEPTH);
+
+  // All the function calls are executed on one worker, which is reserved for the whole batch
+  MatlabWorkerPool workerPool(MATLAB_DEFAULT_PORT, GetNumberOfMatlabWorkers(), GetMatlabWorkerSchedulingPolicy());
+  int workerPort=-1;
+  igtl::ClientSocket::Pointer socket;
+  // Function calls that have been sent, in the order of sending
+  std::deque<BatchItem*> pendingItems;
+  int numberOfFailedItems=0;
+  std::vector<BatchItem>::iterator nextItemIt=items.begin();
+  while (nextItemIt!=items.end() || !pendingItems.empty())
+  {
+    if (nextItemIt!=items.end() && pendingItems.size()<pipelineDepth)
+    {
+      // Send the next function call
+      BatchItem& item=*(nextItemIt++);
+      double connectStartTime=vtksys::SystemTools::GetTime();
+      while (socket.IsNull())
+      {
+        double queueWaitStartTime=vtksys::SystemTools::GetTime();
+        workerPort=workerPool.ReserveWorker();
+        CommandTiming.QueueWaitSec+=vtksys::SystemTools::GetTime()-queueWaitStartTime;
+        if (workerPort<0)
+        {
+          break;
+        }
+        std::cout << "Execute batch on Matlab worker at port " << workerPort << std::endl;
+        socket=GetHealthyWorkerConnection(workerPort);
+        if (socket.IsNull())
+        {
+          std::cerr << "WARNING: Matlab worker at port " << workerPort << " is not available" << std::endl;
+          workerPool.SetWorkerUnhealthy(workerPort);
+        }
+        else
+        {
+          workerPool.SetWorkerHealthy(workerPort);
+        }
+      }
+      CommandTiming.ConnectSec+=vtksys::SystemTools::GetTime()-connectStartTime;
+      if (socket.IsNull())
+      {
+        item.Reply="ERROR: No Matlab worker is available";
+        ReportBatchItem(item);
+        numberOfFailedItems++;
+        continue;
+      }
+      if (SendBatchItem(socket, item))
+      {
+        pendingItems.push_back(&item);
+        continue;
+      }
+      item.Reply="ERROR: Failed to send message to Matlab process";
+      pendingItems.push_back(&item);
+      // the connection is broken, replies of the pending calls will not arrive either
+    }
+    else
+    {
+      // Receive the reply of the oldest pending function call (replies of other calls that arrive earlier are stored)
+      BatchItem& item=*pendingItems.front();
+      pendingItems.pop_front();
+      bool connectionLost=false;
+      double receiveStartTime=vtksys::SystemTools::GetTime();
+      item.Status=ReceiveReply(socket, item.ReplyDeviceName, item.Reply, 0, connectionLost, &item.DataTransfer);
+      CommandTiming.ReceiveSec+=vtksys::SystemTools::GetTime()-receiveStartTime;
+      RemoveMappedImageFiles(item.DataTransfer);
+      if (!ReportBatchItem(item))
+      {
+        numberOfFailedItems++;
+      }
+      if (item.Status==COMMAND_STATUS_SUCCESS)
+      {
+        continue;
+      }
+    }
+    // The connection is in an unknown state, do not reuse it. Pending function calls are reported as failed
+    // (they are not sent again, as the server may have executed them already).
+    CloseConnection(MATLAB_DEFAULT_HOST, workerPort);
+    socket=NULL;
+    for (std::deque<BatchItem*>::iterator pendingItemIt=pendingItems.begin(); pendingItemIt!=pendingItems.end(); ++pendingItemIt)
+    {
+      if ((*pendingItemIt)->Reply.empty())
+      {
+        (*pendingItemIt)->Reply="ERROR: Connection to the Matlab process is lost";
+      }
+      PendingCommands.erase((*pendingItemIt)->ReplyDeviceName);
+      RemoveMappedImageFiles((*pendingItemIt)->DataTransfer);
+      ReportBatchItem(**pendingItemIt);
+      numberOfFailedItems++;
+    }
+    pendingItems.clear();
+  }
+  workerPool.ReleaseWorker();
+
+  ReportCommandTiming(vtksys::SystemTools::GetTime()-startTime, numberOfFailedItems==0);
+  std::cout << "Batch completed: " << items.size()-numberOfFailedItems << " of " << items.size()
+    << " function calls succeeded" << std::endl;
+  return (numberOfFailedItems==0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Asynchronous jobs: the Matlab function call is queued on a worker and MatlabCommander returns immediately.
+// The worker executes the job in the background (in a parallel pool, which requires the Parallel Computing Toolbox),
+// so it can respond to status requests and interrupt the job when it is cancelled.
+// Job ID is port_number, where port identifies the worker and number identifies the job on the worker.
+
+// Queue a Matlab function call (MatlabCommander arguments: --submit function_name parameter1 parameter2 ...)
+// and print the job ID on the last line of the output.
+int SubmitMatlabJob(int argc, char * argv [])
+{
+  // Images and meshes are always transferred in files, as the job may be executed after this process exits
+  std::string functionCmd=GetMatlabFunctionCommand(argc, argv, NULL);
+  std::cout << "Command: " << functionCmd << std::endl;
+
+  // Quotes in the command have to be doubled to put it in a Matlab string
+  std::string quotedFunctionCmd;
+  for (std::string::const_iterator it=functionCmd.begin(); it!=functionCmd.end(); ++it)
+  {
+    quotedFunctionCmd+=(*it=='\'' ? "''" : std::string(1, *it));
+  }
+
+  std::string reply;
+  int workerPort=-1;
+  ExecuteMatlabCommandStatus status=ExecuteMatlabCommandOnWorker("cli_jobs('submit','"+quotedFunctionCmd+"');", reply, NULL, workerPort);
+  int jobNumber=0;
+  if (status!=COMMAND_STATUS_SUCCESS || IsErrorResponse(reply) || !(std::istringstream(reply) >> jobNumber))
+  {
+    std::cerr << "Failed to submit Matlab function: " << argv[2] << std::endl;
+    std::cerr << reply << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << workerPort << "_" << jobNumber << std::endl;
+  return EXIT_SUCCESS;
+}
+
+// Get the status of, get the result of, or cancel a submitted job
+// (jobAction is status, result, or cancel) and print the reply
+int ExecuteMatlabJobAction(const std::string &jobAction, const std::string &jobId)
+{
+  int port=0;
+  int jobNumber=0;
+  char separator=0;
+  std::istringstream jobIdStream(jobId);
+  if (!(jobIdStream >> port >> separator >> jobNumber) || separator!='_')
+  {
+    std::cerr << "ERROR: Invalid job ID: " << jobId << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::ostringstream cmd;
+  cmd << "cli_jobs('" << jobAction << "'," << jobNumber << ");";
+
+  // Jobs are lost if the worker exits, so do not start a new worker
+  std::string reply;
+  ExecuteMatlabCommandStatus status=ExecuteMatlabCommand(MATLAB_DEFAULT_HOST, port, cmd.str(), reply, 0, NULL, false);
+  if (status!=COMMAND_STATUS_SUCCESS || IsErrorResponse(reply))
+  {
+    std::cerr << reply << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << reply << std::endl;
+  return EXIT_SUCCESS;
+}
+
 
 int CallStandardCli(int argc, char * argv [])
 {
   PARSE_ARGS;
 
-  if (!cmd.empty())
+  if (!cmd.empty() && replypolicy==REPLY_POLICY_FULL)
+  {
+    // Execute command. The complete output is returned, which may be very long,
+    // so it is written to the return parameter file while it is received.
+    ReturnValuesWriter returnValuesWriter(returnParameterFile);
+    double startTime=vtksys::SystemTools::GetTime();
+    ExecuteMatlabCommandStatus status=ExecuteMatlabCommand(hostname, port, cmd, reply, 0, NULL, true, &returnValuesWriter);
+    ReportCommandTiming(vtksys::SystemTools::GetTime()-startTime, status==COMMAND_STATUS_SUCCESS);
+    completed=(status==COMMAND_STATUS_SUCCESS);
+    returnValuesWriter.Finish(completed, completed ? "" : reply);
+  }
+  else if (!cmd.empty())
   {
     // Execute command
+    ReplyPolicy.Mode=replypolicy;
+    ReplyPolicy.MaxLength=(replylength>0 ? static_cast<size_t>(replylength) : DEFAULT_MAX_REPLY_LENGTH);
+    double startTime=vtksys::SystemTools::GetTime();
     ExecuteMatlabCommandStatus status=ExecuteMatlabCommand(hostname, port, cmd, reply);
+    ReportCommandTiming(vtksys::SystemTools::GetTime()-startTime, status==COMMAND_STATUS_SUCCESS);
     if (status==COMMAND_STATUS_SUCCESS)
     {
       std::cout << reply << std::endl;
@@ -462,20 +1992,20 @@ int CallStandardCli(int argc, char * argv [])
     // Remove newline characters, as it would confuse the return parameter file
     std::replace( reply.begin(), reply.end(), '\r', ' ');
     std::replace( reply.begin(), reply.end(), '\n', ' ');
+    SetReturnValues(returnParameterFile,reply.c_str(),completed);
   }
   else
   {
     // Empty command, for example when we just want to exit Matlab
     reply.clear();
     completed = true;
+    SetReturnValues(returnParameterFile,reply.c_str(),completed);
   }
-  
-  SetReturnValues(returnParameterFile,reply.c_str(),completed);
 
   // Exit Matlab
   if (exitmatlab == true)
   {
-    return ExitMatlab();
+    return ExitMatlabWorkers(hostname, port);
   }
 
   return EXIT_SUCCESS; // always return with EXIT_SUCCESS, otherwise Slicer ignores the return values and we cannot show the reply on the module GUI
@@ -491,7 +2021,42 @@ int main (int argc, char * argv [])
   else if (argc==2 && EXIT_MATLAB_ARG.compare(argv[1])==0)
   {
     // MatlabCommander is called with arguments: --exit-matlab
-    return ExitMatlab();
+    return ExitMatlabWorkers();
+  }
+  else if (argc==2 && RELOAD_MATLAB_FUNCTIONS_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --reload
+    return ReloadMatlabFunctions();
+  }
+  else if (argc==3 && BATCH_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --batch manifest_file
+    return ExecuteMatlabBatch(argv[2]);
+  }
+  else if (argc==2 && START_MATLAB_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --start-matlab
+    return StartMatlabWorkers();
+  }
+  else if (argc>2 && SUBMIT_JOB_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --submit function_name parameter1 parameter2 ...
+    return SubmitMatlabJob(argc, argv);
+  }
+  else if (argc==3 && JOB_STATUS_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --status job_id
+    return ExecuteMatlabJobAction("status", argv[2]);
+  }
+  else if (argc==3 && JOB_RESULT_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --result job_id
+    return ExecuteMatlabJobAction("result", argv[2]);
+  }
+  else if (argc==3 && CANCEL_JOB_ARG.compare(argv[1])==0)
+  {
+    // MatlabCommander is called with arguments: --cancel job_id
+    return ExecuteMatlabJobAction("cancel", argv[2]);
   }
   else
   {
@@ -0,0 +1,204 @@
+#include "MatlabCommanderBenchmarkUtilities.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "igtlMessageHeader.h"
+#include "igtlStatusMessage.h"
+
+#include "MatlabCommanderStringTransfer.h"
+
+const int BENCHMARK_MATLAB_SERVER_PORT=4100;
+const int BENCHMARK_MOCK_SERVER_PORT=4199;
+
+namespace
+{
+
+// The mock server checks this often if it has to stop while it is waiting for a connection or a message
+const int MOCK_SERVER_POLL_INTERVAL_MSEC=100;
+
+// Device name of the readiness check (GET_STATUS) message
+const char READINESS_CHECK_DEVICE_NAME[]="CMD_READY";
+
+// Receive a message header. Returns false if the connection is closed or (if timeoutMsec>0) no message arrived in time.
+bool ReceiveHeader(igtl::Socket* socket, igtl::MessageHeader::Pointer& headerMsg, igtlUint64& bodyCrc, int timeoutMsec, bool& receiveTimedOut)
+{
+  headerMsg=igtl::MessageHeader::New();
+  headerMsg->InitPack();
+  receiveTimedOut=false;
+  if (timeoutMsec>0)
+  {
+    socket->SetReceiveTimeout(timeoutMsec);
+  }
+  igtlUint64 receivedBytes=socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize(), receiveTimedOut);
+  if (timeoutMsec>0)
+  {
+    // The message body is received in blocking mode
+    socket->SetReceiveTimeout(0);
+  }
+  if (receivedBytes!=headerMsg->GetPackSize() || receiveTimedOut)
+  {
+    return false;
+  }
+  bodyCrc=GetPackedHeaderBodyCrc(headerMsg);
+  headerMsg->Unpack();
+  return true;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+double GetBenchmarkTimeSec()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//----------------------------------------------------------------------------
+double GetPercentile(std::vector<double> values, double percentile)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index=static_cast<size_t>(percentile/100.0*(values.size()-1)+0.5);
+  return values[std::min(index, values.size()-1)];
+}
+
+//----------------------------------------------------------------------------
+bool ExecuteBenchmarkCommand(igtl::Socket* socket, unsigned int commandUid, const std::string& cmd, std::string& reply)
+{
+  std::ostringstream uid;
+  uid << commandUid;
+  if (!SendString(socket, "CMD_"+uid.str(), cmd))
+  {
+    return false;
+  }
+  const std::string replyDeviceName="ACK_"+uid.str();
+  while (true)
+  {
+    igtl::MessageHeader::Pointer headerMsg;
+    igtlUint64 bodyCrc=0;
+    bool receiveTimedOut=false;
+    if (!ReceiveHeader(socket, headerMsg, bodyCrc, 0, receiveTimedOut))
+    {
+      return false;
+    }
+    if (replyDeviceName.compare(headerMsg->GetDeviceName())!=0 || !IsStringMessage(headerMsg))
+    {
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      continue;
+    }
+    // The Matlab command server sends 0 as CRC if it does not compute the CRC
+    reply=ReceiveString(socket, headerMsg, bodyCrc, bodyCrc!=0);
+    return true;
+  }
+}
+
+//----------------------------------------------------------------------------
+MatlabCommanderMockServer::MatlabCommanderMockServer()
+  : StopRequested(false), NumberOfConnections(0)
+{
+}
+
+//----------------------------------------------------------------------------
+MatlabCommanderMockServer::~MatlabCommanderMockServer()
+{
+  this->Stop();
+}
+
+//----------------------------------------------------------------------------
+bool MatlabCommanderMockServer::Start(int port)
+{
+  this->ServerSocket=igtl::ServerSocket::New();
+  if (this->ServerSocket->CreateServer(port)!=0)
+  {
+    std::cerr << "ERROR: Cannot create mock server at port " << port << std::endl;
+    this->ServerSocket=NULL;
+    return false;
+  }
+  this->StopRequested=false;
+  this->NumberOfConnections=0;
+  this->ServerThread=std::thread(&MatlabCommanderMockServer::Run, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void MatlabCommanderMockServer::Stop()
+{
+  if (!this->ServerThread.joinable())
+  {
+    return;
+  }
+  this->StopRequested=true;
+  this->ServerThread.join();
+  this->ServerSocket->CloseSocket();
+  this->ServerSocket=NULL;
+}
+
+//----------------------------------------------------------------------------
+int MatlabCommanderMockServer::GetNumberOfConnections() const
+{
+  return this->NumberOfConnections;
+}
+
+//----------------------------------------------------------------------------
+void MatlabCommanderMockServer::Run()
+{
+  while (!this->StopRequested)
+  {
+    igtl::ClientSocket::Pointer socket=this->ServerSocket->WaitForConnection(MOCK_SERVER_POLL_INTERVAL_MSEC);
+    if (socket.IsNull())
+    {
+      continue;
+    }
+    this->NumberOfConnections++;
+    this->ServeClient(socket);
+    socket->CloseSocket();
+  }
+}
+
+//----------------------------------------------------------------------------
+void MatlabCommanderMockServer::ServeClient(igtl::Socket* socket)
+{
+  while (!this->StopRequested)
+  {
+    igtl::MessageHeader::Pointer headerMsg;
+    igtlUint64 bodyCrc=0;
+    bool receiveTimedOut=false;
+    if (!ReceiveHeader(socket, headerMsg, bodyCrc, MOCK_SERVER_POLL_INTERVAL_MSEC, receiveTimedOut))
+    {
+      if (receiveTimedOut)
+      {
+        // no message yet, check if the server has to stop
+        continue;
+      }
+      // client closed the connection
+      return;
+    }
+    const std::string deviceName=headerMsg->GetDeviceName();
+    if (strcmp(headerMsg->GetDeviceType(), "GET_STATUS")==0 && deviceName==READINESS_CHECK_DEVICE_NAME)
+    {
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      igtl::StatusMessage::Pointer statusMsg=igtl::StatusMessage::New();
+      statusMsg->SetDeviceName(READINESS_CHECK_DEVICE_NAME);
+      statusMsg->SetCode(igtl::StatusMessage::STATUS_OK);
+      statusMsg->Pack();
+      socket->Send(statusMsg->GetPackPointer(), statusMsg->GetPackSize());
+      continue;
+    }
+    if (deviceName.compare(0, 4, "CMD_")!=0 || !IsStringMessage(headerMsg))
+    {
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      continue;
+    }
+    std::string cmd=ReceiveString(socket, headerMsg, bodyCrc, true);
+    if (!SendString(socket, "ACK_"+deviceName.substr(4), cmd))
+    {
+      return;
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef __MatlabCommanderBenchmarkUtilities_h
+#define __MatlabCommanderBenchmarkUtilities_h
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "igtlServerSocket.h"
+#include "igtlSocket.h"
+
+// Helper functions for the benchmarks that measure the connection between MatlabCommander and the Matlab command server.
+// Benchmarks send commands the same way as MatlabCommander does (command is sent to device CMD_uid in a STRING
+// or LARGESTRING message, the reply is received from device ACK_uid) to either a running Matlab command server
+// or to a mock server that runs in the benchmark process. The mock server measures the client side and the
+// transport only, as it replies immediately, without a Matlab interpreter.
+
+/// Default port of the Matlab command server (started by MatlabCommander --start-matlab)
+extern const int BENCHMARK_MATLAB_SERVER_PORT;
+/// Default port of the mock server, different from the Matlab command server port,
+/// so that the mock server can be used while Matlab is running
+extern const int BENCHMARK_MOCK_SERVER_PORT;
+
+/// Returns the current time in seconds (for measuring durations)
+double GetBenchmarkTimeSec();
+
+/// Returns the value at the specified percentile (0-100) of the values
+double GetPercentile(std::vector<double> values, double percentile);
+
+/// Send a command to device CMD_uid and wait for the reply from device ACK_uid.
+/// Other messages (e.g., server timing) are skipped.
+/// Returns false if the connection is broken.
+bool ExecuteBenchmarkCommand(igtl::Socket* socket, unsigned int commandUid, const std::string& cmd, std::string& reply);
+
+/// Minimal command server that runs in a background thread of the benchmark process.
+/// It replies to each command (STRING or LARGESTRING message from device CMD_uid) immediately
+/// with the command string (from device ACK_uid) and passes the readiness check (GET_STATUS from CMD_READY).
+/// Connections are served one at a time, the same way as the Matlab command server serves one client at a time.
+class MatlabCommanderMockServer
+{
+public:
+  MatlabCommanderMockServer();
+  ~MatlabCommanderMockServer();
+
+  /// Start listening on the port. Returns false if the server socket cannot be created.
+  bool Start(int port);
+
+  /// Stop listening and wait until the background thread exits.
+  /// Clients have to close their connections before the server is stopped.
+  void Stop();
+
+  /// Number of connections that have been accepted since the server was started
+  int GetNumberOfConnections() const;
+
+private:
+  void Run();
+  void ServeClient(igtl::Socket* socket);
+
+  igtl::ServerSocket::Pointer ServerSocket;
+  std::thread ServerThread;
+  std::atomic<bool> StopRequested;
+  std::atomic<int> NumberOfConnections;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "MatlabCommanderFileLock.h"
+
+#include <iostream>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------
+MatlabFileLock::MatlabFileLock(const std::string& filename)
+  : Filename(filename)
+  , Locked(false)
+#ifdef _WIN32
+  , FileHandle(INVALID_HANDLE_VALUE)
+#else
+  , FileDescriptor(-1)
+#endif
+{
+}
+
+//----------------------------------------------------------------------------
+MatlabFileLock::~MatlabFileLock()
+{
+  this->Unlock();
+}
+
+//----------------------------------------------------------------------------
+bool MatlabFileLock::Lock(bool wait)
+{
+  if (this->Locked)
+  {
+    return true;
+  }
+#ifdef _WIN32
+  this->FileHandle=CreateFileA(this->Filename.c_str(), GENERIC_READ|GENERIC_WRITE,
+    FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (this->FileHandle==INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "ERROR: Failed to open lock file " << this->Filename << std::endl;
+    return false;
+  }
+  OVERLAPPED overlapped;
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  DWORD flags=LOCKFILE_EXCLUSIVE_LOCK | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+  this->Locked=(LockFileEx(this->FileHandle, flags, 0, 1, 0, &overlapped)!=0);
+  if (!this->Locked)
+  {
+    CloseHandle(this->FileHandle);
+    this->FileHandle=INVALID_HANDLE_VALUE;
+  }
+#else
+  this->FileDescriptor=open(this->Filename.c_str(), O_RDWR|O_CREAT, 0666);
+  if (this->FileDescriptor<0)
+  {
+    std::cerr << "ERROR: Failed to open lock file " << this->Filename << std::endl;
+    return false;
+  }
+  int result=0;
+  do
+  {
+    result=flock(this->FileDescriptor, LOCK_EX | (wait ? 0 : LOCK_NB));
+  }
+  while (result!=0 && errno==EINTR);
+  this->Locked=(result==0);
+  if (!this->Locked)
+  {
+    close(this->FileDescriptor);
+    this->FileDescriptor=-1;
+  }
+#endif
+  return this->Locked;
+}
+
+//----------------------------------------------------------------------------
+void MatlabFileLock::Unlock()
+{
+  if (!this->Locked)
+  {
+    return;
+  }
+#ifdef _WIN32
+  OVERLAPPED overlapped;
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  UnlockFileEx(this->FileHandle, 0, 1, 0, &overlapped);
+  CloseHandle(this->FileHandle);
+  this->FileHandle=INVALID_HANDLE_VALUE;
+#else
+  flock(this->FileDescriptor, LOCK_UN);
+  close(this->FileDescriptor);
+  this->FileDescriptor=-1;
+#endif
+  this->Locked=false;
+}
@@ -0,0 +1,39 @@
+#ifndef __MatlabCommanderFileLock_h
+#define __MatlabCommanderFileLock_h
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Exclusive lock on a file that is shared by all MatlabCommander processes
+// (used for reserving Matlab workers and for updating the result cache).
+// The lock is released when the object is deleted or, if the process crashes, by the operating system.
+
+class MatlabFileLock
+{
+public:
+  MatlabFileLock(const std::string& filename);
+  ~MatlabFileLock();
+
+  /// If wait is false then the method returns immediately if another process holds the lock.
+  /// Returns true if the lock is acquired.
+  bool Lock(bool wait);
+
+  void Unlock();
+
+private:
+  MatlabFileLock(const MatlabFileLock&);
+  MatlabFileLock& operator=(const MatlabFileLock&);
+
+  std::string Filename;
+  bool Locked;
+#ifdef _WIN32
+  HANDLE FileHandle;
+#else
+  int FileDescriptor;
+#endif
+};
+
+#endif
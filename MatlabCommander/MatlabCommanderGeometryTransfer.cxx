@@ -0,0 +1,281 @@
+#include "MatlabCommanderGeometryTransfer.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+#include "vtkCellArray.h"
+#include "vtkErrorCode.h"
+#include "vtkPLYReader.h"
+#include "vtkPLYWriter.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
+#include "vtkPolyDataAlgorithm.h"
+#include "vtkSmartPointer.h"
+#include "vtkSTLReader.h"
+#include "vtkSTLWriter.h"
+#include "vtkWriter.h"
+
+#include "vtksys/SystemTools.hxx"
+
+const char POLYDATA_MESSAGE_TYPE[]="POLYDATA";
+
+namespace
+{
+
+// POLYDATA message body (all numbers are in network byte order):
+//   header: uint32 number of points, number of vertices, size of vertices, number of lines, size of lines,
+//     number of polygons, size of polygons, number of triangle strips, size of triangle strips, number of attributes
+//   points: 3 float32 coordinates for each point
+//   vertices, lines, polygons, triangle strips: for each cell uint32 number of points, uint32 point indices
+//   attributes (not used)
+const size_t POLYDATA_HEADER_SIZE=40;
+const size_t POLYDATA_HEADER_NUMBER_OF_FIELDS=10;
+const size_t POINT_SIZE=3*4;
+const unsigned int POINTS_PER_TRIANGLE=3;
+const size_t TRIANGLE_CELL_SIZE=(1+POINTS_PER_TRIANGLE)*4;
+
+enum PolyDataHeaderField
+{
+  NUMBER_OF_POINTS=0,
+  NUMBER_OF_VERTICES=1,
+  SIZE_OF_VERTICES=2,
+  NUMBER_OF_LINES=3,
+  SIZE_OF_LINES=4,
+  NUMBER_OF_POLYGONS=5,
+  SIZE_OF_POLYGONS=6,
+  NUMBER_OF_TRIANGLE_STRIPS=7
+};
+
+char* WriteUint32(char* buffer, igtl_uint32 value)
+{
+  buffer[0]=static_cast<char>((value>>24) & 0xff);
+  buffer[1]=static_cast<char>((value>>16) & 0xff);
+  buffer[2]=static_cast<char>((value>>8) & 0xff);
+  buffer[3]=static_cast<char>(value & 0xff);
+  return buffer+4;
+}
+
+char* WriteFloat32(char* buffer, double value)
+{
+  float floatValue=static_cast<float>(value);
+  igtl_uint32 valueBits=0;
+  memcpy(&valueBits, &floatValue, sizeof(floatValue));
+  return WriteUint32(buffer, valueBits);
+}
+
+igtl_uint32 ReadUint32(const char* buffer)
+{
+  const unsigned char* bytes=reinterpret_cast<const unsigned char*>(buffer);
+  return (static_cast<igtl_uint32>(bytes[0])<<24) | (static_cast<igtl_uint32>(bytes[1])<<16)
+    | (static_cast<igtl_uint32>(bytes[2])<<8) | static_cast<igtl_uint32>(bytes[3]);
+}
+
+float ReadFloat32(const char* buffer)
+{
+  igtl_uint32 valueBits=ReadUint32(buffer);
+  float value=0;
+  memcpy(&value, &valueBits, sizeof(value));
+  return value;
+}
+
+std::string GetMeshFileExtension(const std::string& filename)
+{
+  return vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(filename));
+}
+
+// Returns NULL if the file cannot be read
+vtkSmartPointer<vtkPolyData> ReadMeshFile(const std::string& filename)
+{
+  vtkSmartPointer<vtkPolyDataAlgorithm> reader;
+  const std::string extension=GetMeshFileExtension(filename);
+  if (extension==".stl")
+  {
+    // Corners of triangles are not merged (the reader would merge them by default), so that the mesh
+    // has the same vertices as when cli_geometryread reads the file (the Matlab side merges them on request)
+    vtkSmartPointer<vtkSTLReader> stlReader=vtkSmartPointer<vtkSTLReader>::New();
+    stlReader->SetFileName(filename.c_str());
+    stlReader->MergingOff();
+    reader=stlReader;
+  }
+  else if (extension==".ply" && vtkPLYReader::CanReadFile(filename.c_str()))
+  {
+    vtkSmartPointer<vtkPLYReader> plyReader=vtkSmartPointer<vtkPLYReader>::New();
+    plyReader->SetFileName(filename.c_str());
+    reader=plyReader;
+  }
+  else
+  {
+    return NULL;
+  }
+  reader->Update();
+  if (reader->GetErrorCode()!=vtkErrorCode::NoError)
+  {
+    return NULL;
+  }
+  return reader->GetOutput();
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+std::vector<char> ReadPolyDataMessageFromFile(const std::string& filename, const std::string& deviceName)
+{
+  vtkSmartPointer<vtkPolyData> polyData=ReadMeshFile(filename);
+  if (polyData==NULL || polyData->GetNumberOfVerts()>0 || polyData->GetNumberOfLines()>0 || polyData->GetNumberOfStrips()>0)
+  {
+    return std::vector<char>();
+  }
+  const unsigned long long numberOfPoints=polyData->GetNumberOfPoints();
+  const unsigned long long numberOfTriangles=polyData->GetNumberOfPolys();
+  if (numberOfTriangles*TRIANGLE_CELL_SIZE>0xFFFFFFFF)
+  {
+    // polygon array size is stored as uint32 in the message
+    return std::vector<char>();
+  }
+
+  std::vector<char> message(IGTL_HEADER_SIZE+POLYDATA_HEADER_SIZE+numberOfPoints*POINT_SIZE+numberOfTriangles*TRIANGLE_CELL_SIZE);
+  char* position=&message[IGTL_HEADER_SIZE];
+  igtl_uint32 polyDataHeader[POLYDATA_HEADER_NUMBER_OF_FIELDS]={0};
+  polyDataHeader[NUMBER_OF_POINTS]=static_cast<igtl_uint32>(numberOfPoints);
+  polyDataHeader[NUMBER_OF_POLYGONS]=static_cast<igtl_uint32>(numberOfTriangles);
+  polyDataHeader[SIZE_OF_POLYGONS]=static_cast<igtl_uint32>(numberOfTriangles*TRIANGLE_CELL_SIZE);
+  for (size_t fieldIndex=0; fieldIndex<POLYDATA_HEADER_NUMBER_OF_FIELDS; fieldIndex++)
+  {
+    position=WriteUint32(position, polyDataHeader[fieldIndex]);
+  }
+
+  // Points are converted from RAS (file) to LPS (message)
+  for (vtkIdType pointIndex=0; pointIndex<static_cast<vtkIdType>(numberOfPoints); pointIndex++)
+  {
+    double point[3]={0.0,0.0,0.0};
+    polyData->GetPoint(pointIndex, point);
+    position=WriteFloat32(position, -point[0]);
+    position=WriteFloat32(position, -point[1]);
+    position=WriteFloat32(position, point[2]);
+  }
+
+  vtkCellArray* polys=polyData->GetPolys();
+  vtkIdType numberOfCellPoints=0;
+  const vtkIdType* cellPoints=NULL;
+  for (polys->InitTraversal(); polys->GetNextCell(numberOfCellPoints, cellPoints); )
+  {
+    if (numberOfCellPoints!=POINTS_PER_TRIANGLE)
+    {
+      // not a triangle mesh
+      return std::vector<char>();
+    }
+    position=WriteUint32(position, POINTS_PER_TRIANGLE);
+    for (unsigned int cornerIndex=0; cornerIndex<POINTS_PER_TRIANGLE; cornerIndex++)
+    {
+      position=WriteUint32(position, static_cast<igtl_uint32>(cellPoints[cornerIndex]));
+    }
+  }
+
+  igtl_header header;
+  memset(&header, 0, sizeof(header));
+  header.version=IGTL_HEADER_VERSION_1;
+  strncpy(header.name, POLYDATA_MESSAGE_TYPE, IGTL_HEADER_TYPE_SIZE);
+  strncpy(header.device_name, deviceName.c_str(), IGTL_HEADER_NAME_SIZE);
+  header.timestamp=0;
+  header.body_size=message.size()-IGTL_HEADER_SIZE;
+  header.crc=crc64(reinterpret_cast<unsigned char*>(&message[IGTL_HEADER_SIZE]), header.body_size, 0);
+  igtl_header_convert_byte_order(&header);
+  memcpy(&message[0], &header, IGTL_HEADER_SIZE);
+  return message;
+}
+
+//----------------------------------------------------------------------------
+bool WritePolyDataMessageBodyToFile(const std::vector<char>& body, const std::string& filename)
+{
+  if (body.size()<POLYDATA_HEADER_SIZE)
+  {
+    std::cerr << "ERROR: Incomplete mesh received from Matlab" << std::endl;
+    return false;
+  }
+  unsigned long long polyDataHeader[POLYDATA_HEADER_NUMBER_OF_FIELDS]={0};
+  for (size_t fieldIndex=0; fieldIndex<POLYDATA_HEADER_NUMBER_OF_FIELDS; fieldIndex++)
+  {
+    polyDataHeader[fieldIndex]=ReadUint32(&body[fieldIndex*4]);
+  }
+  const unsigned long long numberOfPoints=polyDataHeader[NUMBER_OF_POINTS];
+  const unsigned long long numberOfTriangles=polyDataHeader[NUMBER_OF_POLYGONS];
+  if (polyDataHeader[NUMBER_OF_VERTICES]>0 || polyDataHeader[NUMBER_OF_LINES]>0 || polyDataHeader[NUMBER_OF_TRIANGLE_STRIPS]>0
+    || polyDataHeader[SIZE_OF_POLYGONS]!=numberOfTriangles*TRIANGLE_CELL_SIZE)
+  {
+    std::cerr << "ERROR: Only triangle meshes are supported in meshes received from Matlab" << std::endl;
+    return false;
+  }
+  const unsigned long long pointsStart=POLYDATA_HEADER_SIZE;
+  const unsigned long long polygonsStart=pointsStart+numberOfPoints*POINT_SIZE
+    +polyDataHeader[SIZE_OF_VERTICES]+polyDataHeader[SIZE_OF_LINES];
+  if (body.size()<polygonsStart+polyDataHeader[SIZE_OF_POLYGONS])
+  {
+    std::cerr << "ERROR: Incomplete mesh received from Matlab" << std::endl;
+    return false;
+  }
+
+  // Points are converted from LPS (message) to RAS (file)
+  vtkSmartPointer<vtkPoints> points=vtkSmartPointer<vtkPoints>::New();
+  points->SetNumberOfPoints(static_cast<vtkIdType>(numberOfPoints));
+  const char* position=&body[0]+pointsStart;
+  for (vtkIdType pointIndex=0; pointIndex<static_cast<vtkIdType>(numberOfPoints); pointIndex++, position+=POINT_SIZE)
+  {
+    points->SetPoint(pointIndex, -ReadFloat32(position), -ReadFloat32(position+4), ReadFloat32(position+8));
+  }
+
+  vtkSmartPointer<vtkCellArray> polys=vtkSmartPointer<vtkCellArray>::New();
+  polys->AllocateExact(static_cast<vtkIdType>(numberOfTriangles), static_cast<vtkIdType>(numberOfTriangles*POINTS_PER_TRIANGLE));
+  position=&body[0]+polygonsStart;
+  for (unsigned long long triangleIndex=0; triangleIndex<numberOfTriangles; triangleIndex++, position+=TRIANGLE_CELL_SIZE)
+  {
+    if (ReadUint32(position)!=POINTS_PER_TRIANGLE)
+    {
+      std::cerr << "ERROR: Only triangle meshes are supported in meshes received from Matlab" << std::endl;
+      return false;
+    }
+    vtkIdType cellPoints[POINTS_PER_TRIANGLE];
+    for (unsigned int cornerIndex=0; cornerIndex<POINTS_PER_TRIANGLE; cornerIndex++)
+    {
+      igtl_uint32 pointIndex=ReadUint32(position+4*(cornerIndex+1));
+      if (pointIndex>=numberOfPoints)
+      {
+        std::cerr << "ERROR: Invalid point index in mesh received from Matlab: " << pointIndex << std::endl;
+        return false;
+      }
+      cellPoints[cornerIndex]=pointIndex;
+    }
+    polys->InsertNextCell(POINTS_PER_TRIANGLE, cellPoints);
+  }
+
+  vtkSmartPointer<vtkPolyData> polyData=vtkSmartPointer<vtkPolyData>::New();
+  polyData->SetPoints(points);
+  polyData->SetPolys(polys);
+
+  // Binary files are much faster to write and read than ASCII
+  vtkSmartPointer<vtkWriter> writer;
+  const std::string extension=GetMeshFileExtension(filename);
+  if (extension==".stl")
+  {
+    vtkSmartPointer<vtkSTLWriter> stlWriter=vtkSmartPointer<vtkSTLWriter>::New();
+    stlWriter->SetFileName(filename.c_str());
+    stlWriter->SetFileTypeToBinary();
+    writer=stlWriter;
+  }
+  else
+  {
+    vtkSmartPointer<vtkPLYWriter> plyWriter=vtkSmartPointer<vtkPLYWriter>::New();
+    plyWriter->SetFileName(filename.c_str());
+    plyWriter->SetFileTypeToBinary();
+    writer=plyWriter;
+  }
+  writer->SetInputData(polyData);
+  if (!writer->Write() || writer->GetErrorCode()!=vtkErrorCode::NoError)
+  {
+    std::cerr << "ERROR: Failed to write mesh received from Matlab to file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
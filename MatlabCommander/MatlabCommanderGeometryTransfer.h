@@ -0,0 +1,26 @@
+#ifndef __MatlabCommanderGeometryTransfer_h
+#define __MatlabCommanderGeometryTransfer_h
+
+#include <string>
+#include <vector>
+
+// Helper functions for transferring meshes to/from the Matlab command server
+// in OpenIGTLink POLYDATA messages instead of PLY/STL files.
+// Slicer writes mesh files in RAS coordinate system, points are described in LPS coordinate system
+// in the messages (the same as cli_geometryread returns them), so Matlab does not need to convert them.
+// Only triangle meshes are transferred: the messages contain points and polygons of 3 points
+// (no vertices, lines, triangle strips, or attributes).
+
+/// Device type name of the mesh message
+extern const char POLYDATA_MESSAGE_TYPE[];
+
+/// Read a mesh file (PLY or STL) into a complete OpenIGTLink POLYDATA message (header and body).
+/// Returns an empty vector if the file cannot be read or the mesh is not a triangle mesh,
+/// in this case the file has to be transferred as is.
+std::vector<char> ReadPolyDataMessageFromFile(const std::string& filename, const std::string& deviceName);
+
+/// Write the mesh stored in a POLYDATA message body to file (in PLY or STL format, determined by the file extension).
+/// Returns true if successful.
+bool WritePolyDataMessageBodyToFile(const std::vector<char>& body, const std::string& filename);
+
+#endif
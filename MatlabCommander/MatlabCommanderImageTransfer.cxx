@@ -0,0 +1,426 @@
+#include "MatlabCommanderImageTransfer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <limits.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "igtl_util.h"
+
+#include "itkNrrdImageIO.h"
+
+namespace
+{
+
+struct ScalarTypeMapping
+{
+  itk::ImageIOBase::IOComponentType ItkComponentType;
+  int IgtlScalarType;
+};
+
+// Voxel types that can be transferred in IMAGE messages
+const ScalarTypeMapping SCALAR_TYPES[] =
+{
+  { itk::ImageIOBase::CHAR, igtl::ImageMessage::TYPE_INT8 },
+  { itk::ImageIOBase::UCHAR, igtl::ImageMessage::TYPE_UINT8 },
+  { itk::ImageIOBase::SHORT, igtl::ImageMessage::TYPE_INT16 },
+  { itk::ImageIOBase::USHORT, igtl::ImageMessage::TYPE_UINT16 },
+  { itk::ImageIOBase::INT, igtl::ImageMessage::TYPE_INT32 },
+  { itk::ImageIOBase::UINT, igtl::ImageMessage::TYPE_UINT32 },
+  { itk::ImageIOBase::FLOAT, igtl::ImageMessage::TYPE_FLOAT32 },
+  { itk::ImageIOBase::DOUBLE, igtl::ImageMessage::TYPE_FLOAT64 }
+};
+const int NUMBER_OF_SCALAR_TYPES = sizeof(SCALAR_TYPES)/sizeof(SCALAR_TYPES[0]);
+
+// Maximum size of an image along an axis (stored as uint16 in the message)
+const int MAX_IMAGE_MESSAGE_DIMENSION = 65535;
+
+// Returns 0 if the component type is not supported
+int GetIgtlScalarType(itk::ImageIOBase::IOComponentType componentType)
+{
+  for (int i=0; i<NUMBER_OF_SCALAR_TYPES; i++)
+  {
+    if (SCALAR_TYPES[i].ItkComponentType==componentType)
+    {
+      return SCALAR_TYPES[i].IgtlScalarType;
+    }
+  }
+  return 0;
+}
+
+// Returns false if the scalar type is not supported
+bool GetItkComponentType(int igtlScalarType, itk::ImageIOBase::IOComponentType &componentType)
+{
+  for (int i=0; i<NUMBER_OF_SCALAR_TYPES; i++)
+  {
+    if (SCALAR_TYPES[i].IgtlScalarType==igtlScalarType)
+    {
+      componentType=SCALAR_TYPES[i].ItkComponentType;
+      return true;
+    }
+  }
+  return false;
+}
+
+// File that is mapped into the memory of this process. The same file is mapped by the Matlab process,
+// therefore voxels can be exchanged without sending them through the socket.
+class MappedFile
+{
+public:
+  MappedFile()
+    : Data(NULL)
+    , Size(0)
+#ifdef _WIN32
+    , FileHandle(INVALID_HANDLE_VALUE)
+    , MappingHandle(NULL)
+#else
+    , FileDescriptor(-1)
+#endif
+  {
+  }
+
+  ~MappedFile()
+  {
+    this->Close();
+  }
+
+  // Map an existing file (read-only) or create a new file with the requested size (read-write).
+  // Returns false if the file cannot be mapped.
+  bool Open(const std::string& filename, size_t size, bool create)
+  {
+    this->Close();
+    if (size==0)
+    {
+      return false;
+    }
+#ifdef _WIN32
+    this->FileHandle=CreateFileA(filename.c_str(), create ? (GENERIC_READ|GENERIC_WRITE) : GENERIC_READ,
+      FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (this->FileHandle==INVALID_HANDLE_VALUE)
+    {
+      return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!create && (!GetFileSizeEx(this->FileHandle, &fileSize) || static_cast<unsigned long long>(fileSize.QuadPart)<size))
+    {
+      this->Close();
+      return false;
+    }
+    const unsigned long long mappingSize=size;
+    this->MappingHandle=CreateFileMappingA(this->FileHandle, NULL, create ? PAGE_READWRITE : PAGE_READONLY,
+      static_cast<DWORD>(mappingSize>>32), static_cast<DWORD>(mappingSize&0xFFFFFFFF), NULL);
+    if (this->MappingHandle==NULL)
+    {
+      this->Close();
+      return false;
+    }
+    this->Data=MapViewOfFile(this->MappingHandle, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+#else
+    this->FileDescriptor=open(filename.c_str(), create ? (O_RDWR|O_CREAT|O_TRUNC) : O_RDONLY, 0600);
+    if (this->FileDescriptor<0)
+    {
+      return false;
+    }
+    struct stat fileStatus;
+    if (create ? (ftruncate(this->FileDescriptor, static_cast<off_t>(size))!=0)
+      : (fstat(this->FileDescriptor, &fileStatus)!=0 || static_cast<size_t>(fileStatus.st_size)<size))
+    {
+      this->Close();
+      return false;
+    }
+    void* data=mmap(NULL, size, create ? (PROT_READ|PROT_WRITE) : PROT_READ, MAP_SHARED, this->FileDescriptor, 0);
+    this->Data=(data==MAP_FAILED ? NULL : data);
+#endif
+    if (this->Data==NULL)
+    {
+      this->Close();
+      return false;
+    }
+    this->Size=size;
+    return true;
+  }
+
+  void Close()
+  {
+#ifdef _WIN32
+    if (this->Data!=NULL)
+    {
+      UnmapViewOfFile(this->Data);
+    }
+    if (this->MappingHandle!=NULL)
+    {
+      CloseHandle(this->MappingHandle);
+      this->MappingHandle=NULL;
+    }
+    if (this->FileHandle!=INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(this->FileHandle);
+      this->FileHandle=INVALID_HANDLE_VALUE;
+    }
+#else
+    if (this->Data!=NULL)
+    {
+      munmap(this->Data, this->Size);
+    }
+    if (this->FileDescriptor>=0)
+    {
+      close(this->FileDescriptor);
+      this->FileDescriptor=-1;
+    }
+#endif
+    this->Data=NULL;
+    this->Size=0;
+  }
+
+  void* GetData()
+  {
+    return this->Data;
+  }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  void* Data;
+  size_t Size;
+#ifdef _WIN32
+  HANDLE FileHandle;
+  HANDLE MappingHandle;
+#else
+  int FileDescriptor;
+#endif
+};
+
+} // namespace
+
+//----------------------------------------------------------------------------
+igtl::ImageMessage::Pointer ReadImageMessageFromFile(const std::string& filename, const std::string& deviceName,
+  const std::string& mappedFilename)
+{
+  itk::NrrdImageIO::Pointer imageIO = itk::NrrdImageIO::New();
+  if (!imageIO->CanReadFile(filename.c_str()))
+  {
+    return NULL;
+  }
+  try
+  {
+    imageIO->SetFileName(filename.c_str());
+    imageIO->ReadImageInformation();
+
+    const unsigned int numberOfDimensions=imageIO->GetNumberOfDimensions();
+    if (numberOfDimensions>3 || imageIO->GetNumberOfComponents()!=1)
+    {
+      return NULL;
+    }
+    int scalarType=GetIgtlScalarType(imageIO->GetComponentType());
+    if (scalarType==0)
+    {
+      return NULL;
+    }
+
+    int dimensions[3]={1,1,1};
+    float spacing[3]={1.0,1.0,1.0};
+    double origin[3]={0.0,0.0,0.0};
+    double direction[3][3]={{1.0,0.0,0.0},{0.0,1.0,0.0},{0.0,0.0,1.0}};
+    double numberOfVoxels=1.0;
+    for (unsigned int axis=0; axis<numberOfDimensions; axis++)
+    {
+      if (imageIO->GetDimensions(axis)>static_cast<unsigned long>(MAX_IMAGE_MESSAGE_DIMENSION))
+      {
+        return NULL;
+      }
+      dimensions[axis]=static_cast<int>(imageIO->GetDimensions(axis));
+      spacing[axis]=static_cast<float>(imageIO->GetSpacing(axis));
+      origin[axis]=imageIO->GetOrigin(axis);
+      std::vector<double> axisDirection=imageIO->GetDirection(axis);
+      for (unsigned int row=0; row<numberOfDimensions && row<axisDirection.size(); row++)
+      {
+        direction[row][axis]=axisDirection[row];
+      }
+      numberOfVoxels*=dimensions[axis];
+    }
+
+    igtl::ImageMessage::Pointer imageMsg=igtl::ImageMessage::New();
+    imageMsg->SetDeviceName(deviceName.c_str());
+    imageMsg->SetDimensions(dimensions);
+    imageMsg->SetSpacing(spacing);
+    imageMsg->SetScalarType(scalarType);
+    const double imageSize=numberOfVoxels*imageMsg->GetScalarSize();
+    if (mappedFilename.empty() && imageSize>INT_MAX)
+    {
+      // image size is stored as int in the message
+      return NULL;
+    }
+    imageMsg->SetCoordinateSystem(igtl::ImageMessage::COORDINATE_LPS);
+
+    // File stores position of the first voxel, message stores position of the volume center
+    igtl::Matrix4x4 matrix;
+    for (int row=0; row<3; row++)
+    {
+      double center=origin[row];
+      for (int axis=0; axis<3; axis++)
+      {
+        matrix[row][axis]=static_cast<float>(direction[row][axis]);
+        center+=direction[row][axis]*spacing[axis]*(dimensions[axis]-1)/2.0;
+      }
+      matrix[row][3]=static_cast<float>(center);
+      matrix[3][row]=0.0;
+    }
+    matrix[3][3]=1.0;
+    imageMsg->SetMatrix(matrix);
+
+    itk::ImageIORegion ioRegion(numberOfDimensions);
+    for (unsigned int axis=0; axis<numberOfDimensions; axis++)
+    {
+      ioRegion.SetIndex(axis, 0);
+      ioRegion.SetSize(axis, dimensions[axis]);
+    }
+    imageIO->SetIORegion(ioRegion);
+    if (mappedFilename.empty())
+    {
+      // Read voxels directly into the message buffer
+      imageMsg->AllocateScalars();
+      imageIO->Read(imageMsg->GetScalarPointer());
+    }
+    else
+    {
+      // Read voxels directly into the shared file, the message only describes the image
+      MappedFile mappedFile;
+      if (!mappedFile.Open(mappedFilename, static_cast<size_t>(imageSize), true))
+      {
+        std::cerr << "WARNING: Failed to create memory-mapped file " << mappedFilename << std::endl;
+        return NULL;
+      }
+      imageIO->Read(mappedFile.GetData());
+      int subvolumeSize[3]={0,0,0};
+      int subvolumeOffset[3]={0,0,0};
+      imageMsg->SetSubVolume(subvolumeSize, subvolumeOffset);
+      imageMsg->AllocateScalars();
+    }
+
+    imageMsg->Pack();
+    return imageMsg;
+  }
+  catch (itk::ExceptionObject& ex)
+  {
+    std::cerr << "WARNING: Failed to read image " << filename << " for sending it to Matlab: " << ex.GetDescription() << std::endl;
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+bool WriteImageMessageToFile(igtl::ImageMessage* imageMsg, const std::string& filename, const std::string& mappedFilename)
+{
+  itk::ImageIOBase::IOComponentType componentType=itk::ImageIOBase::UNKNOWNCOMPONENTTYPE;
+  if (!GetItkComponentType(imageMsg->GetScalarType(), componentType) || imageMsg->GetNumComponents()!=1)
+  {
+    std::cerr << "ERROR: Unsupported voxel type in image received from Matlab: " << imageMsg->GetScalarType() << std::endl;
+    return false;
+  }
+
+  int dimensions[3]={0,0,0};
+  imageMsg->GetDimensions(dimensions);
+  float spacing[3]={1.0,1.0,1.0};
+  imageMsg->GetSpacing(spacing);
+  igtl::Matrix4x4 matrix;
+  imageMsg->GetMatrix(matrix);
+
+  // Files are written in LPS coordinate system
+  double lpsFromMessage[3]={1.0,1.0,1.0};
+  if (imageMsg->GetCoordinateSystem()==igtl::ImageMessage::COORDINATE_RAS)
+  {
+    lpsFromMessage[0]=-1.0;
+    lpsFromMessage[1]=-1.0;
+  }
+
+  // Message stores position of the volume center, file stores position of the first voxel
+  std::vector<double> direction[3];
+  double origin[3]={0.0,0.0,0.0};
+  for (int axis=0; axis<3; axis++)
+  {
+    direction[axis].resize(3);
+  }
+  for (int row=0; row<3; row++)
+  {
+    origin[row]=lpsFromMessage[row]*matrix[row][3];
+    for (int axis=0; axis<3; axis++)
+    {
+      direction[axis][row]=lpsFromMessage[row]*matrix[row][axis];
+      origin[row]-=direction[axis][row]*spacing[axis]*(dimensions[axis]-1)/2.0;
+    }
+  }
+
+  int subvolumeSize[3]={0,0,0};
+  int subvolumeOffset[3]={0,0,0};
+  imageMsg->GetSubVolume(subvolumeSize, subvolumeOffset);
+  MappedFile mappedFile;
+  void* voxels=NULL;
+  if (subvolumeSize[0]==0 && subvolumeSize[1]==0 && subvolumeSize[2]==0)
+  {
+    // Message only describes the image, voxels are in the shared file
+    // (written by a process on this computer, so byte order is already correct)
+    const size_t imageSize=static_cast<size_t>(dimensions[0])*dimensions[1]*dimensions[2]*imageMsg->GetScalarSize();
+    if (mappedFilename.empty() || !mappedFile.Open(mappedFilename, imageSize, false))
+    {
+      std::cerr << "ERROR: Failed to map voxels of image received from Matlab: " << mappedFilename << std::endl;
+      return false;
+    }
+    voxels=mappedFile.GetData();
+  }
+  else
+  {
+    voxels=imageMsg->GetScalarPointer();
+    // Voxels are written in the byte order of this computer
+    bool littleEndianMessage=(imageMsg->GetEndian()==igtl::ImageMessage::ENDIAN_LITTLE);
+    bool littleEndianSystem=(igtl_is_little_endian()!=0);
+    if (littleEndianMessage!=littleEndianSystem)
+    {
+      const int scalarSize=imageMsg->GetScalarSize();
+      unsigned char* voxel=static_cast<unsigned char*>(voxels);
+      unsigned char* voxelsEnd=voxel+imageMsg->GetImageSize();
+      for (; voxel<voxelsEnd; voxel+=scalarSize)
+      {
+        std::reverse(voxel, voxel+scalarSize);
+      }
+    }
+  }
+
+  try
+  {
+    itk::NrrdImageIO::Pointer imageIO = itk::NrrdImageIO::New();
+    imageIO->SetNumberOfDimensions(3);
+    imageIO->SetPixelType(itk::ImageIOBase::SCALAR);
+    imageIO->SetComponentType(componentType);
+    imageIO->SetNumberOfComponents(1);
+    itk::ImageIORegion ioRegion(3);
+    for (int axis=0; axis<3; axis++)
+    {
+      imageIO->SetDimensions(axis, dimensions[axis]);
+      imageIO->SetSpacing(axis, spacing[axis]);
+      imageIO->SetOrigin(axis, origin[axis]);
+      imageIO->SetDirection(axis, direction[axis]);
+      ioRegion.SetIndex(axis, 0);
+      ioRegion.SetSize(axis, dimensions[axis]);
+    }
+    imageIO->SetIORegion(ioRegion);
+    // The file is read right after writing, so speed is more important than size
+    imageIO->SetUseCompression(false);
+    imageIO->SetFileName(filename.c_str());
+    imageIO->Write(voxels);
+  }
+  catch (itk::ExceptionObject& ex)
+  {
+    std::cerr << "ERROR: Failed to write image received from Matlab to " << filename << ": " << ex.GetDescription() << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,30 @@
+#ifndef __MatlabCommanderImageTransfer_h
+#define __MatlabCommanderImageTransfer_h
+
+#include <string>
+
+#include "igtlImageMessage.h"
+
+// Helper functions for transferring images to/from the Matlab command server
+// in OpenIGTLink IMAGE messages instead of NRRD files.
+// Images are described in LPS coordinate system in the messages. Position of the image
+// is the center of the volume (as specified by the OpenIGTLink IMAGE message standard).
+
+/// Read an image file into a packed OpenIGTLink IMAGE message.
+/// If mappedFilename is specified then the voxels are read into that memory-mapped file
+/// (that the Matlab process maps, too) and the message contains only the image header
+/// (with zero subvolume size).
+/// Returns a null pointer if the file cannot be read or the image cannot be represented
+/// by an IMAGE message (e.g., it has more than 3 dimensions or has multiple components),
+/// in this case the file has to be transferred as is.
+igtl::ImageMessage::Pointer ReadImageMessageFromFile(const std::string& filename, const std::string& deviceName,
+  const std::string& mappedFilename="");
+
+/// Write the image stored in an unpacked OpenIGTLink IMAGE message to file (in NRRD format).
+/// If the message contains only the image header (zero subvolume size) then the voxels
+/// are read from the memory-mapped file mappedFilename.
+/// Returns true if successful.
+bool WriteImageMessageToFile(igtl::ImageMessage* imageMsg, const std::string& filename,
+  const std::string& mappedFilename="");
+
+#endif
@@ -0,0 +1,248 @@
+// Measures wall time and peak memory usage of transferring an image to Matlab and back with each image transfer mode.
+//
+//   MatlabCommanderImageTransferBenchmark mode [sizeMB] [workingDirectory]
+//
+//   mode: file, message, or sharedmemory (same as the values of SLICER_MATLAB_IMAGE_TRANSFER, file is the default transfer)
+//
+// A synthetic int16 volume of sizeMB megabytes (default: 256) is written to an NRRD file in workingDirectory
+// (default: current directory). Then the image is transferred the same way as for a Matlab function that has
+// an input and an output image, with the Matlab side simulated by the operations that the command server performs:
+//   file: Matlab reads the input NRRD file into memory and writes the output NRRD file
+//   message: MatlabCommander reads the NRRD file into an IMAGE message, Matlab receives the whole message and
+//     sends it back, MatlabCommander unpacks the received message and writes the output NRRD file
+//   sharedmemory: MatlabCommander reads the NRRD file into a memory-mapped file (in /dev/shm if available),
+//     Matlab copies the voxels from it and writes the output voxels into another memory-mapped file,
+//     MatlabCommander writes the output NRRD file from that, only the image header is sent in messages
+// Socket transfer and Matlab interpreter overhead are not included. Peak memory usage is only meaningful
+// for one mode per process, so the benchmark has to be run once for each mode.
+// In sharedmemory mode only the MatlabCommander side avoids copying the voxels: cli_imageread still copies
+// them from the memory-mapped file into a Matlab array (pixelDataMap.Data.pixelData) and cli_imagewrite
+// writes the output array into the mapped file with fwrite. The simulated Matlab side makes the same copies,
+// so the gain measured here is the C++ half (no IMAGE message buffer and no socket transfer of the voxels).
+// Results are printed as a JSON line.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "igtlImageMessage.h"
+#include "igtlMessageHeader.h"
+
+#include "vtksys/SystemTools.hxx"
+
+#include "MatlabCommanderImageTransfer.h"
+
+namespace
+{
+
+const int IMAGE_WIDTH=512;
+const int IMAGE_HEIGHT=512;
+
+double GetTimeSec()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident set size of this process in MB (-1 if not available)
+double GetPeakMemoryMB()
+{
+#ifdef _WIN32
+  return -1;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)!=0)
+  {
+    return -1;
+  }
+#ifdef __APPLE__
+  return usage.ru_maxrss/(1024.0*1024.0); // bytes
+#else
+  return usage.ru_maxrss/1024.0; // kilobytes
+#endif
+#endif
+}
+
+// Write a raw encoded int16 NRRD file with varying voxel values
+bool WriteInputImage(const std::string& filename, int numberOfSlices)
+{
+  FILE* file=fopen(filename.c_str(), "wb");
+  if (file==NULL)
+  {
+    return false;
+  }
+  fprintf(file, "NRRD0004\ntype: short\ndimension: 3\nspace: left-posterior-superior\nsizes: %d %d %d\n"
+    "space directions: (1,0,0) (0,1,0) (0,0,1)\nendian: little\nencoding: raw\nspace origin: (0,0,0)\n\n",
+    IMAGE_WIDTH, IMAGE_HEIGHT, numberOfSlices);
+  std::vector<short> slice(IMAGE_WIDTH*IMAGE_HEIGHT);
+  bool success=true;
+  for (int sliceIndex=0; sliceIndex<numberOfSlices && success; sliceIndex++)
+  {
+    for (size_t voxelIndex=0; voxelIndex<slice.size(); voxelIndex++)
+    {
+      slice[voxelIndex]=static_cast<short>(voxelIndex+sliceIndex);
+    }
+    success=(fwrite(&slice[0], sizeof(short), slice.size(), file)==slice.size());
+  }
+  fclose(file);
+  return success;
+}
+
+bool ReadFile(const std::string& filename, std::vector<char>& content)
+{
+  FILE* file=fopen(filename.c_str(), "rb");
+  if (file==NULL)
+  {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long long fileSize=ftell(file);
+  fseek(file, 0, SEEK_SET);
+  content.resize(fileSize>0 ? static_cast<size_t>(fileSize) : 0);
+  bool success=(content.empty() || fread(&content[0], 1, content.size(), file)==content.size());
+  fclose(file);
+  return success;
+}
+
+bool WriteFile(const std::string& filename, const std::vector<char>& content)
+{
+  FILE* file=fopen(filename.c_str(), "wb");
+  if (file==NULL)
+  {
+    return false;
+  }
+  bool success=(content.empty() || fwrite(&content[0], 1, content.size(), file)==content.size());
+  fclose(file);
+  return success;
+}
+
+// Unpack a packed IMAGE message the same way as MatlabCommander does when it receives it from the socket
+igtl::ImageMessage::Pointer ReceiveImageMessage(const std::vector<char>& packedMessage)
+{
+  igtl::MessageHeader::Pointer headerMsg=igtl::MessageHeader::New();
+  headerMsg->InitPack();
+  memcpy(headerMsg->GetPackPointer(), &packedMessage[0], headerMsg->GetPackSize());
+  headerMsg->Unpack();
+  igtl::ImageMessage::Pointer imageMsg=igtl::ImageMessage::New();
+  imageMsg->SetMessageHeader(headerMsg);
+  imageMsg->AllocatePack();
+  memcpy(imageMsg->GetPackBodyPointer(), &packedMessage[headerMsg->GetPackSize()], imageMsg->GetPackBodySize());
+  if (!(imageMsg->Unpack(1) & igtl::MessageHeader::UNPACK_BODY))
+  {
+    return NULL;
+  }
+  return imageMsg;
+}
+
+// Input phase: the input image gets to Matlab. Output phase: the output image gets from Matlab into the output file.
+bool TransferImage(const std::string& mode, const std::string& inputFilename, const std::string& outputFilename,
+  const std::string& mappedDirectory, double& inputSec, double& outputSec)
+{
+  double startTime=GetTimeSec();
+  if (mode=="file")
+  {
+    std::vector<char> matlabImage;
+    if (!ReadFile(inputFilename, matlabImage))
+    {
+      return false;
+    }
+    inputSec=GetTimeSec()-startTime;
+    startTime=GetTimeSec();
+    if (!WriteFile(outputFilename, matlabImage))
+    {
+      return false;
+    }
+    outputSec=GetTimeSec()-startTime;
+    return true;
+  }
+
+  const bool sharedMemory=(mode=="sharedmemory");
+  const std::string mappedInputFilename=(sharedMemory ? mappedDirectory+"/MatlabCommanderBenchmark_IMG_1.raw" : "");
+  const std::string mappedOutputFilename=(sharedMemory ? mappedDirectory+"/MatlabCommanderBenchmark_IMG_2.raw" : "");
+  igtl::ImageMessage::Pointer inputMsg=ReadImageMessageFromFile(inputFilename, "IMG_1", mappedInputFilename);
+  if (inputMsg.IsNull())
+  {
+    return false;
+  }
+  // Matlab receives the message (and copies the voxels from the mapped file)
+  const char* packedInputMsg=static_cast<const char*>(inputMsg->GetPackPointer());
+  std::vector<char> matlabMessage(packedInputMsg, packedInputMsg+inputMsg->GetPackSize());
+  inputMsg=NULL;
+  std::vector<char> matlabVoxels;
+  if (sharedMemory && !ReadFile(mappedInputFilename, matlabVoxels))
+  {
+    return false;
+  }
+  inputSec=GetTimeSec()-startTime;
+
+  // Matlab sends the same image back (and writes the voxels into the mapped file)
+  startTime=GetTimeSec();
+  if (sharedMemory && !WriteFile(mappedOutputFilename, matlabVoxels))
+  {
+    return false;
+  }
+  igtl::ImageMessage::Pointer outputMsg=ReceiveImageMessage(matlabMessage);
+  bool success=(outputMsg.IsNotNull() && WriteImageMessageToFile(outputMsg, outputFilename, mappedOutputFilename));
+  outputSec=GetTimeSec()-startTime;
+  if (sharedMemory)
+  {
+    vtksys::SystemTools::RemoveFile(mappedInputFilename);
+    vtksys::SystemTools::RemoveFile(mappedOutputFilename);
+  }
+  return success;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string mode=(argc>1 ? argv[1] : "");
+  if (mode!="file" && mode!="message" && mode!="sharedmemory")
+  {
+    std::cerr << "Usage: MatlabCommanderImageTransferBenchmark file|message|sharedmemory [sizeMB] [workingDirectory]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int sizeMB=(argc>2 ? atoi(argv[2]) : 256);
+  std::string workingDirectory=(argc>3 ? argv[3] : vtksys::SystemTools::GetCurrentWorkingDirectory());
+  const int numberOfSlices=static_cast<int>(sizeMB*1024.0*1024.0/(IMAGE_WIDTH*IMAGE_HEIGHT*sizeof(short)));
+  if (numberOfSlices<1)
+  {
+    std::cerr << "ERROR: Invalid image size: " << sizeMB << "MB" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string mappedDirectory="/dev/shm";
+  if (!vtksys::SystemTools::FileIsDirectory(mappedDirectory))
+  {
+    mappedDirectory=workingDirectory;
+  }
+
+  const std::string inputFilename=workingDirectory+"/MatlabCommanderBenchmarkInput.nrrd";
+  const std::string outputFilename=workingDirectory+"/MatlabCommanderBenchmarkOutput.nrrd";
+  if (!WriteInputImage(inputFilename, numberOfSlices))
+  {
+    std::cerr << "ERROR: Failed to write file " << inputFilename << std::endl;
+    return EXIT_FAILURE;
+  }
+  const double initialPeakMemoryMB=GetPeakMemoryMB();
+  double inputSec=0;
+  double outputSec=0;
+  bool success=TransferImage(mode, inputFilename, outputFilename, mappedDirectory, inputSec, outputSec);
+  vtksys::SystemTools::RemoveFile(inputFilename);
+  vtksys::SystemTools::RemoveFile(outputFilename);
+  if (!success)
+  {
+    std::cerr << "ERROR: Image transfer failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "{\"mode\":\"" << mode << "\",\"sizeMB\":" << sizeMB
+    << ",\"input\":" << inputSec << ",\"output\":" << outputSec << ",\"total\":" << inputSec+outputSec
+    << ",\"initialPeakMemoryMB\":" << initialPeakMemoryMB << ",\"peakMemoryMB\":" << GetPeakMemoryMB() << "}" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+// Measures the time of executing many short commands with a new connection per command and on one kept-alive connection.
+//
+//   MatlabCommanderKeepAliveBenchmark mock|matlab [numberOfCommands] [port]
+//
+//   mock: the commands are executed by a mock server that runs in this process and replies immediately
+//     (default port: 4199), so only the connection setup and the message transfer are measured
+//   matlab: the commands are executed by a running Matlab command server (default port: 4100),
+//     start it with MatlabCommander --start-matlab
+//
+// numberOfCommands (default: 1000) empty commands are executed first with connecting to the server before
+// each command and disconnecting after the reply is received (as MatlabCommander did before keep-alive sessions),
+// then the same number of commands are executed on one connection (as one MatlabCommander process does).
+// Results are printed as a JSON line.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "igtlClientSocket.h"
+
+#include "MatlabCommanderBenchmarkUtilities.h"
+
+namespace
+{
+
+const char HOSTNAME[]="127.0.0.1";
+
+// Execute the commands, each on a new connection. Returns the total time in seconds (negative if failed).
+double ExecuteCommandsWithConnectPerCommand(int port, int numberOfCommands, unsigned int& commandUid)
+{
+  double startTime=GetBenchmarkTimeSec();
+  for (int commandIndex=0; commandIndex<numberOfCommands; commandIndex++)
+  {
+    igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+    if (socket->ConnectToServer(HOSTNAME, port)!=0)
+    {
+      std::cerr << "ERROR: Cannot connect to server at port " << port << std::endl;
+      return -1;
+    }
+    std::string reply;
+    bool success=ExecuteBenchmarkCommand(socket, ++commandUid, "", reply);
+    socket->CloseSocket();
+    if (!success)
+    {
+      std::cerr << "ERROR: Connection lost while executing command" << std::endl;
+      return -1;
+    }
+  }
+  return GetBenchmarkTimeSec()-startTime;
+}
+
+// Execute the commands on one connection. Returns the total time in seconds (negative if failed).
+double ExecuteCommandsWithKeepAlive(int port, int numberOfCommands, unsigned int& commandUid)
+{
+  double startTime=GetBenchmarkTimeSec();
+  igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+  if (socket->ConnectToServer(HOSTNAME, port)!=0)
+  {
+    std::cerr << "ERROR: Cannot connect to server at port " << port << std::endl;
+    return -1;
+  }
+  for (int commandIndex=0; commandIndex<numberOfCommands; commandIndex++)
+  {
+    std::string reply;
+    if (!ExecuteBenchmarkCommand(socket, ++commandUid, "", reply))
+    {
+      std::cerr << "ERROR: Connection lost while executing command" << std::endl;
+      socket->CloseSocket();
+      return -1;
+    }
+  }
+  socket->CloseSocket();
+  return GetBenchmarkTimeSec()-startTime;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string server=(argc>1 ? argv[1] : "");
+  if (server!="mock" && server!="matlab")
+  {
+    std::cerr << "Usage: MatlabCommanderKeepAliveBenchmark mock|matlab [numberOfCommands] [port]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int numberOfCommands=(argc>2 ? atoi(argv[2]) : 1000);
+  int port=(argc>3 ? atoi(argv[3]) : (server=="mock" ? BENCHMARK_MOCK_SERVER_PORT : BENCHMARK_MATLAB_SERVER_PORT));
+  if (numberOfCommands<1)
+  {
+    std::cerr << "ERROR: Invalid number of commands: " << numberOfCommands << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  MatlabCommanderMockServer mockServer;
+  if (server=="mock" && !mockServer.Start(port))
+  {
+    return EXIT_FAILURE;
+  }
+  unsigned int commandUid=0;
+  double connectPerCommandSec=ExecuteCommandsWithConnectPerCommand(port, numberOfCommands, commandUid);
+  double keepAliveSec=(connectPerCommandSec>=0 ? ExecuteCommandsWithKeepAlive(port, numberOfCommands, commandUid) : -1);
+  mockServer.Stop();
+  if (connectPerCommandSec<0 || keepAliveSec<0)
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "{\"server\":\"" << server << "\",\"commands\":" << numberOfCommands
+    << ",\"connectPerCommand\":" << connectPerCommandSec << ",\"keepAlive\":" << keepAliveSec
+    << ",\"connectPerCommandMsecPerCommand\":" << connectPerCommandSec*1000.0/numberOfCommands
+    << ",\"keepAliveMsecPerCommand\":" << keepAliveSec*1000.0/numberOfCommands
+    << ",\"speedup\":" << (keepAliveSec>0 ? connectPerCommandSec/keepAliveSec : 0) << "}" << std::endl;
+  return EXIT_SUCCESS;
+}
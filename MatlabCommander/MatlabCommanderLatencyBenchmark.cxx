@@ -0,0 +1,80 @@
+// Measures the round-trip latency of empty commands, which shows how fast the command server wakes up
+// when a command arrives while it is idle.
+//
+//   MatlabCommanderLatencyBenchmark mock|matlab [numberOfCommands] [intervalMsec] [port]
+//
+//   mock: the commands are answered by a mock server that runs in this process (default port: 4199),
+//     which gives the latency of the client and the transport only
+//   matlab: the commands are answered by a running Matlab command server (default port: 4100),
+//     start it with MatlabCommander --start-matlab
+//
+// numberOfCommands (default: 200) empty commands are sent on one connection. The benchmark waits intervalMsec
+// (default: 20) between receiving a reply and sending the next command, so that the server is waiting for events
+// when each command arrives. The server replies to an empty command with an error message, without evaluating
+// anything in Matlab, so the round-trip time is the wake-up latency of the server plus the message transfer.
+// Results (in milliseconds) are printed as a JSON line.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "igtlClientSocket.h"
+#include "igtlOSUtil.h"
+
+#include "MatlabCommanderBenchmarkUtilities.h"
+
+int main(int argc, char* argv[])
+{
+  std::string server=(argc>1 ? argv[1] : "");
+  if (server!="mock" && server!="matlab")
+  {
+    std::cerr << "Usage: MatlabCommanderLatencyBenchmark mock|matlab [numberOfCommands] [intervalMsec] [port]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int numberOfCommands=(argc>2 ? atoi(argv[2]) : 200);
+  int intervalMsec=(argc>3 ? atoi(argv[3]) : 20);
+  int port=(argc>4 ? atoi(argv[4]) : (server=="mock" ? BENCHMARK_MOCK_SERVER_PORT : BENCHMARK_MATLAB_SERVER_PORT));
+  if (numberOfCommands<1 || intervalMsec<0)
+  {
+    std::cerr << "ERROR: Invalid number of commands or interval" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  MatlabCommanderMockServer mockServer;
+  if (server=="mock" && !mockServer.Start(port))
+  {
+    return EXIT_FAILURE;
+  }
+  igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+  if (socket->ConnectToServer("127.0.0.1", port)!=0)
+  {
+    std::cerr << "ERROR: Cannot connect to server at port " << port << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<double> latenciesMsec;
+  bool success=true;
+  for (int commandIndex=0; commandIndex<numberOfCommands; commandIndex++)
+  {
+    igtl::Sleep(intervalMsec);
+    std::string reply;
+    double startTime=GetBenchmarkTimeSec();
+    if (!ExecuteBenchmarkCommand(socket, commandIndex+1, "", reply))
+    {
+      std::cerr << "ERROR: Connection lost while executing command" << std::endl;
+      success=false;
+      break;
+    }
+    latenciesMsec.push_back((GetBenchmarkTimeSec()-startTime)*1000.0);
+  }
+  socket->CloseSocket();
+  mockServer.Stop();
+  if (!success)
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "{\"server\":\"" << server << "\",\"commands\":" << numberOfCommands << ",\"intervalMsec\":" << intervalMsec
+    << ",\"p50\":" << GetPercentile(latenciesMsec, 50) << ",\"p90\":" << GetPercentile(latenciesMsec, 90)
+    << ",\"p99\":" << GetPercentile(latenciesMsec, 99) << ",\"max\":" << GetPercentile(latenciesMsec, 100) << "}" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,299 @@
+#include "MatlabCommanderParameterTransfer.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+const char PARAMETERS_MESSAGE_TYPE[]="PARAMS";
+
+namespace
+{
+
+enum ParameterValueType
+{
+  PARAMETER_TYPE_STRING=0,
+  PARAMETER_TYPE_DOUBLE=1
+};
+
+// Number of significant digits of numbers written to the return parameter file
+const int RETURN_PARAMETER_PRECISION=15;
+
+// Returns true if the argument is a parameter name (starts with - or -- followed by a letter)
+bool IsParameterName(const std::string& arg)
+{
+  size_t nameStart=(arg.size()>1 && arg[0]=='-' && arg[1]=='-') ? 2 : 1;
+  return arg.size()>nameStart && arg[0]=='-' && isalpha(static_cast<unsigned char>(arg[nameStart]));
+}
+
+// Returns the parameter name without the leading - or -- (up to the next -, as in cli_argsread.m)
+std::string GetParameterName(const std::string& arg)
+{
+  size_t nameStart=(arg.size()>1 && arg[1]=='-') ? 2 : 1;
+  size_t nameEnd=arg.find('-', nameStart);
+  return arg.substr(nameStart, nameEnd==std::string::npos ? std::string::npos : nameEnd-nameStart);
+}
+
+// Get value from a command-line argument: comma-separated list of numbers is stored as numbers, anything else as string
+MatlabParameter GetParameterValue(const std::string& name, const std::string& valueStr)
+{
+  MatlabParameter parameter;
+  parameter.Name=name;
+  parameter.IsNumeric=true;
+  std::istringstream valueStream(valueStr);
+  std::string component;
+  while (std::getline(valueStream, component, ','))
+  {
+    const char* componentStart=component.c_str();
+    char* componentEnd=NULL;
+    double value=strtod(componentStart, &componentEnd);
+    while (componentEnd!=NULL && isspace(static_cast<unsigned char>(*componentEnd)))
+    {
+      componentEnd++;
+    }
+    if (componentEnd==componentStart || componentEnd==NULL || *componentEnd!=0)
+    {
+      // not a number
+      parameter.IsNumeric=false;
+      parameter.NumericValue.clear();
+      parameter.StringValue=valueStr;
+      return parameter;
+    }
+    parameter.NumericValue.push_back(value);
+  }
+  return parameter;
+}
+
+void AppendUnsigned(std::vector<char>& buffer, unsigned long long value, int numberOfBytes)
+{
+  for (int byteIndex=numberOfBytes-1; byteIndex>=0; byteIndex--)
+  {
+    buffer.push_back(static_cast<char>((value>>(8*byteIndex)) & 0xff));
+  }
+}
+
+bool ReadUnsigned(const std::vector<char>& buffer, size_t& position, int numberOfBytes, unsigned long long& value)
+{
+  if (position+numberOfBytes>buffer.size())
+  {
+    return false;
+  }
+  value=0;
+  for (int byteIndex=0; byteIndex<numberOfBytes; byteIndex++)
+  {
+    value=(value<<8) | static_cast<unsigned char>(buffer[position++]);
+  }
+  return true;
+}
+
+// Get the parameter value as a string. Numbers are separated by spaces, as in the files written by cli_argswrite.m.
+std::string GetParameterValueString(const MatlabParameter& parameter)
+{
+  if (!parameter.IsNumeric)
+  {
+    return parameter.StringValue;
+  }
+  std::ostringstream valueStr;
+  valueStr.precision(RETURN_PARAMETER_PRECISION);
+  for (std::vector<double>::const_iterator valueIt=parameter.NumericValue.begin(); valueIt!=parameter.NumericValue.end(); ++valueIt)
+  {
+    if (valueIt!=parameter.NumericValue.begin())
+    {
+      valueStr << " ";
+    }
+    valueStr << *valueIt;
+  }
+  return valueStr.str();
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+MatlabParameterList ParseMatlabFunctionArguments(const std::vector<std::string>& originalArgs)
+{
+  // Point name and value may be stored in one argument ('--somefiducial 12.3,14.6,18.7'), split them
+  std::vector<std::string> args;
+  for (std::vector<std::string>::const_iterator argIt=originalArgs.begin(); argIt!=originalArgs.end(); ++argIt)
+  {
+    size_t separatorPos=argIt->find(' ');
+    if (IsParameterName(*argIt) && separatorPos!=std::string::npos && separatorPos+1<argIt->size())
+    {
+      args.push_back(argIt->substr(0, separatorPos));
+      args.push_back(argIt->substr(separatorPos+1));
+    }
+    else
+    {
+      args.push_back(*argIt);
+    }
+  }
+
+  MatlabParameterList parameters;
+  std::string name;
+  bool nameStored=true;
+  for (std::vector<std::string>::const_iterator argIt=args.begin(); argIt!=args.end(); ++argIt)
+  {
+    if (IsParameterName(*argIt))
+    {
+      if (!nameStored)
+      {
+        // Previous argument was a flag (parameter name without value)
+        parameters.push_back(GetParameterValue(name, ""));
+        parameters.back().IsNumeric=false;
+      }
+      name=GetParameterName(*argIt);
+      nameStored=false;
+      continue;
+    }
+    if (nameStored && argIt->empty())
+    {
+      // empty unnamed values are ignored
+      continue;
+    }
+    parameters.push_back(GetParameterValue(nameStored ? "" : name, *argIt));
+    nameStored=true;
+  }
+  if (!nameStored)
+  {
+    parameters.push_back(GetParameterValue(name, ""));
+    parameters.back().IsNumeric=false;
+  }
+  return parameters;
+}
+
+//----------------------------------------------------------------------------
+std::vector<char> PackParametersMessage(const std::string& deviceName, const MatlabParameterList& parameters)
+{
+  std::vector<char> message(IGTL_HEADER_SIZE);
+  AppendUnsigned(message, parameters.size(), 4);
+  for (MatlabParameterList::const_iterator parameterIt=parameters.begin(); parameterIt!=parameters.end(); ++parameterIt)
+  {
+    AppendUnsigned(message, parameterIt->Name.size(), 2);
+    message.insert(message.end(), parameterIt->Name.begin(), parameterIt->Name.end());
+    if (parameterIt->IsNumeric)
+    {
+      AppendUnsigned(message, PARAMETER_TYPE_DOUBLE, 1);
+      AppendUnsigned(message, parameterIt->NumericValue.size(), 8);
+      for (std::vector<double>::const_iterator valueIt=parameterIt->NumericValue.begin(); valueIt!=parameterIt->NumericValue.end(); ++valueIt)
+      {
+        unsigned long long valueBits=0;
+        double value=*valueIt;
+        memcpy(&valueBits, &value, sizeof(value));
+        AppendUnsigned(message, valueBits, 8);
+      }
+    }
+    else
+    {
+      AppendUnsigned(message, PARAMETER_TYPE_STRING, 1);
+      AppendUnsigned(message, parameterIt->StringValue.size(), 8);
+      message.insert(message.end(), parameterIt->StringValue.begin(), parameterIt->StringValue.end());
+    }
+  }
+
+  igtl_header header;
+  memset(&header, 0, sizeof(header));
+  header.version=IGTL_HEADER_VERSION_1;
+  strncpy(header.name, PARAMETERS_MESSAGE_TYPE, IGTL_HEADER_TYPE_SIZE);
+  strncpy(header.device_name, deviceName.c_str(), IGTL_HEADER_NAME_SIZE);
+  header.timestamp=0;
+  header.body_size=message.size()-IGTL_HEADER_SIZE;
+  header.crc=crc64(reinterpret_cast<unsigned char*>(&message[IGTL_HEADER_SIZE]), header.body_size, 0);
+  igtl_header_convert_byte_order(&header);
+  memcpy(&message[0], &header, IGTL_HEADER_SIZE);
+  return message;
+}
+
+//----------------------------------------------------------------------------
+bool UnpackParametersMessageBody(const std::vector<char>& body, MatlabParameterList& parameters)
+{
+  parameters.clear();
+  size_t position=0;
+  unsigned long long numberOfParameters=0;
+  if (!ReadUnsigned(body, position, 4, numberOfParameters))
+  {
+    return false;
+  }
+  for (unsigned long long parameterIndex=0; parameterIndex<numberOfParameters; parameterIndex++)
+  {
+    MatlabParameter parameter;
+    unsigned long long nameLength=0;
+    unsigned long long valueType=0;
+    unsigned long long numberOfElements=0;
+    if (!ReadUnsigned(body, position, 2, nameLength) || position+nameLength>body.size())
+    {
+      return false;
+    }
+    parameter.Name.assign(body.begin()+position, body.begin()+position+nameLength);
+    position+=nameLength;
+    if (!ReadUnsigned(body, position, 1, valueType) || !ReadUnsigned(body, position, 8, numberOfElements))
+    {
+      return false;
+    }
+    if (valueType==PARAMETER_TYPE_DOUBLE)
+    {
+      if (numberOfElements>(body.size()-position)/8)
+      {
+        return false;
+      }
+      parameter.IsNumeric=true;
+      parameter.NumericValue.resize(numberOfElements);
+      for (unsigned long long elementIndex=0; elementIndex<numberOfElements; elementIndex++)
+      {
+        unsigned long long valueBits=0;
+        ReadUnsigned(body, position, 8, valueBits);
+        memcpy(&parameter.NumericValue[elementIndex], &valueBits, sizeof(double));
+      }
+    }
+    else if (valueType==PARAMETER_TYPE_STRING)
+    {
+      if (numberOfElements>body.size()-position)
+      {
+        return false;
+      }
+      parameter.StringValue.assign(body.begin()+position, body.begin()+position+numberOfElements);
+      position+=numberOfElements;
+    }
+    else
+    {
+      return false;
+    }
+    parameters.push_back(parameter);
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool WriteReturnParameterFile(const std::string& filename, const MatlabParameterList& parameters)
+{
+  // Values of parameters with the same name are merged, the order of the parameters is preserved
+  std::vector<std::string> names;
+  std::map<std::string, std::string> values;
+  for (MatlabParameterList::const_iterator parameterIt=parameters.begin(); parameterIt!=parameters.end(); ++parameterIt)
+  {
+    std::map<std::string, std::string>::iterator valueIt=values.find(parameterIt->Name);
+    if (valueIt==values.end())
+    {
+      names.push_back(parameterIt->Name);
+      values[parameterIt->Name]=GetParameterValueString(*parameterIt);
+    }
+    else
+    {
+      valueIt->second+=","+GetParameterValueString(*parameterIt);
+    }
+  }
+
+  std::ofstream returnParameterFile(filename.c_str());
+  if (!returnParameterFile)
+  {
+    return false;
+  }
+  for (std::vector<std::string>::const_iterator nameIt=names.begin(); nameIt!=names.end(); ++nameIt)
+  {
+    returnParameterFile << *nameIt << " = " << values[*nameIt] << std::endl;
+  }
+  return returnParameterFile.good();
+}
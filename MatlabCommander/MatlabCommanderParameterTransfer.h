@@ -0,0 +1,52 @@
+#ifndef __MatlabCommanderParameterTransfer_h
+#define __MatlabCommanderParameterTransfer_h
+
+#include <string>
+#include <vector>
+
+// Helper functions for transferring Matlab function parameters to/from the Matlab command server
+// in binary PARAMS messages instead of in the command string and the return parameter text file.
+//
+// PARAMS message body (all numbers are in network byte order):
+//   uint32 number of parameters
+//   for each parameter:
+//     uint16 name length, name characters (empty name for unnamed parameters)
+//     uint8 value type (PARAMETER_TYPE_STRING or PARAMETER_TYPE_DOUBLE)
+//     uint64 number of value elements (characters or doubles)
+//     value (characters or 8-byte IEEE doubles)
+// The same parameter name may occur multiple times (e.g., point list parameters).
+
+/// Device type name of the parameters message
+extern const char PARAMETERS_MESSAGE_TYPE[];
+
+struct MatlabParameter
+{
+  MatlabParameter() : IsNumeric(false) {}
+  std::string Name;
+  /// If true then NumericValue contains the value, otherwise StringValue
+  bool IsNumeric;
+  std::string StringValue;
+  std::vector<double> NumericValue;
+};
+
+typedef std::vector<MatlabParameter> MatlabParameterList;
+
+/// Get the parameters from the command-line arguments, the same way as cli_argsread.m
+/// parses them: arguments starting with - or -- followed by a letter are parameter names,
+/// other arguments are values. Values that contain comma-separated numbers are stored as numbers.
+MatlabParameterList ParseMatlabFunctionArguments(const std::vector<std::string>& args);
+
+/// Pack the parameters into a complete OpenIGTLink PARAMS message (header and body)
+std::vector<char> PackParametersMessage(const std::string& deviceName, const MatlabParameterList& parameters);
+
+/// Get the parameters from a PARAMS message body.
+/// Returns false if the body is invalid.
+bool UnpackParametersMessageBody(const std::vector<char>& body, MatlabParameterList& parameters);
+
+/// Write the parameters into a return parameter file that Slicer reads ("name = value" lines).
+/// Numeric values are written as a space-separated list (as cli_argswrite.m writes them),
+/// values of parameters that occur multiple times are written as a comma-separated list.
+/// Returns true if successful.
+bool WriteReturnParameterFile(const std::string& filename, const MatlabParameterList& parameters);
+
+#endif
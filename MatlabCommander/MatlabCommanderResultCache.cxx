@@ -0,0 +1,335 @@
+#include "MatlabCommanderResultCache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "vtksys/Directory.hxx"
+#include "vtksys/MD5.h"
+#include "vtksys/SystemTools.hxx"
+
+#include "MatlabCommanderFileLock.h"
+
+namespace
+{
+
+const char REPLY_FILE_NAME[]="reply.txt";
+const char RETURN_PARAMETER_FILE_NAME[]="returnparameters.txt";
+const char OUTPUT_FILE_NAME_PREFIX[]="output_";
+// This file contains the last time when the entry was used (in seconds, with microsecond resolution,
+// as the file modification time may have only 1 second resolution, which is too coarse for ordering the entries)
+const char LAST_USED_FILE_NAME[]="lastused";
+const char STATISTICS_FILE_NAME[]="statistics.txt";
+// Locked while the statistics file is updated or entries are removed (by any MatlabCommander process)
+const char LOCK_FILE_NAME[]="cache.lock";
+// Suffix of entry directories that are being written
+const char PARTIAL_ENTRY_SUFFIX[]=".partial";
+
+// Size of the blocks in which files are read for computing their hash
+const size_t HASH_BLOCK_SIZE=1024*1024;
+
+class Md5Hash
+{
+public:
+  Md5Hash() : Md5(vtksysMD5_New()) { vtksysMD5_Initialize(this->Md5); }
+  ~Md5Hash() { vtksysMD5_Delete(this->Md5); }
+  void Append(const std::string& str)
+  {
+    vtksysMD5_Append(this->Md5, reinterpret_cast<const unsigned char*>(str.c_str()), static_cast<int>(str.size()));
+    // Separator, so that different lists of strings do not result in the same hash
+    vtksysMD5_Append(this->Md5, reinterpret_cast<const unsigned char*>("\n"), 1);
+  }
+  // Returns false if the file cannot be read
+  bool AppendFile(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+    {
+      return false;
+    }
+    std::vector<char> buffer(HASH_BLOCK_SIZE);
+    while (file)
+    {
+      file.read(&buffer[0], buffer.size());
+      vtksysMD5_Append(this->Md5, reinterpret_cast<const unsigned char*>(&buffer[0]), static_cast<int>(file.gcount()));
+    }
+    return file.eof();
+  }
+  std::string GetHex()
+  {
+    char hex[33];
+    vtksysMD5_FinalizeHex(this->Md5, hex);
+    hex[32]=0;
+    return hex;
+  }
+private:
+  Md5Hash(const Md5Hash&);
+  Md5Hash& operator=(const Md5Hash&);
+  vtksysMD5* Md5;
+};
+
+std::string GetFileHash(const std::string& filename)
+{
+  Md5Hash hash;
+  if (!hash.AppendFile(filename))
+  {
+    return "";
+  }
+  return hash.GetHex();
+}
+
+// Returns true if the argument is the name of a file that the function will create
+bool IsOutputFileName(const std::string& arg)
+{
+  if (vtksys::SystemTools::GetFilenameLastExtension(arg).empty())
+  {
+    return false;
+  }
+  std::string directory=vtksys::SystemTools::GetFilenamePath(arg);
+  return !directory.empty() && vtksys::SystemTools::FileIsDirectory(directory);
+}
+
+std::string GetCachedOutputFileName(size_t outputIndex, const std::string& outputFile)
+{
+  std::ostringstream filename;
+  filename << OUTPUT_FILE_NAME_PREFIX << outputIndex << vtksys::SystemTools::GetFilenameExtension(outputFile);
+  return filename.str();
+}
+
+bool WriteTextFile(const std::string& filename, const std::string& text)
+{
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  file << text;
+  return file.good();
+}
+
+// Write the current time into the last used file of the entry
+bool WriteLastUsedTime(const std::string& entryDirectory)
+{
+  std::ostringstream lastUsedTime;
+  lastUsedTime << std::fixed << std::setprecision(6) << vtksys::SystemTools::GetTime();
+  return WriteTextFile(entryDirectory+"/"+LAST_USED_FILE_NAME, lastUsedTime.str());
+}
+
+// Returns 0 if the time cannot be read, so the entry is removed first
+double ReadLastUsedTime(const std::string& entryDirectory)
+{
+  std::ifstream lastUsedFile((entryDirectory+"/"+LAST_USED_FILE_NAME).c_str());
+  double lastUsedTime=0;
+  if (!(lastUsedFile >> lastUsedTime))
+  {
+    return 0;
+  }
+  return lastUsedTime;
+}
+
+struct CacheEntryInfo
+{
+  std::string Directory;
+  double LastUsedTime;
+  unsigned long long Size;
+  bool operator<(const CacheEntryInfo& other) const { return this->LastUsedTime<other.LastUsedTime; }
+};
+
+} // namespace
+
+//----------------------------------------------------------------------------
+MatlabResultCache::MatlabResultCache(const std::string& cacheDirectory, unsigned long long maximumSizeBytes)
+  : CacheDirectory(cacheDirectory)
+  , MaximumSizeBytes(maximumSizeBytes)
+{
+}
+
+//----------------------------------------------------------------------------
+std::string MatlabResultCache::ComputeKey(const std::string& functionName, const std::string& functionFile,
+  const std::vector<std::string>& args, std::vector<std::string>& outputFiles)
+{
+  outputFiles.clear();
+  Md5Hash keyHash;
+  keyHash.Append("function:"+functionName);
+  if (vtksys::SystemTools::FileExists(functionFile.c_str(), true))
+  {
+    keyHash.Append("functionfile:"+GetFileHash(functionFile));
+  }
+  for (std::vector<std::string>::const_iterator argIt=args.begin(); argIt!=args.end(); ++argIt)
+  {
+    if (vtksys::SystemTools::FileExists(argIt->c_str(), true))
+    {
+      // Input file, only the content matters
+      keyHash.Append("input:"+GetFileHash(*argIt));
+    }
+    else if (IsOutputFileName(*argIt))
+    {
+      // Output file, only its position and type matters
+      keyHash.Append("output:"+vtksys::SystemTools::GetFilenameExtension(*argIt));
+      outputFiles.push_back(*argIt);
+    }
+    else
+    {
+      keyHash.Append("arg:"+*argIt);
+    }
+  }
+  return keyHash.GetHex();
+}
+
+//----------------------------------------------------------------------------
+std::string MatlabResultCache::GetEntryDirectory(const std::string& key)
+{
+  return this->CacheDirectory+"/"+key;
+}
+
+//----------------------------------------------------------------------------
+bool MatlabResultCache::Restore(const std::string& key, const std::vector<std::string>& outputFiles,
+  const std::string& returnParameterFile, std::string& reply)
+{
+  std::string entryDirectory=this->GetEntryDirectory(key);
+  std::string replyFile=entryDirectory+"/"+REPLY_FILE_NAME;
+  if (!vtksys::SystemTools::FileExists(replyFile.c_str(), true))
+  {
+    return false;
+  }
+  for (size_t outputIndex=0; outputIndex<outputFiles.size(); outputIndex++)
+  {
+    // Outputs that the function did not create are not stored in the cache either
+    std::string cachedOutputFile=entryDirectory+"/"+GetCachedOutputFileName(outputIndex, outputFiles[outputIndex]);
+    if (vtksys::SystemTools::FileExists(cachedOutputFile.c_str(), true)
+      && !vtksys::SystemTools::CopyFileAlways(cachedOutputFile, outputFiles[outputIndex]))
+    {
+      std::cerr << "WARNING: Failed to restore output file " << outputFiles[outputIndex] << " from the result cache" << std::endl;
+      return false;
+    }
+  }
+  std::string cachedReturnParameterFile=entryDirectory+"/"+RETURN_PARAMETER_FILE_NAME;
+  if (!returnParameterFile.empty() && vtksys::SystemTools::FileExists(cachedReturnParameterFile.c_str(), true)
+    && !vtksys::SystemTools::CopyFileAlways(cachedReturnParameterFile, returnParameterFile))
+  {
+    std::cerr << "WARNING: Failed to restore return parameter file " << returnParameterFile << " from the result cache" << std::endl;
+    return false;
+  }
+  std::ifstream replyStream(replyFile.c_str(), std::ios::binary);
+  std::ostringstream replyContent;
+  replyContent << replyStream.rdbuf();
+  reply=replyContent.str();
+  WriteLastUsedTime(entryDirectory);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool MatlabResultCache::Store(const std::string& key, const std::vector<std::string>& outputFiles,
+  const std::string& returnParameterFile, const std::string& reply)
+{
+  // The entry is written into a temporary directory and renamed when complete, so that other
+  // MatlabCommander processes never find incomplete entries
+  std::string entryDirectory=this->GetEntryDirectory(key);
+  std::string partialEntryDirectory=entryDirectory+PARTIAL_ENTRY_SUFFIX;
+  vtksys::SystemTools::RemoveADirectory(partialEntryDirectory);
+  if (!vtksys::SystemTools::MakeDirectory(partialEntryDirectory))
+  {
+    return false;
+  }
+  bool success=true;
+  for (size_t outputIndex=0; outputIndex<outputFiles.size() && success; outputIndex++)
+  {
+    if (vtksys::SystemTools::FileExists(outputFiles[outputIndex].c_str(), true)
+      && !vtksys::SystemTools::CopyFileAlways(outputFiles[outputIndex],
+        partialEntryDirectory+"/"+GetCachedOutputFileName(outputIndex, outputFiles[outputIndex])))
+    {
+      success=false;
+    }
+  }
+  if (success && !returnParameterFile.empty() && vtksys::SystemTools::FileExists(returnParameterFile.c_str(), true)
+    && !vtksys::SystemTools::CopyFileAlways(returnParameterFile, partialEntryDirectory+"/"+RETURN_PARAMETER_FILE_NAME))
+  {
+    success=false;
+  }
+  success=success && WriteTextFile(partialEntryDirectory+"/"+REPLY_FILE_NAME, reply)
+    && WriteLastUsedTime(partialEntryDirectory);
+  if (success)
+  {
+    vtksys::SystemTools::RemoveADirectory(entryDirectory);
+    if (!vtksys::SystemTools::RenameFile(partialEntryDirectory.c_str(), entryDirectory.c_str()))
+    {
+      success=false;
+    }
+  }
+  if (!success)
+  {
+    vtksys::SystemTools::RemoveADirectory(partialEntryDirectory);
+    return false;
+  }
+  this->RemoveLeastRecentlyUsedEntries();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void MatlabResultCache::RemoveLeastRecentlyUsedEntries()
+{
+  // Other processes must not remove the same entries at the same time (and count their size twice)
+  MatlabFileLock cacheLock(this->CacheDirectory+"/"+LOCK_FILE_NAME);
+  if (!cacheLock.Lock(true))
+  {
+    return;
+  }
+  std::vector<CacheEntryInfo> entries;
+  unsigned long long totalSize=0;
+  vtksys::Directory cacheDirectory;
+  cacheDirectory.Load(this->CacheDirectory);
+  for (unsigned long entryIndex=0; entryIndex<cacheDirectory.GetNumberOfFiles(); entryIndex++)
+  {
+    std::string entryName=cacheDirectory.GetFile(entryIndex);
+    CacheEntryInfo entry;
+    entry.Directory=this->CacheDirectory+"/"+entryName;
+    std::string lastUsedFile=entry.Directory+"/"+LAST_USED_FILE_NAME;
+    if (entryName=="." || entryName==".." || !vtksys::SystemTools::FileExists(lastUsedFile.c_str(), true))
+    {
+      // not a complete cache entry
+      continue;
+    }
+    entry.LastUsedTime=ReadLastUsedTime(entry.Directory);
+    entry.Size=0;
+    vtksys::Directory entryDirectory;
+    entryDirectory.Load(entry.Directory);
+    for (unsigned long fileIndex=0; fileIndex<entryDirectory.GetNumberOfFiles(); fileIndex++)
+    {
+      std::string entryFile=entry.Directory+"/"+entryDirectory.GetFile(fileIndex);
+      if (vtksys::SystemTools::FileExists(entryFile.c_str(), true))
+      {
+        entry.Size+=vtksys::SystemTools::FileLength(entryFile);
+      }
+    }
+    totalSize+=entry.Size;
+    entries.push_back(entry);
+  }
+  std::sort(entries.begin(), entries.end());
+  for (std::vector<CacheEntryInfo>::iterator entryIt=entries.begin(); entryIt!=entries.end() && totalSize>this->MaximumSizeBytes; ++entryIt)
+  {
+    std::cout << "Remove least recently used entry from the result cache: " << entryIt->Directory << std::endl;
+    vtksys::SystemTools::RemoveADirectory(entryIt->Directory);
+    totalSize-=entryIt->Size;
+  }
+}
+
+//----------------------------------------------------------------------------
+void MatlabResultCache::UpdateStatistics(bool hit, unsigned long long& hits, unsigned long long& misses)
+{
+  vtksys::SystemTools::MakeDirectory(this->CacheDirectory);
+  std::string statisticsFile=this->CacheDirectory+"/"+STATISTICS_FILE_NAME;
+  hits=0;
+  misses=0;
+  // Counts of other processes that update the statistics at the same time must not be lost
+  MatlabFileLock cacheLock(this->CacheDirectory+"/"+LOCK_FILE_NAME);
+  if (!cacheLock.Lock(true))
+  {
+    std::cerr << "WARNING: Failed to lock the result cache, statistics are not updated" << std::endl;
+    return;
+  }
+  {
+    std::ifstream statistics(statisticsFile.c_str());
+    statistics >> hits >> misses;
+  }
+  (hit ? hits : misses)++;
+  std::ofstream statistics(statisticsFile.c_str());
+  statistics << hits << " " << misses << std::endl;
+}
@@ -0,0 +1,54 @@
+#ifndef __MatlabCommanderResultCache_h
+#define __MatlabCommanderResultCache_h
+
+#include <string>
+#include <vector>
+
+// Cache of Matlab function results, so that calling the same function with the same inputs again
+// (e.g., clicking Apply again on the same scene) does not need to execute the function in Matlab.
+//
+// The cache key is computed from the function name, the content of the function's .m file,
+// the arguments and the content of the input files. Arguments that are existing files are inputs,
+// arguments that are file names in an existing directory are outputs. Input and output file names
+// are not part of the key, as Slicer uses different temporary file names each time.
+// Functions that the called function uses (other .m files) are not part of the key, so the cache
+// has to be cleared if they are changed.
+//
+// Each cache entry is a directory that contains copies of the output files, the return parameter
+// file, and the reply of the function. Entries that are not used for the longest time are removed
+// when the total size of the cache exceeds the maximum size.
+
+class MatlabResultCache
+{
+public:
+  MatlabResultCache(const std::string& cacheDirectory, unsigned long long maximumSizeBytes);
+
+  /// Compute the cache key of a function call.
+  /// args must not contain the return parameter file argument.
+  /// outputFiles is set to the list of output files found in the arguments.
+  std::string ComputeKey(const std::string& functionName, const std::string& functionFile,
+    const std::vector<std::string>& args, std::vector<std::string>& outputFiles);
+
+  /// Copy the cached outputs of the function call to the output files and the return parameter file
+  /// (if not empty). Returns false if the result is not found in the cache.
+  bool Restore(const std::string& key, const std::vector<std::string>& outputFiles,
+    const std::string& returnParameterFile, std::string& reply);
+
+  /// Store the outputs of a function call. Least recently used entries are removed
+  /// if the cache size exceeds the maximum. Returns false if the result cannot be stored.
+  bool Store(const std::string& key, const std::vector<std::string>& outputFiles,
+    const std::string& returnParameterFile, const std::string& reply);
+
+  /// Count a cache hit or miss, returns the total number of hits and misses of the cache
+  /// (shared by all MatlabCommander processes that use the same cache directory).
+  void UpdateStatistics(bool hit, unsigned long long& hits, unsigned long long& misses);
+
+private:
+  std::string GetEntryDirectory(const std::string& key);
+  void RemoveLeastRecentlyUsedEntries();
+
+  std::string CacheDirectory;
+  unsigned long long MaximumSizeBytes;
+};
+
+#endif
@@ -0,0 +1,367 @@
+#include "MatlabCommanderStringTransfer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "igtlStringMessage.h"
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+const char LARGE_STRING_MESSAGE_TYPE[]="LARGESTRING";
+const size_t MAX_STRING_MESSAGE_LENGTH=0xFFFF;
+const std::string RESPONSE_ERROR_PREFIX="ERROR:";
+
+namespace
+{
+
+const size_t LARGE_STRING_BODY_HEADER_SIZE=10;
+const unsigned short STRING_ENCODING_US_ASCII=3;
+// Long strings are received in chunks of this size if they are not received into one buffer
+const size_t LARGE_STRING_RECEIVE_CHUNK_SIZE=65536;
+
+// Send a string in a LARGESTRING message. The string is sent directly from its buffer (without copying into a message).
+// Returns true if the message is sent successfully
+bool SendLargeString(igtl::Socket * socket, const std::string &deviceName, const std::string &str)
+{
+  unsigned char stringHeader[LARGE_STRING_BODY_HEADER_SIZE];
+  stringHeader[0]=static_cast<unsigned char>(STRING_ENCODING_US_ASCII>>8);
+  stringHeader[1]=static_cast<unsigned char>(STRING_ENCODING_US_ASCII & 0xff);
+  for (size_t byteIndex=2; byteIndex<LARGE_STRING_BODY_HEADER_SIZE; byteIndex++)
+  {
+    stringHeader[byteIndex]=static_cast<unsigned char>((static_cast<igtlUint64>(str.size())>>(8*(LARGE_STRING_BODY_HEADER_SIZE-1-byteIndex))) & 0xff);
+  }
+  unsigned char* stringData=reinterpret_cast<unsigned char*>(const_cast<char*>(str.data()));
+
+  igtl_header header;
+  memset(&header, 0, sizeof(header));
+  header.version=IGTL_HEADER_VERSION_1;
+  strncpy(header.name, LARGE_STRING_MESSAGE_TYPE, IGTL_HEADER_TYPE_SIZE);
+  strncpy(header.device_name, deviceName.c_str(), IGTL_HEADER_NAME_SIZE);
+  header.timestamp=0;
+  header.body_size=LARGE_STRING_BODY_HEADER_SIZE+str.size();
+  header.crc=crc64(stringHeader, LARGE_STRING_BODY_HEADER_SIZE, 0);
+  header.crc=crc64(stringData, str.size(), header.crc);
+  igtl_header_convert_byte_order(&header);
+
+  return socket->Send(&header, IGTL_HEADER_SIZE)!=0
+    && socket->Send(stringHeader, LARGE_STRING_BODY_HEADER_SIZE)!=0
+    && (str.empty() || socket->Send(stringData, str.size())!=0);
+}
+
+// Keeps the first (or, if keepTail is set, the last) maxLength characters of a string that is written block by block
+class LimitedStringWriter : public StringBlockWriter
+{
+public:
+  LimitedStringWriter(size_t maxLength, bool keepTail)
+    : MaxLength(maxLength), KeepTail(keepTail), FirstBlock(true)
+  {
+  }
+
+  virtual void Write(const char* block, size_t size)
+  {
+    if (this->FirstBlock && this->KeepTail && size>=RESPONSE_ERROR_PREFIX.size()
+      && RESPONSE_ERROR_PREFIX.compare(0, RESPONSE_ERROR_PREFIX.size(), block, RESPONSE_ERROR_PREFIX.size())==0)
+    {
+      // Error message, keep the beginning
+      this->KeepTail=false;
+    }
+    this->FirstBlock=false;
+    if (this->KeepTail)
+    {
+      this->Str.append(block, size);
+      if (this->Str.size()>2*this->MaxLength)
+      {
+        this->Str.erase(0, this->Str.size()-this->MaxLength);
+      }
+    }
+    else if (this->Str.size()<this->MaxLength)
+    {
+      this->Str.append(block, std::min(size, this->MaxLength-this->Str.size()));
+    }
+  }
+
+  std::string& GetString()
+  {
+    return this->Str;
+  }
+
+private:
+  size_t MaxLength;
+  bool KeepTail;
+  bool FirstBlock;
+  std::string Str;
+};
+
+// Receive the string length field at the beginning of a LARGESTRING message body. crc is set to the CRC of the field.
+// Returns false if the message body is invalid or cannot be received.
+bool ReceiveLargeStringLength(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64& stringLength, igtlUint64& crc)
+{
+  igtlUint64 bodySize=header->GetBodySizeToRead();
+  if (bodySize<LARGE_STRING_BODY_HEADER_SIZE)
+  {
+    std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+    socket->Skip(bodySize, 0);
+    return false;
+  }
+  unsigned char stringHeader[LARGE_STRING_BODY_HEADER_SIZE];
+  bool receiveTimedOut = false;
+  igtlUint64 received=socket->Receive(stringHeader, LARGE_STRING_BODY_HEADER_SIZE, receiveTimedOut);
+  if (received!=LARGE_STRING_BODY_HEADER_SIZE || receiveTimedOut)
+  {
+    std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+    return false;
+  }
+  stringLength=0;
+  for (size_t byteIndex=2; byteIndex<LARGE_STRING_BODY_HEADER_SIZE; byteIndex++)
+  {
+    stringLength=(stringLength<<8) | stringHeader[byteIndex];
+  }
+  crc=crc64(stringHeader, LARGE_STRING_BODY_HEADER_SIZE, 0);
+  return true;
+}
+
+// Receive the characters of a LARGESTRING message body (after the string length field) in chunks and pass them to the writer.
+// Padding after the string length and terminator characters at the end of the string are not passed.
+// crc is the CRC of the string length field. Returns false if the body cannot be received or the CRC check fails.
+bool ReceiveLargeStringChunks(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  igtlUint64 stringLength, igtlUint64 crc, StringBlockWriter& writer)
+{
+  const igtlUint64 stringBufferSize=header->GetBodySizeToRead()-LARGE_STRING_BODY_HEADER_SIZE;
+  std::vector<char> chunk(LARGE_STRING_RECEIVE_CHUNK_SIZE);
+  // Zero characters are passed to the writer only when other characters follow them, as they may be the terminator
+  size_t numberOfPendingZeros=0;
+  bool receiveTimedOut=false;
+  for (igtlUint64 position=0; position<stringBufferSize; )
+  {
+    size_t chunkSize=static_cast<size_t>(std::min<igtlUint64>(chunk.size(), stringBufferSize-position));
+    igtlUint64 chunkReceived=socket->Receive(&chunk[0], chunkSize, receiveTimedOut);
+    if (chunkReceived!=chunkSize || receiveTimedOut)
+    {
+      std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+      return false;
+    }
+    if (checkCrc)
+    {
+      crc=crc64(reinterpret_cast<unsigned char*>(&chunk[0]), chunkSize, crc);
+    }
+    // Characters after the string length are padding
+    size_t stringChunkSize=(position<stringLength ? static_cast<size_t>(std::min<igtlUint64>(chunkSize, stringLength-position)) : 0);
+    size_t contentSize=stringChunkSize;
+    while (contentSize>0 && chunk[contentSize-1]==0)
+    {
+      contentSize--;
+    }
+    if (contentSize>0)
+    {
+      if (numberOfPendingZeros>0)
+      {
+        writer.Write(std::string(numberOfPendingZeros, '\0').data(), numberOfPendingZeros);
+        numberOfPendingZeros=0;
+      }
+      writer.Write(&chunk[0], contentSize);
+    }
+    numberOfPendingZeros+=stringChunkSize-contentSize;
+    position+=chunkSize;
+  }
+  if (checkCrc && crc!=bodyCrc)
+  {
+    std::cerr << "WARNING: CRC check failed for message received from device " << header->GetDeviceName() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Receive a LARGESTRING message body. The string is received directly into the returned string's buffer.
+// If maxLength is not 0 and the string is longer than that, then the body is received in chunks and only the first
+// (or, if keepTail is set, the last) maxLength characters are kept, so the complete string is never stored in memory.
+std::string ReceiveLargeString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  size_t maxLength, bool keepTail)
+{
+  igtlUint64 stringLength=0;
+  igtlUint64 crc=0;
+  if (!ReceiveLargeStringLength(socket, header, stringLength, crc))
+  {
+    return "";
+  }
+  const igtlUint64 stringBufferSize=header->GetBodySizeToRead()-LARGE_STRING_BODY_HEADER_SIZE;
+  if (maxLength!=0 && stringBufferSize>maxLength)
+  {
+    LimitedStringWriter writer(maxLength, keepTail);
+    if (!ReceiveLargeStringChunks(socket, header, bodyCrc, checkCrc, stringLength, crc, writer))
+    {
+      return "";
+    }
+    LimitStringLength(writer.GetString(), maxLength, keepTail);
+    return writer.GetString();
+  }
+  std::string str;
+  str.resize(stringBufferSize);
+  if (!str.empty())
+  {
+    bool receiveTimedOut = false;
+    igtlUint64 received=socket->Receive(&str[0], str.size(), receiveTimedOut);
+    if (received!=str.size() || receiveTimedOut)
+    {
+      std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+      return "";
+    }
+    if (checkCrc)
+    {
+      crc=crc64(reinterpret_cast<unsigned char*>(&str[0]), str.size(), crc);
+    }
+  }
+  if (checkCrc && crc!=bodyCrc)
+  {
+    std::cerr << "WARNING: CRC check failed for message received from device " << header->GetDeviceName() << std::endl;
+    return "";
+  }
+  if (stringLength<str.size())
+  {
+    str.resize(stringLength);
+  }
+  // Remove terminator character
+  while (!str.empty() && str[str.size()-1]==0)
+  {
+    str.resize(str.size()-1);
+  }
+  return str;
+}
+
+// Receive a STRING message body. Returns false if the message cannot be received or unpacked.
+bool ReceiveShortString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, bool checkCrc, std::string& str)
+{
+  // Create a message buffer to receive transform data
+  igtl::StringMessage::Pointer stringMsg;
+  stringMsg = igtl::StringMessage::New();
+  stringMsg->SetMessageHeader(header);
+  stringMsg->AllocatePack();
+
+  // Receive transform data from the socket
+  bool receiveTimedOut = false;
+  int received=socket->Receive(stringMsg->GetPackBodyPointer(), stringMsg->GetPackBodySize(), receiveTimedOut);
+  if (received!=stringMsg->GetPackBodySize())
+  {
+    std::cerr << "WARNING: failed to receive complete message body" << std::endl;
+  }
+  if (receiveTimedOut)
+  {
+    std::cerr << "WARNING: receiving timed out" << std::endl;
+  }
+
+  // Deserialize the transform data
+  // If you want to skip CRC check, call Unpack() without argument.
+  int c = stringMsg->Unpack(checkCrc ? 1 : 0);
+
+  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  {
+    str=stringMsg->GetString();
+    return true;
+  }
+
+  // error
+  std::cerr << "WARNING: failed to unpack message received from device " << header->GetDeviceName() << std::endl;
+  return false;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+std::string ReceiveString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  size_t maxLength, bool keepTail)
+{
+  if (strcmp(header->GetDeviceType(), LARGE_STRING_MESSAGE_TYPE) == 0)
+  {
+    return ReceiveLargeString(socket, header, bodyCrc, checkCrc, maxLength, keepTail);
+  }
+
+  std::string str;
+  if (!ReceiveShortString(socket, header, checkCrc, str))
+  {
+    return "";
+  }
+  LimitStringLength(str, maxLength, keepTail);
+  return str;
+}
+
+//----------------------------------------------------------------------------
+bool ReceiveString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  StringBlockWriter& writer)
+{
+  if (strcmp(header->GetDeviceType(), LARGE_STRING_MESSAGE_TYPE) == 0)
+  {
+    igtlUint64 stringLength=0;
+    igtlUint64 crc=0;
+    return ReceiveLargeStringLength(socket, header, stringLength, crc)
+      && ReceiveLargeStringChunks(socket, header, bodyCrc, checkCrc, stringLength, crc, writer);
+  }
+  // STRING messages are short, they are received at once
+  std::string str;
+  if (!ReceiveShortString(socket, header, checkCrc, str))
+  {
+    return false;
+  }
+  if (!str.empty())
+  {
+    writer.Write(str.data(), str.size());
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+igtlUint64 GetPackedHeaderBodyCrc(igtl::MessageHeader::Pointer& header)
+{
+  const unsigned char* packedHeader=static_cast<const unsigned char*>(header->GetPackPointer());
+  igtlUint64 crc=0;
+  // CRC is stored in the last 8 bytes of the header, in network byte order
+  for (int byteIndex=IGTL_HEADER_SIZE-8; byteIndex<IGTL_HEADER_SIZE; byteIndex++)
+  {
+    crc=(crc<<8) | packedHeader[byteIndex];
+  }
+  return crc;
+}
+
+//----------------------------------------------------------------------------
+bool IsStringMessage(igtl::MessageHeader::Pointer& header)
+{
+  return strcmp(header->GetDeviceType(), "STRING") == 0 || strcmp(header->GetDeviceType(), LARGE_STRING_MESSAGE_TYPE) == 0;
+}
+
+//----------------------------------------------------------------------------
+bool IsErrorResponse(const std::string &reply)
+{
+  return (reply.size()>RESPONSE_ERROR_PREFIX.size() && reply.compare(0,RESPONSE_ERROR_PREFIX.size(),RESPONSE_ERROR_PREFIX)==0);
+}
+
+//----------------------------------------------------------------------------
+void LimitStringLength(std::string& str, size_t maxLength, bool keepTail)
+{
+  if (maxLength==0 || str.size()<=maxLength)
+  {
+    return;
+  }
+  if (keepTail && !IsErrorResponse(str))
+  {
+    str.erase(0, str.size()-maxLength);
+  }
+  else
+  {
+    str.resize(maxLength);
+  }
+}
+
+//----------------------------------------------------------------------------
+bool SendString(igtl::Socket * socket, const std::string &deviceName, const std::string &str)
+{
+  if (str.size()>MAX_STRING_MESSAGE_LENGTH)
+  {
+    return SendLargeString(socket, deviceName, str);
+  }
+  igtl::StringMessage::Pointer stringMsg;
+  stringMsg = igtl::StringMessage::New();
+  stringMsg->SetDeviceName(deviceName.c_str());
+  stringMsg->SetString(str.c_str());
+  stringMsg->Pack();
+  return (socket->Send(stringMsg->GetPackPointer(), stringMsg->GetPackSize())!=0);
+}
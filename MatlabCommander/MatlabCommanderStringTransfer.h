@@ -0,0 +1,62 @@
+#ifndef __MatlabCommanderStringTransfer_h
+#define __MatlabCommanderStringTransfer_h
+
+#include <string>
+
+#include "igtlMessageHeader.h"
+#include "igtlSocket.h"
+
+// Helper functions for transferring commands and replies to/from the Matlab command server
+// in OpenIGTLink STRING messages. STRING messages store the string length in 16 bits, longer strings
+// (long commands, verbose replies) are sent in LARGESTRING messages.
+// LARGESTRING message body (all numbers are in network byte order): uint16 encoding, uint64 string length, characters.
+
+/// Device type name of the message that contains a string longer than MAX_STRING_MESSAGE_LENGTH
+extern const char LARGE_STRING_MESSAGE_TYPE[];
+extern const size_t MAX_STRING_MESSAGE_LENGTH;
+
+/// If the Matlab function response string starts with this string then it means
+/// the function execution failed
+extern const std::string RESPONSE_ERROR_PREFIX;
+
+/// Receives the characters of a string block by block while the string is being received,
+/// so that a long string does not have to be stored in memory
+class StringBlockWriter
+{
+public:
+  virtual ~StringBlockWriter() {}
+  virtual void Write(const char* block, size_t size) = 0;
+};
+
+/// Returns the body CRC from the received message header. Must be called before the header is unpacked.
+igtlUint64 GetPackedHeaderBodyCrc(igtl::MessageHeader::Pointer& header);
+
+/// Returns true if the message contains a string (STRING or LARGESTRING message)
+bool IsStringMessage(igtl::MessageHeader::Pointer& header);
+
+/// Response is usually 'OK' (if the function did not have any output) or some printouts.
+/// In case of an error, the response starts with ERROR:...
+bool IsErrorResponse(const std::string &reply);
+
+/// Keep only the first (or, if keepTail is set, the last) maxLength characters of the string.
+/// Error messages are always kept from the beginning, so that they are still recognized as errors.
+void LimitStringLength(std::string& str, size_t maxLength, bool keepTail);
+
+/// Send a string in a STRING message (or in a LARGESTRING message if it is longer than MAX_STRING_MESSAGE_LENGTH).
+/// Returns true if the message is sent successfully.
+bool SendString(igtl::Socket * socket, const std::string &deviceName, const std::string &str);
+
+/// Receive the body of a STRING or LARGESTRING message (the header has been received and unpacked already).
+/// bodyCrc is the CRC stored in the message header (see GetPackedHeaderBodyCrc), it is only checked if checkCrc is set.
+/// If maxLength is not 0 then only the first (or, if keepTail is set, the last) maxLength characters of the string are returned.
+/// Returns an empty string if the message cannot be received.
+std::string ReceiveString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  size_t maxLength=0, bool keepTail=false);
+
+/// Receive the body of a STRING or LARGESTRING message and pass the string to the writer in blocks
+/// (the terminator character is not passed). The CRC can only be checked after all the blocks have been written.
+/// Returns false if the message cannot be received or the CRC check fails.
+bool ReceiveString(igtl::Socket * socket, igtl::MessageHeader::Pointer& header, igtlUint64 bodyCrc, bool checkCrc,
+  StringBlockWriter& writer);
+
+#endif
@@ -0,0 +1,110 @@
+// Measures the throughput of sending commands and receiving replies of 1KB, 1MB, and 64MB.
+//
+//   MatlabCommanderThroughputBenchmark mock|matlab [port]
+//
+//   mock: the commands are answered by a mock server that runs in this process (default port: 4199),
+//     which gives the throughput of the client and the transport only
+//   matlab: the commands are answered by a running Matlab command server (default port: 4100),
+//     start it with MatlabCommander --start-matlab
+//
+// Each command is disp('xxx...') with the specified number of characters, so the command is sent
+// in a STRING (1KB) or LARGESTRING (1MB, 64MB) message and the reply has the same size
+// (Matlab prints the characters, the mock server sends the command back).
+// The round trip of each size is repeated a few times and the median time is reported.
+// Throughput is the number of bytes sent and received per second. Results are printed as a JSON line.
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "igtlClientSocket.h"
+
+#include "MatlabCommanderBenchmarkUtilities.h"
+
+namespace
+{
+
+struct PayloadInfo
+{
+  const char* Name;
+  size_t Size;
+  int NumberOfRepetitions;
+};
+
+const PayloadInfo PAYLOADS[]=
+{
+  { "1KB", 1024, 100 },
+  { "1MB", 1024*1024, 10 },
+  { "64MB", 64*1024*1024, 3 }
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string server=(argc>1 ? argv[1] : "");
+  if (server!="mock" && server!="matlab")
+  {
+    std::cerr << "Usage: MatlabCommanderThroughputBenchmark mock|matlab [port]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int port=(argc>2 ? atoi(argv[2]) : (server=="mock" ? BENCHMARK_MOCK_SERVER_PORT : BENCHMARK_MATLAB_SERVER_PORT));
+
+  MatlabCommanderMockServer mockServer;
+  if (server=="mock" && !mockServer.Start(port))
+  {
+    return EXIT_FAILURE;
+  }
+  igtl::ClientSocket::Pointer socket=igtl::ClientSocket::New();
+  if (socket->ConnectToServer("127.0.0.1", port)!=0)
+  {
+    std::cerr << "ERROR: Cannot connect to server at port " << port << std::endl;
+    return EXIT_FAILURE;
+  }
+  unsigned int commandUid=0;
+  bool success=true;
+  std::ostringstream resultsJson;
+  for (size_t payloadIndex=0; payloadIndex<sizeof(PAYLOADS)/sizeof(PAYLOADS[0]) && success; payloadIndex++)
+  {
+    const PayloadInfo& payload=PAYLOADS[payloadIndex];
+    const std::string cmd="disp('"+std::string(payload.Size, 'x')+"')";
+    std::vector<double> roundTripSec;
+    size_t replySize=0;
+    for (int repetition=0; repetition<payload.NumberOfRepetitions; repetition++)
+    {
+      std::string reply;
+      double startTime=GetBenchmarkTimeSec();
+      if (!ExecuteBenchmarkCommand(socket, ++commandUid, cmd, reply))
+      {
+        std::cerr << "ERROR: Connection lost while executing command" << std::endl;
+        success=false;
+        break;
+      }
+      roundTripSec.push_back(GetBenchmarkTimeSec()-startTime);
+      replySize=reply.size();
+      if (replySize<payload.Size)
+      {
+        std::cerr << "ERROR: Incomplete reply to " << payload.Name << " command: " << reply.substr(0, 200) << std::endl;
+        success=false;
+        break;
+      }
+    }
+    if (!success)
+    {
+      break;
+    }
+    double medianSec=GetPercentile(roundTripSec, 50);
+    resultsJson << (payloadIndex>0 ? "," : "") << "\"" << payload.Name << "\":{\"roundTrip\":" << medianSec
+      << ",\"MBps\":" << (medianSec>0 ? (cmd.size()+replySize)/(1024.0*1024.0)/medianSec : 0) << "}";
+  }
+  socket->CloseSocket();
+  mockServer.Stop();
+  if (!success)
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "{\"server\":\"" << server << "\"," << resultsJson.str() << "}" << std::endl;
+  return EXIT_SUCCESS;
+}
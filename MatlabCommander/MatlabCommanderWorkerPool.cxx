@@ -0,0 +1,241 @@
+#include "MatlabCommanderWorkerPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "vtksys/SystemTools.hxx"
+
+#include "MatlabCommanderFileLock.h"
+
+namespace
+{
+
+// Time between checking if a worker became idle (when all the workers are busy)
+const unsigned int WORKER_POLL_INTERVAL_MSEC=100;
+
+// Other processes skip a worker for this long after it has been marked as unhealthy
+const double UNHEALTHY_WORKER_RETRY_DELAY_SEC=60.0;
+
+std::string GetLockFileDirectory()
+{
+  const char* tempDirEnvVarNames[]={"TMPDIR", "TEMP", "TMP"};
+  for (int i=0; i<3; i++)
+  {
+    const char* tempDir=getenv(tempDirEnvVarNames[i]);
+    if (tempDir!=NULL && vtksys::SystemTools::FileIsDirectory(tempDir))
+    {
+      return tempDir;
+    }
+  }
+  return "/tmp";
+}
+
+std::string GetLockFileName(const std::string& name, int port)
+{
+  std::ostringstream filename;
+  filename << GetLockFileDirectory() << "/MatlabCommander_" << name << "_" << port;
+  return filename.str();
+}
+
+// Returns true if a process marked the worker as unhealthy recently
+bool IsUnhealthyMarkerValid(int port)
+{
+  std::ifstream markerFile(GetLockFileName("unhealthy", port).c_str());
+  double markedTime=0;
+  if (!(markerFile >> markedTime))
+  {
+    return false;
+  }
+  return vtksys::SystemTools::GetTime()-markedTime<UNHEALTHY_WORKER_RETRY_DELAY_SEC;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+MatlabWorkerPool::MatlabWorkerPool(int firstPort, int numberOfWorkers, SchedulingPolicy policy)
+  : FirstPort(firstPort)
+  , Policy(policy)
+  , WorkerHealthy(numberOfWorkers>0 ? numberOfWorkers : 1, true)
+  , ReservedWorkerLock(NULL)
+{
+}
+
+//----------------------------------------------------------------------------
+MatlabWorkerPool::~MatlabWorkerPool()
+{
+  this->ReleaseWorker();
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::GetNumberOfWorkers() const
+{
+  return static_cast<int>(this->WorkerHealthy.size());
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::GetWorkerPort(int workerIndex) const
+{
+  return this->FirstPort+workerIndex;
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::ReserveWorker()
+{
+  this->ReleaseWorker();
+  if (this->Policy==SCHEDULING_ROUND_ROBIN)
+  {
+    return this->ReserveRoundRobinWorker();
+  }
+  return this->ReserveLeastLoadedWorker();
+}
+
+//----------------------------------------------------------------------------
+void MatlabWorkerPool::ReleaseWorker()
+{
+  delete this->ReservedWorkerLock;
+  this->ReservedWorkerLock=NULL;
+}
+
+//----------------------------------------------------------------------------
+void MatlabWorkerPool::SetWorkerUnhealthy(int port)
+{
+  int workerIndex=port-this->FirstPort;
+  if (workerIndex>=0 && workerIndex<this->GetNumberOfWorkers())
+  {
+    this->WorkerHealthy[workerIndex]=false;
+  }
+  std::ofstream markerFile(GetLockFileName("unhealthy", port).c_str());
+  markerFile << std::fixed << vtksys::SystemTools::GetTime() << std::endl;
+}
+
+//----------------------------------------------------------------------------
+void MatlabWorkerPool::SetWorkerHealthy(int port)
+{
+  const std::string markerFilename=GetLockFileName("unhealthy", port);
+  if (vtksys::SystemTools::FileExists(markerFilename.c_str(), true))
+  {
+    vtksys::SystemTools::RemoveFile(markerFilename.c_str());
+  }
+}
+
+//----------------------------------------------------------------------------
+bool MatlabWorkerPool::GetSchedulingPolicyFromString(const std::string& name, SchedulingPolicy& policy)
+{
+  if (name=="leastloaded")
+  {
+    policy=SCHEDULING_LEAST_LOADED;
+    return true;
+  }
+  if (name=="roundrobin")
+  {
+    policy=SCHEDULING_ROUND_ROBIN;
+    return true;
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::ReserveLeastLoadedWorker()
+{
+  // Workers are checked in order, so the first workers are preferred. This way additional
+  // Matlab processes are only started when commands are actually executed in parallel.
+  bool waitingReported=false;
+  while (true)
+  {
+    std::vector<int> usableWorkerIndices=this->GetUsableWorkerIndices();
+    for (std::vector<int>::iterator workerIndexIt=usableWorkerIndices.begin(); workerIndexIt!=usableWorkerIndices.end(); ++workerIndexIt)
+    {
+      int workerIndex=*workerIndexIt;
+      MatlabFileLock* lock=new MatlabFileLock(GetLockFileName("worker", this->GetWorkerPort(workerIndex)));
+      if (lock->Lock(false))
+      {
+        this->ReservedWorkerLock=lock;
+        return this->GetWorkerPort(workerIndex);
+      }
+      delete lock;
+    }
+    if (usableWorkerIndices.empty())
+    {
+      return -1;
+    }
+    if (!waitingReported)
+    {
+      std::cout << "All Matlab workers are busy, waiting for an idle worker..." << std::endl;
+      waitingReported=true;
+    }
+    vtksys::SystemTools::Delay(WORKER_POLL_INTERVAL_MSEC);
+  }
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::ReserveRoundRobinWorker()
+{
+  std::vector<int> usableWorkerIndices=this->GetUsableWorkerIndices();
+  int workerIndex=this->GetNextRoundRobinWorkerIndex();
+  for (int attempt=0; attempt<this->GetNumberOfWorkers(); attempt++)
+  {
+    if (std::find(usableWorkerIndices.begin(), usableWorkerIndices.end(), workerIndex)!=usableWorkerIndices.end())
+    {
+      MatlabFileLock* lock=new MatlabFileLock(GetLockFileName("worker", this->GetWorkerPort(workerIndex)));
+      // Wait until the worker completes the commands of other processes
+      if (lock->Lock(true))
+      {
+        this->ReservedWorkerLock=lock;
+        return this->GetWorkerPort(workerIndex);
+      }
+      delete lock;
+    }
+    workerIndex=(workerIndex+1)%this->GetNumberOfWorkers();
+  }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+int MatlabWorkerPool::GetNextRoundRobinWorkerIndex()
+{
+  // The index of the next worker is stored in a file, so that it is shared by all MatlabCommander processes
+  MatlabFileLock poolLock(GetLockFileName("pool", this->FirstPort)+".lock");
+  if (!poolLock.Lock(true))
+  {
+    return 0;
+  }
+  const std::string nextWorkerFilename=GetLockFileName("pool", this->FirstPort)+".next";
+  int nextWorkerIndex=0;
+  std::ifstream nextWorkerInputFile(nextWorkerFilename.c_str());
+  if (!(nextWorkerInputFile >> nextWorkerIndex) || nextWorkerIndex<0)
+  {
+    nextWorkerIndex=0;
+  }
+  nextWorkerInputFile.close();
+  nextWorkerIndex%=this->GetNumberOfWorkers();
+  std::ofstream nextWorkerOutputFile(nextWorkerFilename.c_str());
+  nextWorkerOutputFile << (nextWorkerIndex+1)%this->GetNumberOfWorkers() << std::endl;
+  return nextWorkerIndex;
+}
+
+//----------------------------------------------------------------------------
+std::vector<int> MatlabWorkerPool::GetUsableWorkerIndices()
+{
+  std::vector<int> healthyWorkerIndices;
+  std::vector<int> markedWorkerIndices;
+  for (int workerIndex=0; workerIndex<this->GetNumberOfWorkers(); workerIndex++)
+  {
+    if (!this->WorkerHealthy[workerIndex])
+    {
+      continue;
+    }
+    if (IsUnhealthyMarkerValid(this->GetWorkerPort(workerIndex)))
+    {
+      markedWorkerIndices.push_back(workerIndex);
+    }
+    else
+    {
+      healthyWorkerIndices.push_back(workerIndex);
+    }
+  }
+  // A worker that another process could not use may work now, so try it rather than failing
+  return (healthyWorkerIndices.empty() ? markedWorkerIndices : healthyWorkerIndices);
+}
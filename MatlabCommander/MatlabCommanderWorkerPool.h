@@ -0,0 +1,76 @@
+#ifndef __MatlabCommanderWorkerPool_h
+#define __MatlabCommanderWorkerPool_h
+
+#include <string>
+#include <vector>
+
+// Pool of Matlab command server processes (workers) that can execute commands in parallel.
+// Workers of a pool listen on consecutive ports, starting at the first port of the pool.
+// Each MatlabCommander process executes one command at a time, so it reserves a worker while
+// it executes a command by locking a file in the temporary directory. This way MatlabCommander
+// processes that run at the same time (e.g., several CLI modules started in Slicer) share
+// the workers. File locks are released by the operating system when the process exits,
+// so a crashed MatlabCommander process cannot block a worker.
+// A worker that cannot be started or does not respond is marked as unhealthy by creating a marker file
+// next to the lock files, so that other MatlabCommander processes skip it, too. The marker expires after
+// some time, so the worker is tried again (e.g., after it has been restarted).
+
+class MatlabFileLock;
+
+class MatlabWorkerPool
+{
+public:
+  enum SchedulingPolicy
+  {
+    /// Use an idle worker. If all the workers are busy then wait for the first one that becomes idle.
+    SCHEDULING_LEAST_LOADED,
+    /// Use the workers in turn. If the selected worker is busy then wait until it becomes idle.
+    SCHEDULING_ROUND_ROBIN
+  };
+
+  MatlabWorkerPool(int firstPort, int numberOfWorkers, SchedulingPolicy policy);
+  /// Releases the reserved worker
+  ~MatlabWorkerPool();
+
+  int GetNumberOfWorkers() const;
+  int GetWorkerPort(int workerIndex) const;
+
+  /// Reserve a worker for executing a command. Workers that are marked as unhealthy in this process are not used.
+  /// Workers that are marked as unhealthy by other processes are only used if there is no other usable worker.
+  /// Returns the port of the reserved worker, -1 if there is no usable worker.
+  int ReserveWorker();
+
+  /// Release the reserved worker, so that other MatlabCommander processes can use it
+  void ReleaseWorker();
+
+  /// Do not use the worker anymore in this process (e.g., because it could not be started or did not respond)
+  /// and make other processes skip it until the unhealthy marker expires
+  void SetWorkerUnhealthy(int port);
+
+  /// Remove the unhealthy marker of the worker (e.g., because it responded to the health check)
+  void SetWorkerHealthy(int port);
+
+  /// Get scheduling policy from its name ("leastloaded" or "roundrobin").
+  /// Returns false if the name is not recognized.
+  static bool GetSchedulingPolicyFromString(const std::string& name, SchedulingPolicy& policy);
+
+private:
+  MatlabWorkerPool(const MatlabWorkerPool&);
+  MatlabWorkerPool& operator=(const MatlabWorkerPool&);
+
+  int ReserveLeastLoadedWorker();
+  int ReserveRoundRobinWorker();
+  // Returns the index of the next worker in turn (shared by all MatlabCommander processes)
+  int GetNextRoundRobinWorkerIndex();
+  // Returns the indices of workers that can be reserved: workers that are healthy in this process
+  // and are not marked as unhealthy by other processes (or all the workers that are healthy in this process,
+  // if all of them are marked as unhealthy by other processes)
+  std::vector<int> GetUsableWorkerIndices();
+
+  int FirstPort;
+  SchedulingPolicy Policy;
+  std::vector<bool> WorkerHealthy;
+  MatlabFileLock* ReservedWorkerLock;
+};
+
+#endif
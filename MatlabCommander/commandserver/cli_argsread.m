@@ -2,6 +2,13 @@ function params=cli_argsread(args)
 % Retrieve parameters in a structure from a list of command-line arguments
 % The output structure contains all the named arguments (field name is the command-line argument name)
 % and an "unnamed" argument containing the list of unnamed arguments in a cell.
+% If args is a string then it is the name of the device that sent the parameters through the command server
+% connection (see cli_datatransfer).
+
+if ischar(args)
+    params=readTransferredParams(args);
+    return;
+end
 
 args=fixupArgumentList(args);
 
@@ -41,6 +48,17 @@ end
 
 %% Helper functions
 
+% Get parameters that were received in a PARAMS message (N-by-2 cell array of names and values)
+function params=readTransferredParams(deviceName)
+    params={};
+    params.unnamed={};
+    [parameters, found]=cli_datatransfer('read', deviceName);
+    assert(found, ['Parameters were not received from device ',deviceName]);
+    for parameterIndex=1:size(parameters,1)
+        params=saveParam(params,parameters{parameterIndex,1},parameters{parameterIndex,2});
+    end
+end
+
 % Fixing up the parameter list
 % Fiducial point name and value is stored in one argument:
 %  '--somefiducial 12.3,14.6, 18.7'
@@ -1,6 +1,11 @@
 function argswrite(returnParameterFilename, args)
 % Write return values specified in the args structure to the return parameter text file
 
+% Return values may be sent through the command server connection instead of writing the file
+if cli_datatransfer('write', returnParameterFilename, [fieldnames(args) struct2cell(args)])
+  return
+end
+
 % open file for writing text file (create new)
 fid=fopen(returnParameterFilename, 'wt+');
 assert(fid > 0, ['Could not open output file:' returnParameterFilename]);
@@ -6,12 +6,19 @@ function cli_commandserver(port)
     import java.net.Socket
     import java.io.*
     import java.net.ServerSocket
+    import java.net.InetSocketAddress
+    import java.nio.channels.*
     
     % Add current directory to the path so that all cli_* functions will be available even when the current working directory is changed
     addpath(pwd);
     
     serverSocketInfo.port=4100;
-    serverSocketInfo.timeout=1000;
+    % Maximum time of waiting for network events without calling drawnow (to keep figures responsive)
+    serverSocketInfo.timeout=100;
+    % The connection is kept open after a command is completed, so that the client can send
+    % more commands without reconnecting. The connection is closed if the client does not
+    % send a new command within this time.
+    serverSocketInfo.keepAliveTimeoutSec=10;
 
     if (nargin>0)
         serverSocketInfo.port=port;
@@ -30,87 +37,155 @@ function cli_commandserver(port)
     end
 
     try
-        serverSocketInfo.socket = ServerSocket(serverSocketInfo.port);        
+        serverSocketInfo.channel = ServerSocketChannel.open;
+        serverSocketInfo.socket = serverSocketInfo.channel.socket;
+        serverSocketInfo.socket.bind(InetSocketAddress(serverSocketInfo.port));
         OPENIGTLINK_SERVER_SOCKET=serverSocketInfo.socket;
     catch 
         error('Failed to open server port. Make sure the port is not open already or blocked by firewall.');
     end        
-    serverSocketInfo.socket.setSoTimeout(serverSocketInfo.timeout);
+
+    % All network events (new connection, command received on an open connection) are waited for
+    % by a selector. The selector returns as soon as an event occurs, so there is no polling delay.
+    serverSocketInfo.selector = Selector.open;
+    serverSocketInfo.channel.configureBlocking(false);
+    serverSocketInfo.channel.register(serverSocketInfo.selector, SelectionKey.OP_ACCEPT);
+
+    % Open client connections, key is the connection ID
+    clients=containers.Map('KeyType','double','ValueType','any');
+    lastClientId=0;
+
+    % Commands are read as soon as they arrive and queued, so that a client can send multiple commands
+    % without waiting for the replies. Queued commands are executed in the order of arrival (commands received
+    % on multiple connections are processed one after the other), time spent in the queue is reported as server queue wait time.
+    requestQueue={};
+    lastRequestId=0;
 
     disp('Waiting for client connections...');
     
     % Handle client connections
+    lastDrawNowTime=tic;
     while(true)
 
-        % Wait for client connection
-        drawNowCounter=0;
-        while(true),            
-            try 
-              clientSocketInfo.socket = serverSocketInfo.socket.accept;  
-              break; 
-            catch
+        % Wait for network events (just check for them if there are commands waiting for execution)
+        if (isempty(requestQueue))
+            numberOfReadyChannels=serverSocketInfo.selector.select(serverSocketInfo.timeout);
+        else
+            numberOfReadyChannels=serverSocketInfo.selector.selectNow;
+        end
+        if (toc(lastDrawNowTime)*1000>serverSocketInfo.timeout)
+            drawnow
+            lastDrawNowTime=tic;
+        end
+
+        % Close idle connections
+        clientIds=clients.keys;
+        for clientIndex=1:length(clientIds)
+            clientSocketInfo=clients(clientIds{clientIndex});
+            if (toc(clientSocketInfo.lastActivityTime)>serverSocketInfo.keepAliveTimeoutSec ...
+                && ~any(cellfun(@(request) request.clientId==clientSocketInfo.id, requestQueue)))
+                disp('Client connection is idle, closing it');
+                CloseClientConnection(clientSocketInfo);
+                clients.remove(clientIds{clientIndex});
             end
-            if (drawNowCounter>10)
-              drawnow
-              drawNowCounter=0;
-            end;
-            drawNowCounter=drawNowCounter+1;
-            pause(0.5);
         end
 
-        % Client connected
-        disp('Client connected')
-        % Rehash forces re-reading of all Matlab functions from files
-        rehash        
-        
-        clientSocketInfo.remoteHost = char(clientSocketInfo.socket.getInetAddress);
-        clientSocketInfo.outputStream = clientSocketInfo.socket.getOutputStream;
-        clientSocketInfo.inputStream = clientSocketInfo.socket.getInputStream;       
-        clientSocketInfo.messageHeaderReceiveTimeoutSec=5;
-        clientSocketInfo.messageBodyReceiveTimeoutSec=25;
-
-        % Read command
-        receivedMsg=ReadOpenIGTLinkStringMessage(clientSocketInfo);
-        if(~isempty(receivedMsg) && ~isempty(receivedMsg.string))
-            dataType=deblank(char(receivedMsg.dataTypeName));
-            deviceName=deblank(char(receivedMsg.deviceName));
-            cmd=deblank(char(receivedMsg.string));
-            replyDeviceName='ACK';
-            if (~strcmp(dataType,'STRING'))
-              response=['ERROR: Expected STRING data type, received data type: [',dataType,']'];
-            elseif (length(deviceName)<3 || ~strcmp(deviceName(1:3),'CMD'))
-              response=['ERROR: Expected device name starting with CMD. Received device name: [',deviceName,']'];
-            elseif (isempty(cmd))
-              response='ERROR: Received empty command string';
-            else
-              % Reply device name for CMD is ACQ, for CMD_someuid is ACK_someuid
-              replyDeviceName=deviceName;
-              replyDeviceName(1:3)='ACK';
-              try
-                disp([' Execute command: ',cmd]);
-                response=evalc(cmd);
-                if (isempty(response))
-                  % Replace empty response by OK to indicate success
-                  response='OK';
+        if (numberOfReadyChannels==0 && isempty(requestQueue))
+            continue;
+        end
+
+        % Collect the selected keys first, as processing of client connections modifies the selected key set
+        readyKeys={};
+        keyIterator=serverSocketInfo.selector.selectedKeys.iterator;
+        while (keyIterator.hasNext)
+            readyKeys{end+1}=keyIterator.next;
+            keyIterator.remove;
+        end
+
+        for keyIndex=1:length(readyKeys)
+            key=readyKeys{keyIndex};
+            if (~key.isValid)
+                continue;
+            end
+
+            if (key.isAcceptable)
+                % Client connected
+                clientChannel=serverSocketInfo.channel.accept;
+                if (isempty(clientChannel))
+                    continue;
                 end
-                disp(' Command execution completed successfully');
-              catch ME
-                response=['ERROR: Command execution failed. ',ME.getReport('extended','hyperlinks','off')];
-              end
+                disp('Client connected')
+                % Functions are not re-read from files here (rehash is slow if there are many toolboxes on the path),
+                % MatlabCommander calls cli_reload to clear only the functions that have been modified.
+                lastClientId=lastClientId+1;
+                clientSocketInfo=[];
+                clientSocketInfo.id=lastClientId;
+                clientSocketInfo.channel=clientChannel;
+                clientSocketInfo.socket=clientChannel.socket;
+                clientSocketInfo.remoteHost = char(clientSocketInfo.socket.getInetAddress);
+                % Message header and body are written separately, send them without waiting for acknowledgement
+                clientSocketInfo.socket.setTcpNoDelay(true);
+                clientSocketInfo.messageHeaderReceiveTimeoutSec=5;
+                clientSocketInfo.messageBodyReceiveTimeoutSec=25;
+                clientSocketInfo.messageSendTimeoutSec=25;
+                % Message CRC is not computed and checked on local connections if skipping is enabled
+                % CRC is not used at all if crc64_mex is not available (computing it in Matlab would take minutes for large messages)
+                clientSocketInfo.checkCrc=isCrc64Available() && ~(isLoopbackCrcSkipEnabled() && clientSocketInfo.socket.getInetAddress.isLoopbackAddress);
+                clientSocketInfo.lastActivityTime=tic;
+                % Data is read and written directly through the non-blocking channel, in large blocks.
+                % The connection's own selector is used for waiting while data is being transferred.
+                clientSocketInfo.channel.configureBlocking(false);
+                clientSocketInfo.selector=Selector.open;
+                clientSocketInfo.selectionKey=clientSocketInfo.channel.register(clientSocketInfo.selector, SelectionKey.OP_READ);
+                % Wait for commands on this connection
+                clientSocketInfo.channel.register(serverSocketInfo.selector, SelectionKey.OP_READ, clientSocketInfo.id);
+                clients(clientSocketInfo.id)=clientSocketInfo;
+                continue;
             end
-        else
-            response='ERROR: Error while receiving the command';            
-        end        
-        
-        % Send reply
-        responseStr=num2str(response);
-        disp([' Response (sent to device ',replyDeviceName,'): ', responseStr]);
-        WriteOpenIGTLinkStringMessage(clientSocketInfo, responseStr, replyDeviceName);
 
-        % Close connection
-        clientSocketInfo.socket.close;
-        clientSocketInfo.socket=[];
-        disp('Client connection closed');
+            if (key.isReadable)
+                clientId=key.attachment;
+                if (~clients.isKey(clientId))
+                    key.cancel;
+                    continue;
+                end
+                clientSocketInfo=clients(clientId);
+                % Read all the messages that the client has sent
+                keepConnection=true;
+                while (keepConnection)
+                    lastRequestId=lastRequestId+1;
+                    [keepConnection, request]=ReadClientMessage(clientSocketInfo, ['r' num2str(lastRequestId)]);
+                    if (~isempty(request))
+                        requestQueue{end+1}=request;
+                    end
+                    if (~isClientDataAvailable(clientSocketInfo))
+                        break;
+                    end
+                end
+                if (keepConnection)
+                    % Wait for further commands on this connection
+                    clientSocketInfo.lastActivityTime=tic;
+                    clients(clientId)=clientSocketInfo;
+                else
+                    requestQueue=RemoveClientConnection(clients, clientId, requestQueue);
+                end
+            end
+
+        end
+
+        % Execute the command that has been waiting for the longest time
+        if (~isempty(requestQueue))
+            request=requestQueue{1};
+            requestQueue(1)=[];
+            clientSocketInfo=clients(request.clientId);
+            keepConnection=ExecuteClientRequest(clientSocketInfo, request);
+            if (keepConnection)
+                clientSocketInfo.lastActivityTime=tic;
+                clients(request.clientId)=clientSocketInfo;
+            else
+                requestQueue=RemoveClientConnection(clients, request.clientId, requestQueue);
+            end
+        end
 
     end
 
@@ -120,9 +195,376 @@ function cli_commandserver(port)
 
 end
 
-function msg=ReadOpenIGTLinkStringMessage(clientSocket)
-    msg=ReadOpenIGTLinkMessage(clientSocket);
-    if (length(msg.body)<5)
+% Read a message from the client. Data objects are stored until the next command of the client arrives,
+% commands are returned in request (with the data objects bound to them) for queued execution.
+% Requests that cannot be executed (invalid command messages, readiness checks) are replied immediately,
+% so replies may arrive at the client in a different order than the commands were sent.
+% Returns keepConnection=false if the client closed the connection or the connection cannot be used anymore.
+function [keepConnection, request]=ReadClientMessage(clientSocketInfo, requestId)
+
+    keepConnection=false;
+    request=[];
+
+    % Read message
+    receiveStartTime=tic;
+    try
+        receivedMsg=ReadOpenIGTLinkMessage(clientSocketInfo);
+    catch ME
+        if (strcmp(ME.identifier,'cli_commandserver:connectionClosed'))
+            % The client closed the connection, there is no need to reply
+            return
+        end
+        disp(ME.message);
+        % The message stream is out of sync, cannot continue this session
+        WriteOpenIGTLinkStringMessage(clientSocketInfo, 'ERROR: Error while receiving the command', 'ACK');
+        return
+    end
+    receiveSec=toc(receiveStartTime);
+    dataType=deblank(char(receivedMsg.dataTypeName));
+    deviceName=deblank(char(receivedMsg.deviceName));
+
+    if (strcmp(dataType,'GET_STATUS'))
+        % Readiness check: the server is ready to execute commands.
+        % The client only accepts 0 body CRC without checking if the server announces here that it does not compute the CRC.
+        statusString='Ready';
+        if (~clientSocketInfo.checkCrc)
+            statusString=[statusString, ' CRC off'];
+        end
+        keepConnection=WriteOpenIGTLinkStatusMessage(clientSocketInfo, statusString, deviceName);
+        return
+    end
+
+    if (strcmp(dataType,'IMAGE'))
+        % Image that the next command will use instead of reading it from file
+        try
+            cli_datatransfer('receive', clientSocketInfo.id, deviceName, ParseOpenIGTLinkImageMessage(receivedMsg));
+            disp([' Received image from device ',deviceName]);
+        catch ME
+            % The command will read the image from file
+            disp(['Failed to decode image received from device ',deviceName,': ',ME.message]);
+        end
+        keepConnection=true;
+        return
+    end
+
+    if (strcmp(dataType,'POLYDATA'))
+        % Mesh that the next command will use instead of reading it from file
+        try
+            cli_datatransfer('receive', clientSocketInfo.id, deviceName, ParseOpenIGTLinkPolyDataMessage(receivedMsg));
+            disp([' Received mesh from device ',deviceName]);
+        catch ME
+            % The command will read the mesh from file
+            disp(['Failed to decode mesh received from device ',deviceName,': ',ME.message]);
+        end
+        keepConnection=true;
+        return
+    end
+
+    if (strcmp(dataType,'PARAMS'))
+        % Function parameters that the next command will use instead of the argument list in the command string
+        try
+            cli_datatransfer('receive', clientSocketInfo.id, deviceName, ParseOpenIGTLinkParamsMessage(receivedMsg));
+        catch ME
+            % cli_argsread will report the missing parameters when the command is executed
+            disp(['Failed to decode parameters received from device ',deviceName,': ',ME.message]);
+        end
+        keepConnection=true;
+        return
+    end
+
+    if (strcmp(dataType,'STRING') && strncmp(deviceName,'RPL',3))
+        % Reply policy of the next command (how the command output is returned)
+        receivedMsg=ParseOpenIGTLinkStringMessage(receivedMsg);
+        cli_datatransfer('receive', clientSocketInfo.id, deviceName, deblank(char(receivedMsg.string)));
+        keepConnection=true;
+        return
+    end
+
+    % Read command
+    response='';
+    cmd='';
+    if (~strcmp(dataType,'STRING') && ~strcmp(dataType,'LARGESTRING'))
+        response=['ERROR: Expected STRING or LARGESTRING data type, received data type: [',dataType,']'];
+    else
+        receivedMsg=ParseOpenIGTLinkStringMessage(receivedMsg);
+        cmd=deblank(char(receivedMsg.string));
+        if (length(deviceName)<3 || ~strcmp(deviceName(1:3),'CMD'))
+            response=['ERROR: Expected device name starting with CMD. Received device name: [',deviceName,']'];
+        elseif (isempty(cmd))
+            response='ERROR: Received empty command string';
+        end
+    end
+    if (~isempty(response))
+        replyDeviceName='ACK';
+        if (strncmp(deviceName,'CMD',3))
+            replyDeviceName=['ACK',deviceName(4:end)];
+        end
+        disp([' Response (sent to device ',replyDeviceName,'): ', abbreviateForDisplay(response)]);
+        keepConnection=WriteOpenIGTLinkStringMessage(clientSocketInfo, response, replyDeviceName);
+        return
+    end
+
+    % Reply device name for CMD is ACK, for CMD_someuid is ACK_someuid.
+    % Progress reported by cli_progress is sent to PRG_someuid while the command is running,
+    % server-side timing is sent to TIM_someuid. Reply policy is received from RPL_someuid (before the command).
+    request.clientId=clientSocketInfo.id;
+    request.requestId=requestId;
+    request.cmd=cmd;
+    request.replyDeviceName=['ACK',deviceName(4:end)];
+    request.progressDeviceName=['PRG',deviceName(4:end)];
+    request.timingDeviceName=['TIM',deviceName(4:end)];
+    request.replyPolicyDeviceName=['RPL',deviceName(4:end)];
+    request.receiveSec=receiveSec;
+    request.receivedTime=tic;
+    % Data objects received before the command are used by this command
+    cli_datatransfer('bind', clientSocketInfo.id, requestId);
+    keepConnection=true;
+end
+
+% Execute a queued command and send the outputs and the reply to the client.
+% Returns false if the connection cannot be used anymore.
+function keepConnection=ExecuteClientRequest(clientSocketInfo, request)
+
+    global CLI_PROGRESS_REPORTER
+
+    keepConnection=false;
+
+    % Duration of the command execution phases (in seconds), sent to the client before the reply
+    timing.queueWait=toc(request.receivedTime);
+    timing.receive=request.receiveSec;
+    timing.eval=0;
+    timing.serialize=0;
+
+    outputs=[];
+    CLI_PROGRESS_REPORTER=@(fraction, message) WriteOpenIGTLinkProgressMessage(clientSocketInfo, fraction, message, request.progressDeviceName);
+    cli_datatransfer('begin', request.requestId);
+    replyPolicy=getReplyPolicy(request.replyPolicyDeviceName);
+    replyFilename='';
+    evalStartTime=tic;
+    try
+        disp([' Execute command: ',abbreviateForDisplay(request.cmd)]);
+        switch (replyPolicy.mode)
+            case 'none'
+                % Output is only printed on the console
+                eval(request.cmd);
+                response='';
+            case {'file','truncate','tail'}
+                % Output is written to the file by diary, so it is not stored in memory.
+                % The client owns the file (it is not removed by the server) if the command succeeds with file policy.
+                replyFilename=[tempname,'.txt'];
+                diary(replyFilename);
+                try
+                    eval(request.cmd);
+                catch ME
+                    diary('off');
+                    rethrow(ME);
+                end
+                diary('off');
+                if (strcmp(replyPolicy.mode,'file'))
+                    response=replyFilename;
+                else
+                    % Only the returned part of the output is read from the file
+                    response=readLimitedReply(replyFilename, replyPolicy);
+                    deleteReplyFile(replyFilename);
+                    replyFilename='';
+                end
+            otherwise
+                response=evalc(request.cmd);
+        end
+        timing.eval=toc(evalStartTime);
+        if (isempty(response))
+            % Replace empty response by OK to indicate success
+            response='OK';
+        end
+        disp(' Command execution completed successfully');
+        outputs=cli_datatransfer('end');
+    catch ME
+        timing.eval=toc(evalStartTime);
+        response=['ERROR: Command execution failed. ',ME.getReport('extended','hyperlinks','off')];
+        cli_datatransfer('end');
+    end
+    CLI_PROGRESS_REPORTER=[];
+
+    % Send data objects that the command created for the client.
+    % If a data object cannot be serialized then the remaining ones are not sent and the command fails
+    % (the error must not stop the server).
+    serializeStartTime=tic;
+    try
+        for outputIndex=1:length(outputs)
+            if iscell(outputs(outputIndex).data)
+                % Return parameters
+                writeSuccess=WriteOpenIGTLinkParamsMessage(clientSocketInfo, outputs(outputIndex).data, outputs(outputIndex).deviceName);
+            elseif isfield(outputs(outputIndex).data,'faces')
+                disp([' Send mesh to device ',outputs(outputIndex).deviceName]);
+                writeSuccess=WriteOpenIGTLinkPolyDataMessage(clientSocketInfo, outputs(outputIndex).data, outputs(outputIndex).deviceName);
+            else
+                disp([' Send image to device ',outputs(outputIndex).deviceName]);
+                % If voxels are shared through a memory-mapped file then only the image geometry is sent
+                includePixelData=isempty(outputs(outputIndex).mappedFilename);
+                writeSuccess=WriteOpenIGTLinkImageMessage(clientSocketInfo, outputs(outputIndex).data, outputs(outputIndex).deviceName, includePixelData);
+            end
+            if (~writeSuccess)
+                % The connection is broken
+                deleteReplyFile(replyFilename);
+                return
+            end
+        end
+    catch ME
+        response=['ERROR: Failed to send output ',outputs(outputIndex).deviceName,'. ',ME.getReport('extended','hyperlinks','off')];
+    end
+    timing.serialize=toc(serializeStartTime);
+    if (strncmp(response,'ERROR:',6))
+        deleteReplyFile(replyFilename);
+    end
+    response=limitReplyLength(response, replyPolicy);
+
+    % Send server-side timing
+    timingStr=sprintf('{"queueWait":%g,"receive":%g,"eval":%g,"serialize":%g}', ...
+        timing.queueWait, timing.receive, timing.eval, timing.serialize);
+    if (~WriteOpenIGTLinkStringMessage(clientSocketInfo, timingStr, request.timingDeviceName))
+        % The connection is broken
+        deleteReplyFile(replyFilename);
+        return
+    end
+
+    % Send reply
+    responseStr=num2str(response);
+    disp([' Response (sent to device ',request.replyDeviceName,'): ', abbreviateForDisplay(responseStr)]);
+    keepConnection=WriteOpenIGTLinkStringMessage(clientSocketInfo, responseStr, request.replyDeviceName);
+    if (~keepConnection)
+        deleteReplyFile(replyFilename);
+    end
+end
+
+% Remove the output file of the file reply policy if the client does not receive its name
+% (command failed or the connection is broken), as nobody else would remove it
+function deleteReplyFile(replyFilename)
+    if (~isempty(replyFilename) && exist(replyFilename,'file'))
+        delete(replyFilename);
+    end
+end
+
+% Get the reply policy of the current command: mode is full (default), truncate, tail, file, or none;
+% maxLength is the maximum reply length for truncate and tail modes
+function replyPolicy=getReplyPolicy(deviceName)
+    replyPolicy.mode='full';
+    replyPolicy.maxLength=Inf;
+    [policyStr, found]=cli_datatransfer('option', deviceName);
+    if (~found)
+        return
+    end
+    [mode, maxLengthStr]=strtok(policyStr);
+    if (~any(strcmp(mode,{'full','truncate','tail','file','none'})))
+        disp(['Unknown reply policy: ',policyStr,'. Complete output is returned.']);
+        return
+    end
+    replyPolicy.mode=mode;
+    maxLength=str2double(maxLengthStr);
+    if (~isnan(maxLength) && maxLength>0)
+        replyPolicy.maxLength=maxLength;
+    end
+end
+
+% Shorten the response to maxLength characters if the reply policy is truncate or tail.
+% Error messages are always kept from the beginning, so that the client recognizes them as errors.
+function response=limitReplyLength(response, replyPolicy)
+    if (~any(strcmp(replyPolicy.mode,{'truncate','tail'})) || length(response)<=replyPolicy.maxLength)
+        return
+    end
+    [partLength, keepTail, note]=getReplyPart(length(response), replyPolicy, strncmp(response,'ERROR:',6));
+    if (keepTail)
+        response=[note,response(end-partLength+1:end)];
+    else
+        response=[response(1:partLength),note];
+    end
+end
+
+% Read the command output that diary wrote to the file, shortened the same way as limitReplyLength does,
+% but only the returned part of the file is read
+function response=readLimitedReply(replyFilename, replyPolicy)
+    fileInfo=dir(replyFilename);
+    totalLength=fileInfo.bytes;
+    fid=fopen(replyFilename,'r');
+    if (fid<0)
+        error(['Failed to open command output file ',replyFilename]);
+    end
+    if (totalLength<=replyPolicy.maxLength)
+        response=fread(fid,[1 Inf],'*char');
+    else
+        isError=strncmp(fread(fid,[1 6],'*char'),'ERROR:',6);
+        [partLength, keepTail, note]=getReplyPart(totalLength, replyPolicy, isError);
+        if (keepTail)
+            fseek(fid, -partLength, 'eof');
+            response=[note,fread(fid,[1 partLength],'*char')];
+        else
+            fseek(fid, 0, 'bof');
+            response=[fread(fid,[1 partLength],'*char'),note];
+        end
+    end
+    fclose(fid);
+end
+
+% Returns the length of the part of a long response (totalLength characters) that the truncate or tail reply policy keeps,
+% whether it is kept from the end, and the note about the truncation that is added to it (if it fits in maxLength)
+function [partLength, keepTail, note]=getReplyPart(totalLength, replyPolicy, isError)
+    maxLength=replyPolicy.maxLength;
+    keepTail=(strcmp(replyPolicy.mode,'tail') && ~isError);
+    if (keepTail)
+        note=sprintf('(reply truncated, %d characters in total) ...\n', totalLength);
+    else
+        note=sprintf('\n... (reply truncated, %d characters in total)', totalLength);
+    end
+    if (length(note)>=maxLength)
+        note='';
+    end
+    partLength=maxLength-length(note);
+end
+
+% Returns true if data received from the client is waiting to be read
+function available=isClientDataAvailable(clientSocketInfo)
+    import java.nio.channels.SelectionKey
+    clientSocketInfo.selectionKey.interestOps(SelectionKey.OP_READ);
+    available=(clientSocketInfo.selector.selectNow>0);
+    clientSocketInfo.selector.selectedKeys.clear;
+end
+
+% Close a client connection and remove its queued commands (their replies cannot be sent anymore)
+function requestQueue=RemoveClientConnection(clients, clientId, requestQueue)
+    CloseClientConnection(clients(clientId));
+    clients.remove(clientId);
+    for requestIndex=length(requestQueue):-1:1
+        if (requestQueue{requestIndex}.clientId==clientId)
+            % Release the data objects of the command
+            cli_datatransfer('begin', requestQueue{requestIndex}.requestId);
+            cli_datatransfer('end');
+            requestQueue(requestIndex)=[];
+        end
+    end
+    % Data objects received after the last command
+    cli_datatransfer('begin', clientId);
+    cli_datatransfer('end');
+end
+
+function CloseClientConnection(clientSocketInfo)
+    try
+        clientSocketInfo.channel.close;
+        clientSocketInfo.selector.close;
+    catch ME
+        disp(ME.message);
+    end
+    disp('Client connection closed');
+end
+
+% Get the string from a STRING or LARGESTRING message.
+% LARGESTRING has the same structure as STRING, but the string length is stored in 8 bytes
+% (STRING messages can only contain strings shorter than 64kB).
+function msg=ParseOpenIGTLinkStringMessage(msg)
+    if (strcmp(deblank(char(msg.dataTypeName)),'LARGESTRING'))
+        strMsgHeaderLength=10;
+    else
+        strMsgHeaderLength=4;
+    end
+    if (length(msg.body)<strMsgHeaderLength)
         disp('Error: STRING message received with incomplete contents')
         msg.string='';
         return
@@ -131,8 +573,16 @@ function msg=ReadOpenIGTLinkStringMessage(clientSocket)
     if (strMsgEncoding~=3)
         disp(['Warning: STRING message received with unknown encoding ',num2str(strMsgEncoding)])
     end
-    strMsgLength=convertFromUint8VectorToUint16(msg.body(3:4));
-    msg.string=char(msg.body(5:4+strMsgLength));
+    if (strMsgHeaderLength==4)
+        strMsgLength=double(convertFromUint8VectorToUint16(msg.body(3:4)));
+    else
+        strMsgLength=double(convertFromBigEndianUint8Vector(msg.body(3:10),'uint64'));
+    end
+    if (strMsgHeaderLength+strMsgLength>length(msg.body))
+        disp('Error: STRING message received with incomplete contents')
+        strMsgLength=length(msg.body)-strMsgHeaderLength;
+    end
+    msg.string=char(msg.body(strMsgHeaderLength+1:strMsgHeaderLength+strMsgLength));
 end    
 
 function msg=ReadOpenIGTLinkMessage(clientSocket)
@@ -141,47 +591,325 @@ function msg=ReadOpenIGTLinkMessage(clientSocket)
     if (length(headerData)==openIGTLinkHeaderLength)
         msg=ParseOpenIGTLinkMessageHeader(headerData);
         msg.body=ReadWithTimeout(clientSocket, msg.bodySize, clientSocket.messageBodyReceiveTimeoutSec);            
+        if (clientSocket.checkCrc && computeCrc64(msg.body)~=msg.bodyCrc)
+            error(['ERROR: CRC check failed for message received from device ',deblank(char(msg.deviceName))])
+        end
     else
         error('ERROR: Timeout while waiting receiving OpenIGTLink message header')
     end
 end    
         
+% Strings that do not fit into a STRING message (64kB) are sent in a LARGESTRING message
 function result=WriteOpenIGTLinkStringMessage(clientSocket, msgString, deviceName)
-    msg.dataTypeName='STRING';
     msg.deviceName=deviceName;
     msg.timestamp=0;
     msgString=[uint8(msgString) uint8(0)]; % Convert string to uint8 vector and add terminator character
-    msg.body=[convertFromUint16ToUint8Vector(3),convertFromUint16ToUint8Vector(length(msgString)),msgString];
+    if (length(msgString)<=65535)
+        msg.dataTypeName='STRING';
+        msg.body=[convertFromUint16ToUint8Vector(3),convertFromUint16ToUint8Vector(length(msgString)),msgString];
+    else
+        msg.dataTypeName='LARGESTRING';
+        msg.body=[convertFromUint16ToUint8Vector(3),convertFromInt64ToUint8Vector(length(msgString)),msgString];
+    end
     result=WriteOpenIGTLinkMessage(clientSocket, msg);
 end
 
+% Shorten long commands and responses for logging on the console
+function str=abbreviateForDisplay(str)
+    maxDisplayLength=1000;
+    if (length(str)>maxDisplayLength)
+        str=[str(1:maxDisplayLength),' ... (',num2str(length(str)),' characters)'];
+    end
+end
+
+% Write progress of the running command in a STRING message: completed fraction (or '-' if not known),
+% followed by a space and the status message
+function WriteOpenIGTLinkProgressMessage(clientSocket, fraction, message, deviceName)
+    if isempty(fraction)
+        fractionStr='-';
+    else
+        fractionStr=num2str(min(max(fraction,0),1));
+    end
+    % If sending fails then the connection is broken, which is detected when the reply is sent
+    WriteOpenIGTLinkStringMessage(clientSocket, [fractionStr,' ',message], deviceName);
+end
+
+% Write a STATUS message with OK status code
+% Returns 1 if successful, 0 if failed
+function result=WriteOpenIGTLinkStatusMessage(clientSocket, statusString, deviceName)
+    msg.dataTypeName='STATUS';
+    msg.deviceName=deviceName;
+    msg.timestamp=0;
+    statusCodeOk=1;
+    msg.body=[convertFromUint16ToUint8Vector(statusCodeOk), ...
+        convertFromInt64ToUint8Vector(0), ... % subcode
+        uint8(padString('',20)), ... % error name
+        uint8(statusString), uint8(0)];
+    result=WriteOpenIGTLinkMessage(clientSocket, msg);
+end
+
+% Write an image (with the same structure as returned by cli_imageread) in an IMAGE message.
+% If includePixelData is false then the message only contains the image header (with zero subvolume size).
+% Returns 1 if successful, 0 if failed
+function result=WriteOpenIGTLinkImageMessage(clientSocket, img, deviceName, includePixelData)
+    msg.dataTypeName='IMAGE';
+    msg.deviceName=deviceName;
+    msg.timestamp=0;
+    dims=size(img.pixelData);
+    if (length(dims)<3)
+        % 2D image is sent as single-slice 3D volume
+        dims(3)=1;
+    end
+    if isfield(img,'ijkToLpsTransform')
+        ijkToLpsTransform=img.ijkToLpsTransform;
+    else
+        ijkToLpsTransform=eye(4);
+    end
+    % Message contains axis directions scaled by spacing and position of the volume center
+    % (origin of the IJK coordinate system is (1,1,1) in ijkToLpsTransform)
+    axes_directions=ijkToLpsTransform(1:3,1:3);
+    axes_origin=ijkToLpsTransform(1:3,:)*[1;1;1;1];
+    center=axes_origin+axes_directions*(dims'-1)/2;
+    [dummy1,dummy2,systemEndian]=computer();
+    if isequal(systemEndian,'B')
+        pixelDataEndian=1;
+    else
+        pixelDataEndian=2;
+    end
+    if (includePixelData)
+        subvolumeSize=dims;
+    else
+        subvolumeSize=[0 0 0];
+    end
+    imageHeader=[convertFromUint16ToUint8Vector(1), ... % version
+        uint8(1), ... % number of components
+        uint8(getImageMessageScalarType(class(img.pixelData))), ...
+        uint8(pixelDataEndian), ...
+        uint8(2), ... % coordinate system: LPS
+        convertToBigEndianUint8Vector(uint16(dims)), ...
+        convertToBigEndianUint8Vector(single([axes_directions(:); center])), ...
+        convertToBigEndianUint8Vector(uint16([0 0 0])), ... % subvolume offset
+        convertToBigEndianUint8Vector(uint16(subvolumeSize))];
+    if (includePixelData)
+        msg.body=[imageHeader, reshape(typecast(img.pixelData(:),'uint8'),1,[])];
+    else
+        msg.body=imageHeader;
+    end
+    result=WriteOpenIGTLinkMessage(clientSocket, msg);
+end
+
+% Get an image (with the same structure as returned by cli_imageread) from an IMAGE message.
+% If the message only contains the image header (zero subvolume size) then pixelData is an empty array
+% of the voxel type, the voxels are then read from a memory-mapped file by cli_imageread.
+function img=ParseOpenIGTLinkImageMessage(msg)
+    imageHeaderLength=72;
+    assert(length(msg.body)>=imageHeaderLength, 'IMAGE message received with incomplete contents');
+    assert(msg.body(3)==1, 'Only single-component images are supported');
+    pixelType=getImageMessagePixelType(msg.body(4));
+    pixelDataEndian=msg.body(5); % 1: big, 2: little
+    coordinateSystem=msg.body(6); % 1: RAS, 2: LPS
+    dims=double(convertFromBigEndianUint8Vector(msg.body(7:12),'uint16'));
+    matrix=double(convertFromBigEndianUint8Vector(msg.body(13:60),'single'));
+    subvolumeSize=double(convertFromBigEndianUint8Vector(msg.body(67:72),'uint16'));
+    assert(isequal(subvolumeSize,dims) || ~any(subvolumeSize), 'Image subvolumes are not supported');
+
+    if (any(subvolumeSize))
+        pixelData=typecast(msg.body(imageHeaderLength+1:end), pixelType);
+        assert(numel(pixelData)==prod(dims), 'IMAGE message contains incomplete pixel data');
+        [dummy1,dummy2,systemEndian]=computer();
+        if ((pixelDataEndian==1)~=isequal(systemEndian,'B'))
+            pixelData=swapbytes(pixelData);
+        end
+        img.pixelData=reshape(pixelData,dims);
+    else
+        img.pixelData=zeros(0,pixelType);
+    end
+
+    % Message contains axis directions scaled by spacing and position of the volume center
+    axes_directions=reshape(matrix(1:9),3,3);
+    center=reshape(matrix(10:12),3,1);
+    if (coordinateSystem==1)
+        rasToLps=diag([-1 -1 1]);
+        axes_directions=rasToLps*axes_directions;
+        center=rasToLps*center;
+    end
+    axes_origin=center-axes_directions*(dims'-1)/2;
+    ijkZeroBasedToLpsTransform=[[axes_directions, axes_origin]; [0 0 0 1]];
+    ijkOneBasedToIjkZeroBasedTransform=[[eye(3), [-1;-1;-1] ]; [0 0 0 1]];
+    % Use the one-based IJK transform (origin is at [1,1,1]), same as cli_imageread
+    img.ijkToLpsTransform=ijkZeroBasedToLpsTransform*ijkOneBasedToIjkZeroBasedTransform;
+
+    % Fill the same metadata fields as the NRRD file header would contain
+    img.metaData=[];
+    img.metaData.type=getNrrdType(pixelType);
+    img.metaData.dimension='3';
+    img.metaData.space='left-posterior-superior';
+    img.metaData.sizes=num2str(dims);
+    img.metaData.space_directions=sprintf('(%f,%f,%f) (%f,%f,%f) (%f,%f,%f)',axes_directions);
+    img.metaData.kinds='domain domain domain';
+    img.metaData.endian='little';
+    img.metaData.encoding='raw';
+    img.metaData.space_origin=sprintf('(%f,%f,%f)',axes_origin);
+    img.metaDataFieldNames=[];
+    img.metaDataFieldNames.space_directions='space directions';
+    img.metaDataFieldNames.space_origin='space origin';
+end
+
+% Write a triangle mesh (with the same structure as returned by cli_geometryread) in a POLYDATA message.
+% Vertices are sent in LPS coordinate system, MatlabCommander converts them to RAS when it writes the file.
+% Returns 1 if successful, 0 if failed
+function result=WriteOpenIGTLinkPolyDataMessage(clientSocket, geometry, deviceName)
+    msg.dataTypeName='POLYDATA';
+    msg.deviceName=deviceName;
+    msg.timestamp=0;
+    numberOfPoints=size(geometry.vertices,1);
+    numberOfTriangles=size(geometry.faces,1);
+    % Each polygon is stored as number of points (3) and zero-based point indices
+    polygons=[repmat(uint32(3),1,numberOfTriangles); uint32(geometry.faces'-1)];
+    polyDataHeader=uint32([numberOfPoints, 0, 0, 0, 0, ... % points, vertices, lines
+        numberOfTriangles, numel(polygons)*4, ... % polygons
+        0, 0, 0]); % triangle strips, attributes
+    msg.body=[convertToBigEndianUint8Vector(polyDataHeader), ...
+        convertToBigEndianUint8Vector(single(geometry.vertices')), ...
+        convertToBigEndianUint8Vector(polygons)];
+    result=WriteOpenIGTLinkMessage(clientSocket, msg);
+end
+
+% Get a triangle mesh (with the same structure as returned by cli_geometryread) from a POLYDATA message.
+% MatlabCommander sends the vertices in LPS coordinate system, so they do not need to be converted.
+function geometry=ParseOpenIGTLinkPolyDataMessage(msg)
+    polyDataHeaderLength=40;
+    body=msg.body;
+    assert(length(body)>=polyDataHeaderLength, 'POLYDATA message received with incomplete contents');
+    polyDataHeader=double(convertFromBigEndianUint8Vector(body(1:polyDataHeaderLength),'uint32'));
+    numberOfPoints=polyDataHeader(1);
+    numberOfTriangles=polyDataHeader(6);
+    assert(polyDataHeader(2)==0 && polyDataHeader(4)==0 && polyDataHeader(8)==0 ...
+        && polyDataHeader(7)==numberOfTriangles*16, 'Only triangle meshes are supported');
+    pointsEnd=polyDataHeaderLength+numberOfPoints*12;
+    polygonsStart=pointsEnd+polyDataHeader(3)+polyDataHeader(5); % after vertices and lines
+    polygonsEnd=polygonsStart+numberOfTriangles*16;
+    assert(length(body)>=polygonsEnd, 'POLYDATA message received with incomplete contents');
+    points=convertFromBigEndianUint8Vector(body(polyDataHeaderLength+1:pointsEnd),'single');
+    geometry.vertices=double(reshape(points,3,numberOfPoints)');
+    polygons=reshape(convertFromBigEndianUint8Vector(body(polygonsStart+1:polygonsEnd),'uint32'),4,numberOfTriangles);
+    assert(all(polygons(1,:)==3), 'Only triangle meshes are supported');
+    geometry.faces=double(polygons(2:4,:)')+1;
+end
+
+% Write function parameters (N-by-2 cell array of names and values) in a PARAMS message.
+% Strings are sent as strings, numeric and logical values as arrays of doubles.
+% Cell array values are sent as multiple parameters with the same name.
+% Returns 1 if successful, 0 if failed
+function result=WriteOpenIGTLinkParamsMessage(clientSocket, parameters, deviceName)
+    msg.dataTypeName='PARAMS';
+    msg.deviceName=deviceName;
+    msg.timestamp=0;
+    bodyParts={};
+    numberOfParameters=0;
+    for parameterIndex=1:size(parameters,1)
+        name=uint8(parameters{parameterIndex,1});
+        values=parameters{parameterIndex,2};
+        if ~iscell(values)
+            values={values};
+        end
+        for valueIndex=1:numel(values)
+            value=values{valueIndex};
+            if ischar(value)
+                valueType=uint8(0);
+                valueBytes=uint8(value(:)');
+            else
+                valueType=uint8(1);
+                valueBytes=convertToBigEndianUint8Vector(double(value(:)'));
+            end
+            bodyParts(end+1:end+5)={convertFromUint16ToUint8Vector(length(name)), name, valueType, ...
+                convertFromInt64ToUint8Vector(numel(value)), valueBytes};
+            numberOfParameters=numberOfParameters+1;
+        end
+    end
+    msg.body=[convertToBigEndianUint8Vector(uint32(numberOfParameters)), bodyParts{:}];
+    result=WriteOpenIGTLinkMessage(clientSocket, msg);
+end
+
+% Get function parameters from a PARAMS message as an N-by-2 cell array of names and values.
+% Numbers are stored in column vectors (same as cli_argsread stores numbers that it parses from strings).
+function parameters=ParseOpenIGTLinkParamsMessage(msg)
+    body=msg.body;
+    bodyLength=length(body);
+    assert(bodyLength>=4, 'PARAMS message received with incomplete contents');
+    numberOfParameters=double(convertFromBigEndianUint8Vector(body(1:4),'uint32'));
+    parameters=cell(numberOfParameters,2);
+    pos=5;
+    for parameterIndex=1:numberOfParameters
+        assert(bodyLength>=pos+1, 'PARAMS message received with incomplete contents');
+        nameLength=double(convertFromBigEndianUint8Vector(body(pos:pos+1),'uint16'));
+        pos=pos+2;
+        % name, value type (1 byte), number of elements (8 bytes)
+        assert(bodyLength>=pos+nameLength+8, 'PARAMS message received with incomplete contents');
+        parameters{parameterIndex,1}=char(body(pos:pos+nameLength-1));
+        pos=pos+nameLength;
+        valueType=body(pos);
+        numberOfElements=double(convertFromBigEndianUint8Vector(body(pos+1:pos+8),'uint64'));
+        pos=pos+9;
+        if (valueType==1)
+            valueLength=numberOfElements*8;
+        else
+            valueLength=numberOfElements;
+        end
+        assert(bodyLength>=pos+valueLength-1, 'PARAMS message received with incomplete contents');
+        if (valueType==1)
+            parameters{parameterIndex,2}=reshape(convertFromBigEndianUint8Vector(body(pos:pos+valueLength-1),'double'),[],1);
+        else
+            parameters{parameterIndex,2}=char(body(pos:pos+valueLength-1));
+        end
+        pos=pos+valueLength;
+    end
+end
+
+function scalarType=getImageMessageScalarType(pixelType)
+    scalarTypes={2, 'int8'; 3, 'uint8'; 4, 'int16'; 5, 'uint16'; 6, 'int32'; 7, 'uint32'; 10, 'single'; 11, 'double'};
+    typeIndex=find(strcmp(scalarTypes(:,2),pixelType));
+    assert(~isempty(typeIndex), ['Pixel type cannot be sent in IMAGE message: ',pixelType]);
+    scalarType=scalarTypes{typeIndex,1};
+end
+
+function pixelType=getImageMessagePixelType(scalarType)
+    scalarTypes={2, 'int8'; 3, 'uint8'; 4, 'int16'; 5, 'uint16'; 6, 'int32'; 7, 'uint32'; 10, 'single'; 11, 'double'};
+    typeIndex=find([scalarTypes{:,1}]==scalarType);
+    assert(~isempty(typeIndex), ['Unsupported IMAGE message scalar type: ',num2str(scalarType)]);
+    pixelType=scalarTypes{typeIndex,2};
+end
+
+function nrrdType=getNrrdType(pixelType)
+    switch (pixelType)
+        case 'single'
+            nrrdType='float';
+        otherwise
+            nrrdType=pixelType;
+    end
+end
+
 % Returns 1 if successful, 0 if failed
 function result=WriteOpenIGTLinkMessage(clientSocket, msg)
-    import java.net.Socket
-    import java.io.*
-    import java.net.ServerSocket
     % Add constant fields values
     msg.versionNumber=1;
     msg.bodySize=length(msg.body);
-    msg.bodyCrc=0; % TODO: compute this
-    % Pack message
-    data=[];
-    data=[data, convertFromUint16ToUint8Vector(msg.versionNumber)];
-    data=[data, padString(msg.dataTypeName,12)];
-    data=[data, padString(msg.deviceName,20)];
-    data=[data, convertFromInt64ToUint8Vector(msg.timestamp)];
-    data=[data, convertFromInt64ToUint8Vector(msg.bodySize)];
-    data=[data, convertFromInt64ToUint8Vector(msg.bodyCrc)];
-    data=[data, uint8(msg.body)];    
-    result=1;
-    try
-        DataOutputStream(clientSocket.outputStream).write(uint8(data),0,length(data));
-    catch ME
-        disp(ME.message)
-        result=0;
+    msg.body=uint8(msg.body);
+    if (clientSocket.checkCrc)
+        msg.bodyCrc=computeCrc64(msg.body);
+    else
+        msg.bodyCrc=uint64(0);
     end
+    % Pack message header
+    header=[convertFromUint16ToUint8Vector(msg.versionNumber), ...
+        padString(msg.dataTypeName,12), padString(msg.deviceName,20), ...
+        convertFromInt64ToUint8Vector(msg.timestamp), ...
+        convertFromInt64ToUint8Vector(msg.bodySize), ...
+        convertToBigEndianUint8Vector(msg.bodyCrc)];
+    result=1;
     try
-        DataOutputStream(clientSocket.outputStream).flush;
+        WriteWithTimeout(clientSocket, uint8(header), clientSocket.messageSendTimeoutSec);
+        WriteWithTimeout(clientSocket, msg.body, clientSocket.messageSendTimeoutSec);
     catch ME
         disp(ME.message)
         result=0;
@@ -191,49 +919,96 @@ function result=WriteOpenIGTLinkMessage(clientSocket, msg)
     end
 end
 
+% Size of the Java buffer that is used for transferring data between the socket and Matlab arrays.
+% Data is transferred in blocks of this size to keep the Java heap usage bounded for large messages.
+function blockSize=getTransferBlockSize()
+    blockSize=4*1024*1024;
+end
+
+function WriteWithTimeout(clientSocket, data, timeoutSec)
+    import java.nio.ByteBuffer
+    import java.nio.channels.SelectionKey
+
+    clientSocket.selectionKey.interestOps(SelectionKey.OP_WRITE);
+    tstart=tic;
+    dataLength=length(data);
+    blockSize=getTransferBlockSize();
+    for blockStart=1:blockSize:dataLength
+        blockEnd=min(blockStart+blockSize-1, dataLength);
+        buffer=ByteBuffer.wrap(typecast(data(blockStart:blockEnd),'int8'));
+        while (buffer.hasRemaining)
+            if (clientSocket.channel.write(buffer)==0)
+                % output buffer is full, wait until it can accept more data
+                remainingTimeMsec=ceil(timeoutSec*1000-toc(tstart)*1000);
+                if (remainingTimeMsec<=0)
+                    error('ERROR: Timeout while sending data');
+                end
+                clientSocket.selector.select(remainingTimeMsec);
+                clientSocket.selector.selectedKeys.clear;
+            end
+        end
+    end
+end
+
 function data=ReadWithTimeout(clientSocket, requestedDataLength, timeoutSec)
-    import java.net.Socket
-    import java.io.*
-    import java.net.ServerSocket
+    import java.nio.ByteBuffer
+    import java.nio.channels.SelectionKey
 
+    requestedDataLength=double(requestedDataLength);
     % preallocate to improve performance
     data=zeros(1,requestedDataLength,'uint8');
-    signedDataByte=int8(0);
+    if (requestedDataLength==0)
+        return
+    end
+
+    % Data is read into a Java byte array as large blocks as available
+    % and each block is converted to uint8 by a single typecast
+    buffer=ByteBuffer.allocate(min(requestedDataLength, getTransferBlockSize()));
+    clientSocket.selectionKey.interestOps(SelectionKey.OP_READ);
+    tstart=tic;
     bytesRead=0;
-    while(bytesRead<requestedDataLength)    
-        % Computing (requestedDataLength-bytesRead) is an int64 operation, which may not be available on Matlab R2009 and before
-        int64arithmeticsSupported=~isempty(find(strcmp(methods('int64'),'minus')));
-        if int64arithmeticsSupported
-            % Full 64-bit arithmetics
-            bytesToRead=min(clientSocket.inputStream.available, requestedDataLength-bytesRead);
-        else
-            % Fall back to floating point arithmetics
-            bytesToRead=min(clientSocket.inputStream.available, double(requestedDataLength)-double(bytesRead));
-        end  
-        if (bytesRead==0 && bytesToRead>0)
-            % starting to read message header
-            tstart=tic;
-        end
-        for i = bytesRead+1:bytesRead+bytesToRead
-            signedDataByte = DataInputStream(clientSocket.inputStream).readByte;
-            if signedDataByte>=0
-                data(i) = signedDataByte;
-            else
-                data(i) = typecast(int8(signedDataByte),'uint8');
+    while(bytesRead+buffer.position<requestedDataLength)
+        numberOfReceivedBytes=clientSocket.channel.read(buffer);
+        if (numberOfReceivedBytes<0)
+            % connection closed by the client
+            if (bytesRead+buffer.position==0)
+                error('cli_commandserver:connectionClosed', 'Client connection closed');
             end
-        end            
-        bytesRead=bytesRead+bytesToRead;
-        if (bytesRead>0 && bytesRead<requestedDataLength)
-            % check if the reading of the header has timed out yet
-            timeElapsedSec=toc(tstart);
-            if(timeElapsedSec>timeoutSec)
+            break
+        end
+        if (numberOfReceivedBytes==0)
+            % no data is available yet, wait for more
+            remainingTimeMsec=ceil(timeoutSec*1000-toc(tstart)*1000);
+            if (remainingTimeMsec<=0)
                 % timeout, it should not happen
-                % remove the unnecessary preallocated elements
-                data=data(1:bytesRead);
                 break
             end
+            clientSocket.selector.select(remainingTimeMsec);
+            clientSocket.selector.selectedKeys.clear;
+            continue
+        end
+        if (~buffer.hasRemaining)
+            % block is full, copy it to the output
+            [data, bytesRead]=appendBufferToData(buffer, data, bytesRead);
+            buffer.limit(min(buffer.capacity, requestedDataLength-bytesRead));
         end
     end
+    [data, bytesRead]=appendBufferToData(buffer, data, bytesRead);
+    if (bytesRead<requestedDataLength)
+        % remove the unnecessary preallocated elements
+        data=data(1:bytesRead);
+    end
+end
+
+function [data, bytesRead]=appendBufferToData(buffer, data, bytesRead)
+    blockLength=buffer.position;
+    if (blockLength==0)
+        return
+    end
+    block=typecast(buffer.array,'uint8');
+    data(bytesRead+1:bytesRead+blockLength)=block(1:blockLength);
+    bytesRead=bytesRead+blockLength;
+    buffer.clear;
 end
 
 %%  Parse OpenIGTLink messag header
@@ -244,7 +1019,55 @@ function parsedMsg=ParseOpenIGTLinkMessageHeader(rawMsg)
     parsedMsg.deviceName=char(rawMsg(15:34));
     parsedMsg.timestamp=convertFromUint8VectorToInt64(rawMsg(35:42));
     parsedMsg.bodySize=convertFromUint8VectorToInt64(rawMsg(43:50));
-    parsedMsg.bodyCrc=convertFromUint8VectorToInt64(rawMsg(51:58));
+    % CRC uses all 64 bits, it does not fit into an int64
+    parsedMsg.bodyCrc=convertFromBigEndianUint8Vector(rawMsg(51:58),'uint64');
+end
+
+% Returns true if CRC of messages sent through loopback connections is not computed and not checked.
+% Computing the CRC of large messages takes time, while corruption of local messages is unlikely.
+% It is enabled by setting the SLICER_MATLAB_SKIP_LOOPBACK_CRC environment variable (MatlabCommander
+% must use the same setting).
+function skip=isLoopbackCrcSkipEnabled()
+    skipStr=getenv('SLICER_MATLAB_SKIP_LOOPBACK_CRC');
+    skip=~isempty(skipStr) && ~strcmp(skipStr,'0');
+end
+
+% Returns true if the CRC of messages can be computed (crc64_mex is available).
+% If it is not available then messages are sent with 0 CRC (announced in the readiness check, so the client does not check it)
+% and received messages are not checked.
+function available=isCrc64Available()
+    persistent mexAvailable
+    if isempty(mexAvailable)
+        mexAvailable=(exist('crc64_mex','file')==3);
+        if (~mexAvailable)
+            disp('crc64_mex is not available, message CRC is not computed or checked');
+        end
+    end
+    available=mexAvailable;
+end
+
+% Compute the CRC-64 of an OpenIGTLink message body (ECMA-182 polynomial, same as OpenIGTLink's crc64 function).
+% Must only be called if isCrc64Available() returns true.
+function crc=computeCrc64(data)
+    crc=crc64_mex(data);
+end
+
+% Convert numbers stored in network byte order
+function result=convertFromBigEndianUint8Vector(uint8Vector, type)
+  result=typecast(uint8Vector(:)', type);
+  [dummy1,dummy2,systemEndian]=computer();
+  if isequal(systemEndian,'L')
+    result=swapbytes(result);
+  end
+end
+
+% Convert numbers to network byte order
+function result=convertToBigEndianUint8Vector(values)
+  [dummy1,dummy2,systemEndian]=computer();
+  if isequal(systemEndian,'L')
+    values=swapbytes(values);
+  end
+  result=typecast(values(:)', 'uint8');
 end
 
 function result=convertFromUint8VectorToUint16(uint8Vector)
@@ -254,7 +1077,11 @@ end
 function result=convertFromUint8VectorToInt64(uint8Vector)
   multipliers = [256^7 256^6 256^5 256^4 256^3 256^2 256^1 1];
   % Matlab R2009 and earlier versions don't support int64 arithmetics.
-  int64arithmeticsSupported=~isempty(find(strcmp(methods('int64'),'mtimes')));
+  % Querying the methods is slow, so it is done only once.
+  persistent int64arithmeticsSupported
+  if isempty(int64arithmeticsSupported)
+    int64arithmeticsSupported=~isempty(find(strcmp(methods('int64'),'mtimes')));
+  end
   if int64arithmeticsSupported
     % Full 64-bit arithmetics
     result = sum(int64(uint8Vector).*int64(multipliers));
@@ -0,0 +1,140 @@
+function varargout = cli_datatransfer(action, varargin)
+%cli_datatransfer  Keeps track of data objects (images, meshes, ...) that are transferred through the command server connection instead of files
+%
+%  The command server and MatlabCommander use this function to exchange data objects in OpenIGTLink messages.
+%  The cli_*read and cli_*write functions use it to find out if a data object has to be read/written from/to file.
+%
+%  Command server:
+%   cli_datatransfer('receive', clientId, deviceName, data): store a data object received from a client
+%   cli_datatransfer('bind', clientId, requestId): a command is received from the client, the data objects received
+%     before it are used by this command (the command is queued and the client may send more data objects meanwhile)
+%   cli_datatransfer('begin', requestId): start executing a command
+%   [option, found] = cli_datatransfer('option', deviceName): get (and remove) an execution option of the current command
+%     (e.g., reply policy) that was received from deviceName. found is false if the option was not received.
+%   outputs = cli_datatransfer('end'): command execution completed, returns the data objects that have to be sent
+%     to the client (struct array with deviceName, data, and mappedFilename fields) and removes all stored data objects of the command
+%
+%  Data objects are images (struct with the same fields as returned by cli_imageread), meshes (struct with
+%  the same fields as returned by cli_geometryread) or parameter lists (N-by-2 cell array of parameter names
+%  and values, used by cli_argsread and cli_argswrite).
+%
+%  MatlabCommander (called in the beginning of the command):
+%   cli_datatransfer('input', deviceName, filename): data object received from deviceName is used instead of reading filename
+%   cli_datatransfer('output', deviceName, filename): data object written to filename is sent to the client by deviceName
+%   Optionally, a memory-mapped file name can be specified as last argument. Then the bulk data (image voxels)
+%   is exchanged through that file and only the data object description is sent in the message.
+%
+%  cli_*read and cli_*write functions:
+%   [data, found] = cli_datatransfer('read', filename): get the data object that is used instead of reading the file.
+%     found is false if the data object has to be read from file.
+%   stored = cli_datatransfer('write', filename, data): store a data object that is sent instead of writing the file.
+%     stored is false if the data object has to be written to file.
+%   mappedFilename = cli_datatransfer('mappedfile', filename): get the memory-mapped file that contains the bulk data
+%     of an input or output data object. Empty if the data is transferred in the message.
+%
+
+persistent requestId received inputs outputs mappedFiles
+if ~isa(received, 'containers.Map')
+  requestId = 0;
+  % Data objects received from clients, key is clientId:deviceName (requestId:deviceName when bound to a command)
+  received = containers.Map();
+  % Data objects used by the current command, key is the filename
+  inputs = containers.Map();
+  % Data objects created by the current command, key is the filename
+  outputs = containers.Map();
+  % Memory-mapped files of the inputs and outputs of the current command, key is the filename
+  mappedFiles = containers.Map();
+end
+
+switch (action)
+  case 'receive'
+    received(getReceivedDataKey(varargin{1}, varargin{2})) = varargin{3};
+  case 'bind'
+    clientKeyPrefix = [num2str(varargin{1}) ':'];
+    receivedKeys = received.keys;
+    for keyIndex = 1:length(receivedKeys)
+      if strncmp(receivedKeys{keyIndex}, clientKeyPrefix, length(clientKeyPrefix))
+        deviceName = receivedKeys{keyIndex}(length(clientKeyPrefix)+1:end);
+        received(getReceivedDataKey(varargin{2}, deviceName)) = received(receivedKeys{keyIndex});
+        received.remove(receivedKeys{keyIndex});
+      end
+    end
+  case 'begin'
+    requestId = varargin{1};
+  case 'option'
+    key = getReceivedDataKey(requestId, varargin{1});
+    found = received.isKey(key);
+    if found
+      varargout{1} = received(key);
+      received.remove(key);
+    else
+      varargout{1} = [];
+    end
+    varargout{2} = found;
+  case 'input'
+    key = getReceivedDataKey(requestId, varargin{1});
+    if received.isKey(key)
+      inputs(varargin{2}) = received(key);
+      received.remove(key);
+      if length(varargin) > 2
+        mappedFiles(varargin{2}) = varargin{3};
+      end
+    end
+  case 'output'
+    mappedFilename = '';
+    if length(varargin) > 2
+      mappedFilename = varargin{3};
+      mappedFiles(varargin{2}) = mappedFilename;
+    end
+    outputs(varargin{2}) = struct('deviceName', varargin{1}, 'data', [], 'mappedFilename', mappedFilename);
+  case 'read'
+    found = inputs.isKey(varargin{1});
+    if found
+      varargout{1} = inputs(varargin{1});
+    else
+      varargout{1} = [];
+    end
+    varargout{2} = found;
+  case 'write'
+    stored = outputs.isKey(varargin{1});
+    if stored
+      output = outputs(varargin{1});
+      output.data = varargin{2};
+      outputs(varargin{1}) = output;
+    end
+    varargout{1} = stored;
+  case 'mappedfile'
+    if mappedFiles.isKey(varargin{1})
+      varargout{1} = mappedFiles(varargin{1});
+    else
+      varargout{1} = '';
+    end
+  case 'end'
+    createdOutputs = struct('deviceName', {}, 'data', {}, 'mappedFilename', {});
+    outputValues = outputs.values;
+    for outputIndex = 1:length(outputValues)
+      % Empty parameter list is sent as well, so that the return parameter file is created
+      if ~isempty(outputValues{outputIndex}.data) || iscell(outputValues{outputIndex}.data)
+        createdOutputs(end+1) = outputValues{outputIndex};
+      end
+    end
+    varargout{1} = createdOutputs;
+    % Data objects that were not used by the command are not needed anymore
+    receivedKeys = received.keys;
+    requestKeyPrefix = [num2str(requestId) ':'];
+    for keyIndex = 1:length(receivedKeys)
+      if strncmp(receivedKeys{keyIndex}, requestKeyPrefix, length(requestKeyPrefix))
+        received.remove(receivedKeys{keyIndex});
+      end
+    end
+    inputs = containers.Map();
+    outputs = containers.Map();
+    mappedFiles = containers.Map();
+    requestId = 0;
+  otherwise
+    error(['Unknown data transfer action: ' action]);
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function key = getReceivedDataKey(clientId, deviceName)
+  key = [num2str(clientId) ':' deviceName];
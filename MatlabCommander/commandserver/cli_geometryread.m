@@ -1,22 +1,46 @@
-function geometry = cli_geometryread(filename)
+function geometry = cli_geometryread(filename, mergeDuplicateVertices)
 %cli_geometryread  Read geometry for the command-line interface module from file (in PLY or STL format) into LPS coordinate system
 %
 %   geometry = cli_geometryread(filename) reads the mesh
+%   geometry = cli_geometryread(filename, true) reads the mesh and merges duplicate vertices
 %
-%   geometry.vertices contains the vertices for all triangles in LPS coordinate system [3*n x 3].
+%   geometry.vertices contains the vertices in LPS coordinate system [m x 3].
+%     STL files store the corners of each triangle separately, therefore by default m = 3*n for STL files.
+%     If mergeDuplicateVertices is true then vertices with identical coordinates are stored only once
+%     (for closed surfaces this reduces the number of vertices about 6-fold). PLY files are always read
+%     with shared vertices.
 %   geometry.faces contains the vertex lists defining each triangle face [n x 3].
 % 
+%   If the mesh has been sent to the command server in an OpenIGTLink POLYDATA message then
+%   the received mesh is returned (it is already in LPS coordinate system, with the same vertices
+%   as if it was read from the file) and the file is not read.
+%
 %   Current limitations/caveats:
 %   * Only triangle mesh geometry is supported.
 %
 %   Example:
-%     g=cli_geometryread('SimpleGeom.stl');
+%     g=cli_geometryread('SimpleGeom.stl', true);
 %     patch(g, 'FaceColor', 'red');
 %
 
+if (nargin<2)
+  mergeDuplicateVertices = false;
+end
+
 [pathstr,name,ext] = fileparts(filename);
+
+[geometry, found] = cli_datatransfer('read', filename);
+if found
+  if (strcmpi(ext,'.stl') && mergeDuplicateVertices)
+    [geometry.vertices, geometry.faces] = mergeVertices(geometry.vertices, geometry.faces);
+  end
+  return
+end
 if (strcmpi(ext,'.stl'))
-  [v, f, n, c, stltitle] = stlread(filename);
+  [v, f] = stlread(filename);
+  if (mergeDuplicateVertices)
+    [v, f] = mergeVertices(v, f);
+  end
 else
   [v, f] = read_ply(filename);
 end
@@ -25,4 +49,20 @@ geometry.vertices = v;
 geometry.faces = f;
 
 % Slicer writes mesh points in RAS coordinate system by default, convert to LPS now
-geometry.vertices(:,1:2) = -1*geometry.vertices(:,1:2)
+geometry.vertices(:,1:2) = -1*geometry.vertices(:,1:2);
+
+%--------------------------------------------------------------------------
+% Merge vertices that have identical coordinates and update the faces to refer to the merged vertices.
+% The weldvertices_mex function is used if it is available, otherwise the (several times slower) unique function.
+function [v, f] = mergeVertices(v, f)
+persistent mexAvailable
+if isempty(mexAvailable)
+  mexAvailable = (exist('weldvertices_mex','file')==3);
+end
+if (mexAvailable)
+  [v, indices] = weldvertices_mex(v);
+else
+  % -0 and 0 are considered to be the same by unique, too
+  [v, ~, indices] = unique(v, 'rows', 'stable');
+end
+f = reshape(indices(f), size(f));
@@ -1,18 +1,43 @@
 function cli_geometrywrite(outputFilename, geometry)
 % Function for writing mesh data to PLY or STL file
 %
-%   geometry.vertices contains the vertices for all triangles in LPS coordinate system [3*n x 3].
+%   geometry.vertices contains the vertices in LPS coordinate system [m x 3]. Vertices may be shared
+%     between faces (e.g., as returned by cli_geometryread with merged duplicate vertices) or
+%     stored separately for each triangle corner (m = 3*n).
 %   geometry.faces contains the vertex lists defining each triangle face [n x 3].
 %
 %   Current limitations/caveats:
 %   * Only triangle mesh geometry is supported.
+%
+%   If the mesh is requested through the command server connection then it is sent in an
+%   OpenIGTLink POLYDATA message (in LPS coordinate system) instead of writing it to file.
+%   Meshes that cannot be sent in a message are written to file.
+
+if isPolyDataMessageSupported(geometry) && cli_datatransfer('write', outputFilename, geometry)
+  return
+end
 
 % Slicer expects mesh points in RAS coordinate system by default, convert from LPS now
-geometry.vertices(:,1:2) = -1*geometry.vertices(:,1:2)
+geometry.vertices(:,1:2) = -1*geometry.vertices(:,1:2);
 
 [pathstr,name,ext] = fileparts(outputFilename);
 if (strcmpi(ext,'.stl'))
   stlwrite(outputFilename, geometry);
 else
-  write_ply(geometry.vertices, geometry.faces, outputFilename);
+  % Binary file is much faster to write and read than ASCII
+  write_ply(geometry.vertices, geometry.faces, outputFilename, 'binary_little_endian');
 end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function supported = isPolyDataMessageSupported(geometry)
+% Returns true if the mesh can be sent in an OpenIGTLink POLYDATA message (triangle mesh with valid vertex indices)
+  supported = isstruct(geometry) && isfield(geometry, 'vertices') && isfield(geometry, 'faces');
+  if ~supported
+    return
+  end
+  vertices = geometry.vertices;
+  faces = geometry.faces;
+  supported = isnumeric(vertices) && isreal(vertices) && ismatrix(vertices) && size(vertices, 2) == 3 ...
+    && isnumeric(faces) && isreal(faces) && ismatrix(faces) && size(faces, 2) == 3 ...
+    && size(vertices, 1) < 2^32 && size(faces, 1) < 2^30 ...
+    && all(faces(:) == round(faces(:))) && all(faces(:) >= 1) && all(faces(:) <= size(vertices, 1));
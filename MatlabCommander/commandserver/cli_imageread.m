@@ -1,8 +1,46 @@
-function img = cli_imageread(filename)
+function img = cli_imageread(filename, varargin)
 %cli_imageread  Read images for the command-line interface module from file (in NRRD format, see http://teem.sourceforge.net/nrrd/format.html)
 %  img = cli_imageread(filename) reads the image volume and associated metadata
+%  img = cli_imageread(filename, 'frames', k) reads only the k-th frame of a 4D volume
 %
 %  See detailed description of the img structure in nrrdread.m
+%
+%  If the image has been sent to the command server in an OpenIGTLink IMAGE message
+%  then the received image is returned and the file is not read. If the voxels
+%  are shared through a memory-mapped file then only the geometry is received
+%  in the message and pixelData is read from the mapped file. pixelData is a
+%  regular Matlab array, so the voxels are copied from the mapped file once.
+%
+%  Image files are read by nrrdread, which uses the nrrdread_mex function if it is available.
 % 
 
-img = nrrdread(filename);
+if nargin > 1
+  % Frames are always read from file, 4D volumes are not sent in IMAGE messages
+  img = nrrdread(filename, getOptions(varargin));
+  return
+end
+
+[img, found] = cli_datatransfer('read', filename);
+if ~found
+  img = nrrdread(filename);
+  return
+end
+
+mappedFilename = cli_datatransfer('mappedfile', filename);
+if ~isempty(mappedFilename)
+  dims = sscanf(img.metaData.sizes, '%d')';
+  pixelDataMap = memmapfile(mappedFilename, 'Format', {class(img.pixelData), dims, 'pixelData'}, 'Repeat', 1);
+  img.pixelData = pixelDataMap.Data.pixelData;
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function options = getOptions(args)
+% Get options struct from an options struct or name, value pairs
+  if length(args) == 1 && isstruct(args{1})
+    options = args{1};
+    return
+  end
+  options = struct();
+  for argIndex = 1:2:length(args)-1
+    options.(args{argIndex}) = args{argIndex+1};
+  end
@@ -1,7 +1,57 @@
-function cli_imagewrite(outputFilename, img)
+function cli_imagewrite(outputFilename, img, varargin)
 % Function for writing pixel and meta data struct to a NRRD file
 %
 % See detailed description of the input data format description in nrrdwrite.m
 %
+% If the image is requested through the command server connection then it is sent
+% in an OpenIGTLink IMAGE message instead of writing it to file. Only pixel data and
+% ijkToLpsTransform are sent in the message, custom metadata fields are not preserved.
+% If the voxels are shared through a memory-mapped file then they are written to that
+% file (copied from img.pixelData) and only the geometry is sent in the message.
+%
+% Image files are written by nrrdwrite, which uses the nrrdwrite_mex function if it is available.
+% Options can be specified as a struct or as name, value pairs (see nrrdwrite.m):
+%   cli_imagewrite(outputFilename, img, 'compressionLevel', 1) sets gzip compression level
+%   cli_imagewrite(outputFilename, frame, 'frames', k) appends the k-th frame of a 4D volume to the file
+%
+
+options = getOptions(varargin);
+
+if isImageMessageSupported(img) && ~isfield(options, 'frames')
+  mappedFilename = cli_datatransfer('mappedfile', outputFilename);
+  if ~isempty(mappedFilename)
+    writeMappedPixelData(mappedFilename, img.pixelData);
+  end
+  if cli_datatransfer('write', outputFilename, img)
+    return
+  end
+end
+nrrdwrite(outputFilename, img, options);
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function supported = isImageMessageSupported(img)
+% Returns true if the image can be sent in an OpenIGTLink IMAGE message
+  supportedTypes = {'int8','uint8','int16','uint16','int32','uint32','single','double'};
+  supported = ndims(img.pixelData) <= 3 ...
+    && any(strcmp(class(img.pixelData), supportedTypes)) ...
+    && all(size(img.pixelData) <= 65535);
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function writeMappedPixelData(mappedFilename, pixelData)
+% Write voxels in the byte order of this computer, the file is mapped by MatlabCommander on the same computer
+  fid = fopen(mappedFilename, 'w');
+  assert(fid > 0, ['Could not open memory-mapped file: ' mappedFilename]);
+  cleaner = onCleanup(@() fclose(fid));
+  fwrite(fid, pixelData, class(pixelData));
 
-nrrdwrite(outputFilename, img);
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function options = getOptions(args)
+% Get options struct from an options struct or name, value pairs
+  if length(args) == 1 && isstruct(args{1})
+    options = args{1};
+    return
+  end
+  options = struct();
+  for argIndex = 1:2:length(args)-1
+    options.(args{argIndex}) = args{argIndex+1};
+  end
@@ -0,0 +1,116 @@
+function cli_jobs(action, varargin)
+%cli_jobs  Asynchronous execution of commands received by the command server
+%
+%  MatlabCommander (the functions are called through the command server, results are printed):
+%   cli_jobs('submit', cmd): queue the command for execution and print the job ID
+%   cli_jobs('status', jobId): print the job state (queued, running, completed, failed, cancelled)
+%   cli_jobs('result', jobId): print the output of the completed job and remove it from the job table.
+%     Raises an error if the job is not completed successfully.
+%   cli_jobs('cancel', jobId): cancel a queued or running job (a running job is interrupted)
+%
+%  Jobs are executed in the background by parfeval (requires the Parallel Computing Toolbox), therefore
+%  the command server keeps processing other commands (e.g., job status requests) while jobs are running.
+%  Jobs are not executed by the command server itself, because then it could not respond to any request
+%  and could not interrupt the job until the job is completed, so submitting a job fails if parfeval
+%  is not available.
+%
+
+persistent jobs lastJobId
+if ~isa(jobs, 'containers.Map')
+  % Key is the job ID
+  jobs = containers.Map('KeyType', 'double', 'ValueType', 'any');
+  lastJobId = 0;
+end
+
+switch (action)
+  case 'submit'
+    if ~isParallelExecutionAvailable()
+      error('Asynchronous jobs require the Parallel Computing Toolbox (parfeval is not available)');
+    end
+    lastJobId = lastJobId + 1;
+    job.cmd = varargin{1};
+    job.state = 'queued';
+    job.output = '';
+    % Pool workers have their own path, working directory, and loaded functions,
+    % so the command is executed in the same environment as on the command server
+    job.future = parfeval(@executeJob, 1, job.cmd, path, pwd);
+    jobs(lastJobId) = job;
+    fprintf('%d\n', lastJobId);
+  case 'status'
+    jobId = varargin{1};
+    job = updateJobState(getJob(jobs, jobId));
+    jobs(jobId) = job;
+    fprintf('%s\n', job.state);
+  case 'result'
+    jobId = varargin{1};
+    job = updateJobState(getJob(jobs, jobId));
+    jobs(jobId) = job;
+    switch (job.state)
+      case 'completed'
+        jobs.remove(jobId);
+        fprintf('%s', job.output);
+      case {'failed', 'cancelled'}
+        jobs.remove(jobId);
+        error('Job %d %s: %s', jobId, job.state, job.output);
+      otherwise
+        error('Job %d is not completed yet, its state is %s', jobId, job.state);
+    end
+  case 'cancel'
+    jobId = varargin{1};
+    job = updateJobState(getJob(jobs, jobId));
+    if ~any(strcmp(job.state, {'queued', 'running'}))
+      error('Job %d cannot be cancelled, its state is %s', jobId, job.state);
+    end
+    % Interrupts the execution if the job is running
+    cancel(job.future);
+    job.state = 'cancelled';
+    job.output = 'Job cancelled by request';
+    jobs(jobId) = job;
+    fprintf('%s\n', job.state);
+  otherwise
+    error(['Unknown job action: ' action]);
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function job = getJob(jobs, jobId)
+  if ~jobs.isKey(jobId)
+    error('Job %d is not found', jobId);
+  end
+  job = jobs(jobId);
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function output = executeJob(cmd, serverPath, workingDirectory)
+% Executed by a pool worker. The path (that includes the command server directory) and the working directory
+% of the command server are set and modified functions in the working directory are cleared (cli_reload tracks
+% them separately in each worker), so the worker uses the same functions as the command server would.
+  path(serverPath);
+  cd(workingDirectory);
+  cli_reload('update', workingDirectory);
+  output = evalc(cmd);
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function job = updateJobState(job)
+% Get the state of jobs that are executed in the background
+  if ~any(strcmp(job.state, {'queued', 'running'}))
+    return
+  end
+  switch (job.future.State)
+    case 'running'
+      job.state = 'running';
+    case 'finished'
+      if isempty(job.future.Error)
+        job.output = fetchOutputs(job.future);
+        job.state = 'completed';
+      else
+        job.output = job.future.Error.getReport('extended', 'hyperlinks', 'off');
+        job.state = 'failed';
+      end
+  end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function available = isParallelExecutionAvailable()
+  persistent parallelExecutionAvailable
+  if isempty(parallelExecutionAvailable)
+    parallelExecutionAvailable = (exist('parfeval', 'file') > 0) && license('test', 'Distrib_Computing_Toolbox');
+  end
+  available = parallelExecutionAvailable;
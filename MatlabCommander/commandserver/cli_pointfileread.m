@@ -1,6 +1,9 @@
-function points = cli_pointfileread(filename)
+function points = cli_pointfileread(filename, readTextColumns)
 % Read image markups from a Slicer fcsv file
-%   points = cli_pointfileread(filename) reads the image volume and associated metadata
+%   points = cli_pointfileread(filename) reads the markups and associated metadata
+%   points = cli_pointfileread(filename, false) reads only the numeric columns (position, orientation,
+%     visibility, selected, locked), which is much faster for large files. id, label, description,
+%     and associatedNodeID are then empty.
 %
 %   points.position: point positions (Nx3)
 %   points.orientation: point orientations as quaternion (Nx4)
@@ -27,7 +30,11 @@ function points = cli_pointfileread(filename)
 % vtkMRMLMarkupsFiducialNode_125,-29.6359,-30.022,41.9246,0,0,0,1,1,0,0,,,
 %
 
-points = {}
+if (nargin<2)
+  readTextColumns = true;
+end
+
+points = struct();
 
 fid = fopen(filename, 'r');
 assert(fid > 0, 'Could not open file.');
@@ -40,14 +47,47 @@ points.headerVersion = fgetl(fid);
 points.headerCoordinateSystem = fgetl(fid);
 points.headerColumns = fgetl(fid);
 
-columns = textscan(fid, '%s %f%f%f %f%f%f%f %d%d%d %s %s %s','delimiter',',')
-
-points.id = columns{1}
-points.position = [columns{2}, columns{3}, columns{4}]
-points.orientation = [columns{5}, columns{6}, columns{7}, columns{8}]
-points.visibility = columns{9}
-points.selected = columns{10}
-points.locked = columns{11}
-points.label = columns{12}
-points.description = columns{13}
-points.associatedNodeID = columns{14}
+% The fcsvread_mex function parses the numbers directly into the output arrays,
+% it is used if it is available, otherwise the (several times slower) textscan function
+persistent mexAvailable
+if isempty(mexAvailable)
+  mexAvailable = (exist('fcsvread_mex','file')==3);
+end
+
+if (mexAvailable)
+  % Strings are only extracted if they are requested
+  if (readTextColumns)
+    [position, orientation, visibility, selected, locked, id, label, description, associatedNodeID] = fcsvread_mex(filename);
+  else
+    [position, orientation, visibility, selected, locked] = fcsvread_mex(filename);
+  end
+else
+  numericFormat = '%f%f%f %f%f%f%f %d%d%d';
+  if (readTextColumns)
+    columns = textscan(fid, ['%s ' numericFormat ' %s %s %s'], 'delimiter', ',');
+    [id, label, description, associatedNodeID] = columns{[1 12 13 14]};
+    columns = columns(2:11);
+  else
+    columns = textscan(fid, ['%*s ' numericFormat ' %*[^\n]'], 'delimiter', ',');
+  end
+  position = [columns{1:3}];
+  orientation = [columns{4:7}];
+  [visibility, selected, locked] = columns{8:10};
+end
+
+if (~readTextColumns)
+  id = {};
+  label = {};
+  description = {};
+  associatedNodeID = {};
+end
+
+points.id = id;
+points.position = position;
+points.orientation = orientation;
+points.visibility = visibility;
+points.selected = selected;
+points.locked = locked;
+points.label = label;
+points.description = description;
+points.associatedNodeID = associatedNodeID;
@@ -1,5 +1,5 @@
 function cli_pointfilewrite(outputfilename, points)
-%cli_measurementwrite  Write a list of measurements to a Slicer fcsv text file
+%cli_pointfilewrite  Write a list of markups to a Slicer fcsv text file
 %
 % See more details at cli_pointfileread
 %
@@ -17,30 +17,42 @@ function cli_pointfilewrite(outputfilename, points)
 % Write header
 fid=fopen(outputfilename, 'w');
 assert(fid > 0, 'Could not open file %s', outputfilename);
+cleaner = onCleanup(@() fclose(fid));
 fprintf(fid,'%s\n', points.headerVersion);
 fprintf(fid,'%s\n', points.headerCoordinateSystem);
 fprintf(fid,'%s\n', points.headerColumns);
+
+% Retrieve optional properties
 numOfPoints = size(points.position,1);
-for k = 1:numOfPoints
-  % Retrieve optional properties
-  label = '';
-  if k <= size(points.label,1)
-    label = points.label(k);
-  end
-  description = '';
-  if k <= size(points.description,1)
-    description = points.description(k);
+id = getTextColumn(points, 'id', numOfPoints);
+label = getTextColumn(points, 'label', numOfPoints);
+description = getTextColumn(points, 'description', numOfPoints);
+associatedNodeID = getTextColumn(points, 'associatedNodeID', numOfPoints);
+numericValues = [points.position, points.orientation, ...
+  double(points.visibility(:)), double(points.selected(:)), double(points.locked(:))];
+
+% Points are written in blocks: numeric columns of all the points of a block are formatted by one
+% sprintf call and joined with the text columns (fprintf would skip empty strings)
+blockSize = 100000;
+for blockStart = 1:blockSize:numOfPoints
+  rows = blockStart:min(blockStart+blockSize-1, numOfPoints);
+  numericLines = regexp(sprintf('%g,%g,%g,%g,%g,%g,%g,%d,%d,%d\n', numericValues(rows,:)'), '\n', 'split');
+  lines = strcat(id(rows), ',', numericLines(1:end-1)', ',', label(rows), ',', description(rows), ',', associatedNodeID(rows));
+  fprintf(fid, '%s\n', lines{:});
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function column = getTextColumn(points, fieldName, numOfPoints)
+% Get a text column as a cell array of strings (Nx1), missing values are empty strings
+  column = repmat({''}, numOfPoints, 1);
+  if ~isfield(points, fieldName)
+    return
   end
-  associatedNodeID = '';
-  if k <= size(points.associatedNodeID,1)
-    associatedNodeID = points.associatedNodeID(k);
+  values = points.(fieldName);
+  if ischar(values)
+    values = cellstr(values);
   end
-  % Write to file
-  fprintf(fid,'%s,%g,%g,%g,%g,%g,%g,%g,%d,%d,%d,%s,%s,%s\n',...
-    points.id(k,:),...
-    points.position(k,1), points.position(k,2), points.position(k,3),...
-    points.orientation(k,1), points.orientation(k,2), points.orientation(k,3), points.orientation(k,4),...
-    points.visibility(k), points.selected(k), points.locked(k),...
-    label, description, associatedNodeID);
-end
-fclose(fid);
+  count = min(numel(values), numOfPoints);
+  column(1:count) = values(1:count);
+  % Unset values (e.g., created by cell(n,1)) are written as empty strings
+  column(~cellfun(@ischar, column)) = {''};
@@ -0,0 +1,27 @@
+function cli_progress(fraction, message)
+%cli_progress  Report progress of the running command-line interface module
+%  cli_progress(fraction) reports the completed fraction (value between 0 and 1) of the processing
+%  cli_progress(fraction, message) reports the completed fraction and a status message
+%  cli_progress([], message) reports only a status message
+%
+%  When the module is executed from Slicer then the progress is shown on the module's progress bar
+%  while the module is running. If the function is not called by the command server (e.g., the
+%  module function is called directly from the Matlab console) then the progress is displayed.
+%
+
+global CLI_PROGRESS_REPORTER
+
+if (nargin<2)
+  message='';
+end
+
+if isempty(CLI_PROGRESS_REPORTER)
+  if isempty(fraction)
+    disp(message);
+  else
+    disp(['Progress: ' num2str(round(fraction*100)) '% ' message]);
+  end
+  return
+end
+
+CLI_PROGRESS_REPORTER(fraction, message);
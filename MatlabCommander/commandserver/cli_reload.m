@@ -0,0 +1,52 @@
+function cli_reload(action, varargin)
+%cli_reload  Reload Matlab functions that have been modified since they were last used
+%
+%  Re-reading all the functions on the Matlab path (rehash) takes a long time if there are many toolboxes
+%  on the path. Instead, modification time of the .m files in the module directory is tracked and only
+%  the functions that have been changed are cleared (so that they are re-read when they are called next time).
+%
+%  MatlabCommander (the functions are called through the command server):
+%   cli_reload('update', directory): clear functions of .m files in the directory that have been modified
+%     or created since the last update. Newly created files are added to the path by rehash.
+%   cli_reload('force'): clear all tracked functions and re-read the path. Use it if a function changed
+%     that is not in a module directory (e.g., a function that the module function calls).
+%
+
+persistent modifiedTimes
+if ~isa(modifiedTimes, 'containers.Map')
+  % Key is the full path of the .m file, value is its modification time (datenum)
+  modifiedTimes = containers.Map();
+end
+
+switch (action)
+  case 'update'
+    directory = varargin{1};
+    files = dir(fullfile(directory, '*.m'));
+    newFunctionFound = false;
+    for fileIndex = 1:length(files)
+      filePath = fullfile(directory, files(fileIndex).name);
+      if modifiedTimes.isKey(filePath) && modifiedTimes(filePath) == files(fileIndex).datenum
+        % not changed
+        continue;
+      end
+      if ~modifiedTimes.isKey(filePath)
+        newFunctionFound = true;
+      end
+      [~, functionName] = fileparts(files(fileIndex).name);
+      clear(functionName);
+      modifiedTimes(filePath) = files(fileIndex).datenum;
+    end
+    if newFunctionFound
+      rehash
+    end
+  case 'force'
+    filePaths = modifiedTimes.keys;
+    for fileIndex = 1:length(filePaths)
+      [~, functionName] = fileparts(filePaths{fileIndex});
+      clear(functionName);
+    end
+    modifiedTimes = containers.Map();
+    rehash
+  otherwise
+    error(['Unknown reload action: ' action]);
+end
@@ -1,4 +1,4 @@
-function fcsvwrite(outputfilename, position, id, visibile, selected, locked, label, description, orientation)
+function fcsvwrite(outputfilename, position, id, visible, selected, locked, label, description, orientation)
 %fcsvwrite  Write a list of fiducial markups to Slicer fcsv file
 %
 
@@ -38,24 +38,40 @@ end
 if nargin < 9
   orientation = [zeros(rows,3) ones(rows,1)];
 else
-  [orientationRows orientationColumns] = size(orientation)
+  [orientationRows orientationColumns] = size(orientation);
   assert(orientationRows==rows, 'Orientation matrix must the same number of rows as the position matrix');
   assert(orientationColumns==4, 'Orientation matrix must have 4 columns');
 end
 
-associatedNodeID = ''; % use just a constant empty associated node ID for all points
-
 % Write header
 fid=fopen(outputfilename, 'w');
 assert(fid > 0, 'Could not open file %s', outputfilename);
+cleaner = onCleanup(@() fclose(fid));
 fprintf(fid,'# Markups fiducial file version = 4.5\n');
 fprintf(fid,'# CoordinateSystem = 0\n');
 fprintf(fid,'# columns = id,x,y,z,ow,ox,oy,oz,vis,sel,lock,label,desc,associatedNodeID\n');
-for rowIndex=1:rows
-  fprintf(fid,'%s,%f,%f,%f,%f,%f,%f,%f,%d,%d,%d,%s,%s,%s\n',char(id(rowIndex)),
-    position(rowIndex,1),position(rowIndex,2),position(rowIndex,3),
-    orientation(rowIndex,1),orientation(rowIndex,2),orientation(rowIndex,3),orientation(rowIndex,4),
-    visible(rowIndex),selected(rowIndex),locked(rowIndex),
-    char(label(rowIndex)),char(description(rowIndex)),associatedNodeID);
-end
-fclose(fid);
+
+id = toTextColumn(id, rows);
+label = toTextColumn(label, rows);
+description = toTextColumn(description, rows);
+numericValues = [position, orientation, double(visible(:)), double(selected(:)), double(locked(:))];
+
+% Points are written in blocks: numeric columns of all the points of a block are formatted by one
+% sprintf call and joined with the text columns (fprintf would skip empty strings).
+% A constant empty associated node ID is used for all points.
+blockSize = 100000;
+for blockStart = 1:blockSize:rows
+  blockRows = blockStart:min(blockStart+blockSize-1, rows);
+  numericLines = regexp(sprintf('%f,%f,%f,%f,%f,%f,%f,%d,%d,%d\n', numericValues(blockRows,:)'), '\n', 'split');
+  lines = strcat(id(blockRows), ',', numericLines(1:end-1)', ',', label(blockRows), ',', description(blockRows), ',');
+  fprintf(fid, '%s\n', lines{:});
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function column = toTextColumn(values, rows)
+% Get a text column as a cell array of strings (Nx1), unset values are empty strings
+  if ischar(values)
+    values = cellstr(values);
+  end
+  column = reshape(values(1:rows), rows, 1);
+  column(~cellfun(@ischar, column)) = {''};
@@ -1,6 +1,8 @@
-function img = nrrdread(filename)
+function img = nrrdread(filename, options)
 % Read image and metadata from a NRRD file (see http://teem.sourceforge.net/nrrd/format.html)
 %   img = cli_imageread(filename) reads the image volume and associated metadata
+%   img = nrrdread(filename, options) reads a single frame of a 4D volume if options.frames is set to the frame
+%     index (one-based). The frame is returned as a 3D volume, the other frames are not loaded into memory.
 %
 %   img.pixelData: pixel data array
 %   img.ijkToLpsTransform: pixel (IJK) to physical (LPS, assuming 'space' is 'left-posterior-superior')
@@ -10,12 +12,19 @@ function img = nrrdread(filename)
 %     special characters (space, dot, etc). Special characters in field names are replaced by underscore by default when the NRRD
 %     file is read. Full field names are used when writing the image to NRRD file.
 %
-%  Supports reading of 3D and 4D volumes.
+%  Supports reading of 3D and 4D volumes, with attached or detached header ("data file" field).
+%  In 4D volumes the frame axis may be the first (kinds: list domain domain domain) or the last axis
+%  (kinds: domain domain domain list, as written frame by frame by nrrdwrite).
+%  Frames of "raw" encoded data are read by seeking in the file. Reading a frame of "gzip" encoded data
+%  requires the nrrdread_mex function, otherwise the whole volume is loaded.
 %
 %   Current limitations/caveats:
 %   * Block datatype is not supported.
 %   * Only tested with "gzip" and "raw" file encodings.
 %
+%  If the nrrdread_mex function is available (built from the MatlabNrrdCodec library) then "raw" and "gzip"
+%  encoded pixel data is read and decompressed by that, which is faster and does not use the Java heap.
+%
 % Partly based on the nrrdread.m function with copyright 2012 The MathWorks, Inc.
 
 fid = fopen(filename, 'rb');
@@ -91,22 +100,47 @@ dims = sscanf(img.metaData.sizes, '%d');
 ndims = sscanf(img.metaData.dimension, '%d');
 assert(numel(dims) == ndims);
 
-data = readData(fid, img.metaData, datatype);
-if isfield(img.metaData, 'endian')
-    data = adjustEndian(data, img.metaData);
+if isfield(img.metaData, 'data_file')
+  % Detached header, pixel data is stored in a separate file
+  [headerDir, dummy1, dummy2] = fileparts(filename);
+  dataFilename = img.metaData.data_file;
+  if ~isAbsolutePath(dataFilename)
+    dataFilename = fullfile(headerDir, dataFilename);
+  end
+  dataOffset = 0;
+  if isfield(img.metaData, 'byte_skip')
+    dataOffset = sscanf(img.metaData.byte_skip, '%d');
+  end
+  dataFid = fopen(dataFilename, 'rb');
+  assert(dataFid > 0, ['Could not open data file: ' dataFilename]);
+  dataCleaner = onCleanup(@() fclose(dataFid));
+  fseek(dataFid, dataOffset, 'bof');
+else
+  % Pixel data starts right after the header
+  dataFilename = filename;
+  dataOffset = ftell(fid);
+  dataFid = fid;
 end
 
-img.pixelData = reshape(data, dims');
+if (nargin > 1) && isfield(options, 'frames')
+  img = readFrame(img, dataFid, dataFilename, dataOffset, datatype, dims, options.frames);
+  ndims = 3;
+else
+  if isMexReaderAvailable(img.metaData.encoding)
+    data = nrrdread_mex(dataFilename, dataOffset, img.metaData.encoding, datatype, prod(dims), needToSwapBytes(img.metaData));
+  else
+    data = readData(dataFid, img.metaData, datatype);
+    if needToSwapBytes(img.metaData)
+      data = swapbytes(data);
+    end
+  end
+  img.pixelData = reshape(data, dims');
+end
 
 % For convenience, compute the transformation matrix between physical and pixel coordinates
-switch (ndims)
- case {3}
-  axes_directions=reshape(sscanf(img.metaData.space_directions,'(%f,%f,%f) (%f,%f,%f) (%f,%f,%f)'),3,3);
- case {4}
-  axes_directions=reshape(sscanf(img.metaData.space_directions,'none (%f,%f,%f) (%f,%f,%f) (%f,%f,%f)'),3,3);
- otherwise
-  assert(false, 'Unsupported pixel data dimension')
-end
+% (direction of the non-spatial axis of 4D volumes is 'none')
+assert(ndims == 3 || ndims == 4, 'Unsupported pixel data dimension')
+axes_directions=reshape(sscanf(strrep(img.metaData.space_directions,'none',''),' (%f,%f,%f) (%f,%f,%f) (%f,%f,%f)'),3,3);
 axes_origin=sscanf(img.metaData.space_origin,'(%f,%f,%f)');
 ijkZeroBasedToLpsTransform=[[axes_directions, axes_origin]; [0 0 0 1]];
 ijkOneBasedToIjkZeroBasedTransform=[[eye(3), [-1;-1;-1] ]; [0 0 0 1]];
@@ -168,15 +202,86 @@ switch (meta.encoding)
 end
 
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-function data = adjustEndian(data, meta)
+function img = readFrame(img, dataFid, dataFilename, dataOffset, datatype, dims, frameIndex)
+% Read a single frame of a 4D volume and update the metadata to describe a 3D volume
+assert(numel(dims) == 4, 'Frames can only be read from 4D volumes')
+kinds = regexp(strtrim(img.metaData.kinds), '\s+', 'split');
+% Frame axis is the non-spatial axis
+framesInterleaved = ~any(strcmp(kinds{1}, {'domain', 'space'}));
+if framesInterleaved
+  frameAxis = 1;
+else
+  frameAxis = 4;
+end
+numberOfFrames = dims(frameAxis);
+frameDims = dims([1:frameAxis-1, frameAxis+1:4]);
+assert(frameIndex >= 1 && frameIndex <= numberOfFrames, 'Frame index is out of range')
+numberOfFrameVoxels = prod(frameDims);
+bytesPerVoxel = numel(typecast(zeros(1,1,datatype), 'uint8'));
+
+if isMexReaderAvailable(img.metaData.encoding)
+  data = nrrdread_mex(dataFilename, dataOffset, img.metaData.encoding, datatype, numberOfFrameVoxels, ...
+    needToSwapBytes(img.metaData), numberOfFrames, frameIndex, framesInterleaved);
+elseif strcmp(img.metaData.encoding, 'raw')
+  if framesInterleaved
+    % Read one voxel and skip the voxels of the other frames
+    fseek(dataFid, dataOffset+(frameIndex-1)*bytesPerVoxel, 'bof');
+    data = fread(dataFid, numberOfFrameVoxels, [datatype '=>' datatype], (numberOfFrames-1)*bytesPerVoxel);
+  else
+    fseek(dataFid, dataOffset+(frameIndex-1)*numberOfFrameVoxels*bytesPerVoxel, 'bof');
+    data = fread(dataFid, numberOfFrameVoxels, [datatype '=>' datatype]);
+  end
+  if needToSwapBytes(img.metaData)
+    data = swapbytes(data);
+  end
+else
+  % Compressed data cannot be accessed randomly, read the whole volume
+  data = readData(dataFid, img.metaData, datatype);
+  if needToSwapBytes(img.metaData)
+    data = swapbytes(data);
+  end
+  data = reshape(data, dims');
+  if framesInterleaved
+    data = data(frameIndex,:,:,:);
+  else
+    data = data(:,:,:,frameIndex);
+  end
+end
+assert(numel(data) == numberOfFrameVoxels, 'Unexpected end of file while reading pixel data')
+img.pixelData = reshape(data, frameDims');
+
+img.metaData.dimension = '3';
+img.metaData.sizes = num2str(frameDims');
+img.metaData.kinds = 'domain domain domain';
+img.metaData.space_directions = strtrim(strrep(img.metaData.space_directions, 'none', ''));
+% Pixel data of the frame is not stored in the data file anymore
+for fieldName = {'data_file', 'byte_skip'}
+  if isfield(img.metaData, fieldName{1})
+    img.metaData = rmfield(img.metaData, fieldName{1});
+  end
+end
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function absolute = isAbsolutePath(filename)
+absolute = ~isempty(regexp(filename, '^([a-zA-Z]:)?[\\/]', 'once'));
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function available = isMexReaderAvailable(encoding)
+% Returns true if pixel data with the specified encoding can be read by nrrdread_mex
+available = any(strcmp(encoding, {'raw', 'gzip', 'gz'})) && exist('nrrdread_mex', 'file') == 3;
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function needToSwap = needToSwapBytes(meta)
+% Returns true if the byte order of the pixel data is different from the byte order of this computer
+if ~isfield(meta, 'endian')
+  needToSwap = false;
+  return;
+end
 % For ignoring unused parameters dummy variables (dummy1 and dummy2) are
 % used instead of ~ to maintain compatibility with Matlab R2009b version
 [dummy1,dummy2,endian] = computer();
 needToSwap = (isequal(endian, 'B') && isequal(lower(meta.endian), 'little')) || ...
          (isequal(endian, 'L') && isequal(lower(meta.endian), 'big'));
-if (needToSwap)
-data = swapbytes(data);
-end
 
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 function M = zlib_decompress(Z,DataType)
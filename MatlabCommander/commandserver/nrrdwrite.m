@@ -1,4 +1,4 @@
-function nrrdwrite(outputFilename, img)
+function nrrdwrite(outputFilename, img, options)
 % Write image and metadata to a NRRD file (see http://teem.sourceforge.net/nrrd/format.html)
 %   img.pixelData: pixel data array
 %   img.ijkToLpsTransform: pixel (IJK) to physical (LPS, assuming 'space' is 'left-posterior-superior')
@@ -20,6 +20,17 @@ function nrrdwrite(outputFilename, img)
 % Supports writing of 3D and 4D volumes.
 % 2D pixelData is written as single-slice 3D volume.
 %
+% If the nrrdwrite_mex function is available (built from the MatlabNrrdCodec library) then "raw" and "gzip"
+% encoded pixel data is written and compressed by that, which is faster and does not use the Java heap.
+% Gzip compression then runs on all processor cores and can be tuned by the optional options struct:
+%   options.compressionLevel: 1 (fastest) to 9 (best compression), -1 (default)
+%   options.numberOfThreads: number of compression threads, 0 (default) uses all processor cores
+%
+% A 4D volume can be written frame by frame, without holding all the frames in memory, by setting
+% options.frames to the frame index (one-based). img.pixelData is then a single 3D frame. Frames must be
+% written in order, starting with frame 1. Each call appends the frame to the raw data file (same name as
+% outputFilename, with .raw extension) and updates the detached header in outputFilename.
+%
 % Examples:
 %
 % 1. Using output from nrrdread: 
@@ -49,13 +60,26 @@ function nrrdwrite(outputFilename, img)
 %   nrrdwrite('testOutput.nrrd', img);
 %
 
+% Write a frame of a 4D volume
+frameIndex = [];
+if (nargin > 2) && isfield(options, 'frames')
+  frameIndex = options.frames;
+  img.metaData.data_file = appendFramePixelData(outputFilename, img.pixelData, frameIndex);
+  % Frames are appended to the data file in little endian byte order, without compression
+  img.metaData.endian = 'little';
+  img.metaData.encoding = 'raw';
+elseif isfield(img, 'metaData') && isfield(img.metaData, 'data_file')
+  % Pixel data is written into the same file as the header
+  img.metaData = rmfield(img.metaData, 'data_file');
+end
+
 % Open file for writing
 fid=fopen(outputFilename, 'w');
 if(fid<=0) 
   fprintf('Could not open file: %s\n', outputFilename);
 end
 
-standardFieldNames = { 'type', 'dimension', 'space', 'sizes', 'space directions', 'kinds', 'endian', 'encoding', 'space origin', 'measurement frame' };
+standardFieldNames = { 'type', 'dimension', 'space', 'sizes', 'space directions', 'kinds', 'endian', 'encoding', 'space origin', 'measurement frame', 'data file' };
 
 fprintf(fid,'NRRD0005\n');
 fprintf(fid,'# Complete NRRD file format specification at:\n');
@@ -69,15 +93,19 @@ if ~isfield(img.metaData,'space')
   img.metaData.space = 'left-posterior-superior';
 end
 
-img.metaData.dimension = length(size(img.pixelData)); % ndim is not defined for int16 arrays
-
+dims = size(img.pixelData);
 % 2D image is be written as single-slice 3D volume
-if img.metaData.dimension == 2
-    img.metaData.dimension = 3;
-    img.metaData.sizes=num2str([size(img.pixelData), 1]);
-else
-  img.metaData.sizes=num2str(size(img.pixelData));
+if length(dims) == 2
+  dims(3) = 1;
+end
+% Frames are stored along the last axis
+framesLast = ~isempty(frameIndex);
+if framesLast
+  assert(length(dims) == 3, 'Only 3D frames can be written')
+  dims(4) = frameIndex;
 end
+img.metaData.dimension = length(dims); % ndim is not defined for int16 arrays
+img.metaData.sizes=num2str(dims);
 
 if isfield(img,'ijkToLpsTransform')
   % Write zero-based IJK transform (origin is at [0,0,0]) to the image header
@@ -91,7 +119,11 @@ if isfield(img,'ijkToLpsTransform')
    case {3}
     img.metaData.space_directions=sprintf('(%f,%f,%f) (%f,%f,%f) (%f,%f,%f)',reshape(axes_directions,1,9));
    case {4}
-    img.metaData.space_directions=sprintf('none (%f,%f,%f) (%f,%f,%f) (%f,%f,%f)',reshape(axes_directions,1,9));
+    if framesLast
+      img.metaData.space_directions=sprintf('(%f,%f,%f) (%f,%f,%f) (%f,%f,%f) none',reshape(axes_directions,1,9));
+    else
+      img.metaData.space_directions=sprintf('none (%f,%f,%f) (%f,%f,%f) (%f,%f,%f)',reshape(axes_directions,1,9));
+    end
    otherwise
     assert(false, 'Unsupported pixel data dimension')
   end
@@ -102,7 +134,11 @@ if ~isfield(img.metaData,'space_directions')
    case {3}
     img.metaData.space_directions = '(1,0,0) (0,1,0) (0,0,1)';
    case {4}
-    img.metaData.space_directions = 'none (1,0,0) (0,1,0) (0,0,1)';
+    if framesLast
+      img.metaData.space_directions = '(1,0,0) (0,1,0) (0,0,1) none';
+    else
+      img.metaData.space_directions = 'none (1,0,0) (0,1,0) (0,0,1)';
+    end
    otherwise
     assert(false, 'Unsupported pixel data dimension')
   end  
@@ -112,9 +148,17 @@ switch (img.metaData.dimension)
  case {3}
   img.metaData.kinds='domain domain domain';
  case {4}
-  img.metaData.kinds='list domain domain domain';
+  if framesLast
+    img.metaData.kinds='domain domain domain list';
+    % Space directions of the frame are used
+    if isempty(strfind(img.metaData.space_directions,'none'))
+      img.metaData.space_directions=[img.metaData.space_directions ' none'];
+    end
+  else
+    img.metaData.kinds='list domain domain domain';
+  end
   % Add a custom field to make the volume load into 3D Slicer as a MultiVolume
-  img = nrrdaddmetafield(img,'MultiVolume.NumberOfFrames',size(img.pixelData,4));
+  img = nrrdaddmetafield(img,'MultiVolume.NumberOfFrames',dims(4));
  otherwise
   assert(false, 'Unsupported pixel data dimension')
 end
@@ -147,7 +191,29 @@ end
 
 fprintf(fid,'\n');
 
+if framesLast
+  % Pixel data has been already written to the data file
+  fclose(fid);
+  return;
+end
+
 % Write pixel data
+if any(strcmp(img.metaData.encoding, {'raw', 'gzip', 'gz'})) && exist('nrrdwrite_mex', 'file') == 3
+  % Pixel data is appended to the header
+  fclose(fid);
+  compressionLevel = -1;
+  numberOfThreads = 0;
+  if (nargin > 2)
+    if isfield(options, 'compressionLevel')
+      compressionLevel = options.compressionLevel;
+    end
+    if isfield(options, 'numberOfThreads')
+      numberOfThreads = options.numberOfThreads;
+    end
+  end
+  nrrdwrite_mex(outputFilename, img.pixelData, img.metaData.encoding, needToSwapBytes(img.metaData), compressionLevel, numberOfThreads);
+  return;
+end
 switch (img.metaData.encoding)
   case {'raw'}
     fwrite(fid, img.pixelData, class(img.pixelData));
@@ -165,6 +231,35 @@ end
 
 fclose('all');
 
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function dataFilename = appendFramePixelData(headerFilename, pixelData, frameIndex)
+% Append pixel data of a frame to the raw data file of a 4D volume with detached header.
+% Writing of frame 1 creates a new data file. Returns the data file name relative to the header file.
+  [pathstr, name, dummy] = fileparts(headerFilename);
+  dataFilename = [name '.raw'];
+  dataFullFilename = fullfile(pathstr, dataFilename);
+  frameSize = numel(pixelData)*numel(typecast(zeros(1,1,class(pixelData)),'uint8'));
+  if frameIndex == 1
+    fid = fopen(dataFullFilename, 'w', 'ieee-le');
+  else
+    fileInfo = dir(dataFullFilename);
+    assert(~isempty(fileInfo) && fileInfo.bytes == (frameIndex-1)*frameSize, ...
+      'Frames must be written in order, starting with frame 1, and all frames must have the same size');
+    fid = fopen(dataFullFilename, 'a', 'ieee-le');
+  end
+  assert(fid > 0, ['Could not open file: ' dataFullFilename]);
+  cleaner = onCleanup(@() fclose(fid));
+  fwrite(fid, pixelData, class(pixelData));
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function needToSwap = needToSwapBytes(meta)
+% Returns true if the byte order specified in the header is different from the byte order of this computer
+% For ignoring unused parameters dummy variables (dummy1 and dummy2) are
+% used instead of ~ to maintain compatibility with Matlab R2009b version
+[dummy1,dummy2,endian] = computer();
+needToSwap = (isequal(endian, 'B') && isequal(lower(meta.endian), 'little')) || ...
+         (isequal(endian, 'L') && isequal(lower(meta.endian), 'big'));
+
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 function writeFieldName(fid, fieldName, fullFieldNames, standardFieldNames)
   % If full field name is listed in img.metaDataFieldNames then use that
@@ -11,18 +11,192 @@ function [vertex,face] = read_ply(filename)
 %
 %   Copyright (c) 2003 Gabriel Peyr
 
+% Each element is read in one shot if the file contains only fixed-size properties
+% and triangle faces, otherwise the general (slow) plyread function is used.
+[vertex,face,success] = read_ply_triangles(filename);
+if success
+    return;
+end
+
 [d,c] = plyread(filename);
 
-vi = d.face.vertex_indices;
-nf = length(vi);
-face = zeros(nf,3);
-for i=1:nf
-    face(i,:) = vi{i}+1;
-end
+face = vertcat(d.face.vertex_indices{:})+1;
 
 vertex = [d.vertex.x, d.vertex.y, d.vertex.z];
 
 
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [vertex,face,success] = read_ply_triangles(filename)
+% Read a triangle mesh from an ASCII or binary PLY file without looping over the elements.
+% Binary elements are read into a byte matrix (one column per element) and each property
+% is extracted from its rows by typecast. success is false if the file cannot be read this way
+% (list properties other than the vertex indices of the faces, faces that are not triangles).
+
+vertex = [];
+face = [];
+success = false;
+
+fid = fopen(filename,'r');
+if fid == -1
+    return;
+end
+
+try
+    [format,elements] = read_ply_header(fid);
+    [c,maxsize,endian] = computer;
+    if strcmp(endian,'L')
+        swap = strcmp(format,'binary_big_endian');
+    else
+        swap = strcmp(format,'binary_little_endian');
+    end
+    if strcmp(format,'ascii')
+        data = fscanf(fid,'%f');
+        offset = 0;
+    elseif ~strcmp(format,'binary_little_endian') && ~strcmp(format,'binary_big_endian')
+        fclose(fid);
+        return;
+    end
+
+    for i = 1:length(elements)
+        properties = elements(i).properties;
+        count = elements(i).count;
+        isList = cellfun(@(property) strcmp(property{1},'list'), properties);
+        if strcmp(elements(i).name,'face')
+            % only a single list of vertex indices is supported, which must contain 3 indices for each face
+            if length(properties) ~= 1 || ~isList || length(properties{1}) ~= 4
+                fclose(fid);
+                return;
+            end
+            if strcmp(format,'ascii')
+                if length(data) < offset+4*count
+                    fclose(fid);
+                    return;
+                end
+                values = reshape(data(offset+1:offset+4*count),4,count);
+                offset = offset+4*count;
+                counts = values(1,:);
+                face = values(2:4,:)'+1;
+            else
+                [countType,countSize] = get_ply_type(properties{1}{2});
+                [indexType,indexSize] = get_ply_type(properties{1}{3});
+                bytes = fread(fid,[countSize+3*indexSize,count],'*uint8');
+                if size(bytes,2) ~= count
+                    fclose(fid);
+                    return;
+                end
+                counts = bytes_to_values(bytes(1:countSize,:),countType,swap);
+                face = reshape(double(bytes_to_values(bytes(countSize+1:end,:),indexType,swap)),3,count)'+1;
+            end
+            if any(counts ~= 3)
+                fclose(fid);
+                return;
+            end
+        else
+            if any(isList)
+                fclose(fid);
+                return;
+            end
+            names = cellfun(@(property) property{end}, properties, 'UniformOutput', false);
+            if strcmp(format,'ascii')
+                if length(data) < offset+length(properties)*count
+                    fclose(fid);
+                    return;
+                end
+                values = reshape(data(offset+1:offset+length(properties)*count),length(properties),count)';
+                offset = offset+length(properties)*count;
+            else
+                types = cell(1,length(properties));
+                sizes = zeros(1,length(properties));
+                for j = 1:length(properties)
+                    [types{j},sizes(j)] = get_ply_type(properties{j}{1});
+                end
+                bytes = fread(fid,[sum(sizes),count],'*uint8');
+                if size(bytes,2) ~= count
+                    fclose(fid);
+                    return;
+                end
+                offsets = [0,cumsum(sizes)];
+                values = zeros(count,length(properties));
+                for j = 1:length(properties)
+                    if any(strcmp(names{j},{'x','y','z'}))
+                        values(:,j) = double(bytes_to_values(bytes(offsets(j)+1:offsets(j+1),:),types{j},swap));
+                    end
+                end
+            end
+            if strcmp(elements(i).name,'vertex')
+                [found,columns] = ismember({'x','y','z'},names);
+                if ~all(found)
+                    fclose(fid);
+                    return;
+                end
+                vertex = values(:,columns);
+            end
+        end
+    end
+catch
+    fclose(fid);
+    return;
+end
+fclose(fid);
+success = true;
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [format,elements] = read_ply_header(fid)
+% Read the PLY header. elements is a struct array with the name, count and properties of each element,
+% each property is a cell array of the tokens of its definition (type(s) followed by the name).
+% The file position is set to the beginning of the data.
+
+if ~strcmp(strtrim(fgetl(fid)),'ply')
+    error('Not a PLY file.');
+end
+format = '';
+elements = struct('name',{},'count',{},'properties',{});
+while true
+    line = fgetl(fid);
+    if ~ischar(line)
+        error('Incomplete PLY header.');
+    end
+    tokens = regexp(strtrim(line),'\s+','split');
+    switch lower(tokens{1})
+        case 'format'
+            format = lower(tokens{2});
+        case 'element'
+            elements(end+1) = struct('name',tokens{2},'count',str2double(tokens{3}),'properties',{{}});
+        case 'property'
+            elements(end).properties{end+1} = tokens(2:end);
+        case 'end_header'
+            break;
+    end
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [matlabType,typeSize] = get_ply_type(plyType)
+% Get the Matlab data type and its size in bytes from a PLY data type name
+
+plyTypeNames = {'char','uchar','short','ushort','int','uint','float','double'; ...
+    'int8','uint8','int16','uint16','int32','uint32','float32','float64'};
+matlabTypeNames = {'int8','uint8','int16','uint16','int32','uint32','single','double'};
+typeSizes = [1,1,2,2,4,4,4,8];
+typeIndex = find(any(strcmp(plyTypeNames,plyType),1));
+if isempty(typeIndex)
+    error(['Unknown property data type: ',plyType]);
+end
+matlabType = matlabTypeNames{typeIndex};
+typeSize = typeSizes(typeIndex);
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function values = bytes_to_values(bytes,matlabType,swap)
+% Convert a byte matrix (each column contains the bytes of one or more values) to a column vector of values
+
+values = typecast(bytes(:),matlabType);
+if swap
+    values = swapbytes(values);
+end
+
+
 
 
 
@@ -92,10 +92,10 @@ end
 % 3 dimensions x 4 bytes x 4 vertices = 48 bytes for triangle vertices
 % 2 bytes = color (if color is specified)
 
-trilist = 1:48;
-
-ind = reshape(repmat(50*(0:(numFaces-1)),[48,1]),[1,48*numFaces])+repmat(trilist,[1,numFaces]);
-Tri = reshape(typecast(T(ind),'single'),[3,4,numFaces]);
+% One column for each facet (instead of computing an index for each byte, which
+% would need 8 times more memory than the file content)
+T = reshape(T(1:50*numFaces),[50,numFaces]);
+Tri = reshape(typecast(reshape(T(1:48,:),[],1),'single'),[3,4,numFaces]);
 
 n=squeeze(Tri(:,1,:))';
 n=double(n);
@@ -107,11 +107,9 @@ v = double(v)';
 f = reshape(1:3*numFaces,[3,numFaces])';
 
 if use_color
-    c0 = typecast(T(49:50),'uint16');
+    c0 = typecast(T(49:50,1),'uint16');
     if (bitget(c0(1),16)==1)
-        trilist = 49:50;
-        ind = reshape(repmat(50*(0:(numFaces-1)),[2,1]),[1,2*numFaces])+repmat(trilist,[1,numFaces]);
-        c0 = reshape(typecast(T(ind),'uint16'),[1,numFaces]);
+        c0 = reshape(typecast(reshape(T(49:50,:),[],1),'uint16'),[1,numFaces]);
         
         %modified by WGL
         r=bitshift(bitand(2^15-1, c0),-10);
@@ -6,6 +6,7 @@ function write_ply(vertex,face,filename, mode)
 %
 %   'vertex' is a 'nb.vert x 3' array specifying the position of the vertices.
 %   'face' is a 'nb.face x 3' array specifying the connectivity of the mesh.
+%   'mode' is 'ascii' (default), 'binary_little_endian', or 'binary_big_endian'.
 %
 %   IMPORTANT: works only for triangular meshes.
 %
@@ -30,16 +31,52 @@ if size(face,2)~=3
     error('face does not have correct format.');
 end
 
-% make a cube
-clear Data;
-Data.vertex.x = vertex(:,1);
-Data.vertex.y = vertex(:,2);
-Data.vertex.z = vertex(:,3);
-Data.face.vertex_indices = {};
-for i=1:size(face,1)
-    Data.face.vertex_indices{end+1} = face(i,:)-1;
+% All the faces are triangles, so the mesh is written in one shot
+% (the general plywrite function writes the faces one by one)
+write_ply_triangles(vertex,face,filename,mode);
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function write_ply_triangles(vertex,face,filename,format)
+% Write a triangle mesh to a PLY file. Vertex coordinates are written as float,
+% faces as uchar vertex count (always 3) followed by int vertex indices.
+
+switch format
+case 'ascii'
+   machineFormat = 'native';
+case 'binary_little_endian'
+   machineFormat = 'ieee-le';
+case 'binary_big_endian'
+   machineFormat = 'ieee-be';
+otherwise
+   error(['Data format ''',format,''' not supported.']);
 end
-plywrite(Data,filename,mode);
+
+[fid,Msg] = fopen(filename,'w',machineFormat);
+if fid == -1, error(Msg); end
+
+numberOfVertices = size(vertex,1);
+numberOfFaces = size(face,1);
+fprintf(fid,'ply\nformat %s 1.0\ncomment created by MATLAB write_ply\n',format);
+fprintf(fid,'element vertex %u\nproperty float x\nproperty float y\nproperty float z\n',numberOfVertices);
+fprintf(fid,'element face %u\nproperty list uchar int vertex_indices\nend_header\n',numberOfFaces);
+
+if strcmp(format,'ascii')
+   fprintf(fid,'%.9g %.9g %.9g\n',vertex');
+   fprintf(fid,'3 %d %d %d\n',face'-1);
+else
+   fwrite(fid,single(vertex'),'single');
+   % Each face is 13 bytes (count and 3 indices), the byte matrix of all the faces is written at once
+   indices = int32(face'-1);
+   [c,maxsize,endian] = computer;
+   if strcmp(endian,'L') ~= strcmp(format,'binary_little_endian')
+      indices = swapbytes(indices);
+   end
+   faceBytes = [repmat(uint8(3),1,numberOfFaces); reshape(typecast(indices(:),'uint8'),12,numberOfFaces)];
+   fwrite(fid,faceBytes,'uint8');
+end
+
+fclose(fid);
 
 
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
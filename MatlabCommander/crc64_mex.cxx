@@ -0,0 +1,98 @@
+// MEX function for computing the OpenIGTLink message body CRC
+//
+//   crc = crc64_mex(data)
+//   crc = crc64_mex(data, crc)
+//
+//   data: uint8 array (message body)
+//   crc: CRC of the preceding data, for computing the CRC of data that is split into multiple parts (default: 0)
+//   crc: uint64 CRC-64 (ECMA-182 polynomial, same as crc64() in OpenIGTLink's igtl_util.c)
+//
+// The CRC is computed 8 bytes at a time using "slicing-by-8" lookup tables, which is several times faster
+// than the byte-wise table lookup and is negligible compared to the network transfer time.
+
+#include "mex.h"
+
+namespace
+{
+
+typedef unsigned long long CrcType;
+
+const CrcType CRC64_POLYNOMIAL=0x42F0E1EBA9EA3693ULL;
+
+// CrcTable[k][b] is the CRC of byte b followed by k zero bytes
+CrcType CrcTable[8][256];
+bool CrcTableInitialized=false;
+
+void InitializeCrcTable()
+{
+  for (int byteValue=0; byteValue<256; byteValue++)
+  {
+    CrcType crc=static_cast<CrcType>(byteValue)<<56;
+    for (int bit=0; bit<8; bit++)
+    {
+      crc=(crc & 0x8000000000000000ULL) ? (crc<<1)^CRC64_POLYNOMIAL : (crc<<1);
+    }
+    CrcTable[0][byteValue]=crc;
+  }
+  for (int byteValue=0; byteValue<256; byteValue++)
+  {
+    for (int slice=1; slice<8; slice++)
+    {
+      CrcType previous=CrcTable[slice-1][byteValue];
+      CrcTable[slice][byteValue]=(previous<<8)^CrcTable[0][previous>>56];
+    }
+  }
+  CrcTableInitialized=true;
+}
+
+CrcType ComputeCrc64(const unsigned char* data, size_t length, CrcType crc)
+{
+  if (!CrcTableInitialized)
+  {
+    InitializeCrcTable();
+  }
+  for (; length>=8; length-=8, data+=8)
+  {
+    CrcType word=crc
+      ^ (static_cast<CrcType>(data[0])<<56) ^ (static_cast<CrcType>(data[1])<<48)
+      ^ (static_cast<CrcType>(data[2])<<40) ^ (static_cast<CrcType>(data[3])<<32)
+      ^ (static_cast<CrcType>(data[4])<<24) ^ (static_cast<CrcType>(data[5])<<16)
+      ^ (static_cast<CrcType>(data[6])<<8) ^ static_cast<CrcType>(data[7]);
+    crc=CrcTable[7][word>>56] ^ CrcTable[6][(word>>48) & 0xff]
+      ^ CrcTable[5][(word>>40) & 0xff] ^ CrcTable[4][(word>>32) & 0xff]
+      ^ CrcTable[3][(word>>24) & 0xff] ^ CrcTable[2][(word>>16) & 0xff]
+      ^ CrcTable[1][(word>>8) & 0xff] ^ CrcTable[0][word & 0xff];
+  }
+  for (; length>0; length--, data++)
+  {
+    crc=CrcTable[0][((crc>>56)^(*data)) & 0xff]^(crc<<8);
+  }
+  return crc;
+}
+
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs<1 || nrhs>2 || nlhs>1)
+  {
+    mexErrMsgIdAndTxt("crc64_mex:invalidArgument", "Usage: crc = crc64_mex(data [, crc])");
+  }
+  if (mxGetClassID(prhs[0])!=mxUINT8_CLASS)
+  {
+    mexErrMsgIdAndTxt("crc64_mex:invalidArgument", "data must be a uint8 array");
+  }
+  CrcType crc=0;
+  if (nrhs>1)
+  {
+    if (mxGetClassID(prhs[1])!=mxUINT64_CLASS || mxGetNumberOfElements(prhs[1])!=1)
+    {
+      mexErrMsgIdAndTxt("crc64_mex:invalidArgument", "crc must be a uint64 scalar");
+    }
+    crc=*static_cast<const CrcType*>(mxGetData(prhs[1]));
+  }
+  crc=ComputeCrc64(static_cast<const unsigned char*>(mxGetData(prhs[0])), mxGetNumberOfElements(prhs[0]), crc);
+
+  plhs[0]=mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+  *static_cast<CrcType*>(mxGetData(plhs[0]))=crc;
+}
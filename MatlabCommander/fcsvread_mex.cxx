@@ -0,0 +1,256 @@
+// MEX function for reading markups fiducial list (fcsv) files
+//
+//   [position, orientation, visibility, selected, locked, id, label, description, associatedNodeID] = fcsvread_mex(filename)
+//
+//   position: N-by-3 double array of point positions
+//   orientation: N-by-4 double array of point orientations (quaternion)
+//   visibility, selected, locked: N-by-1 int32 arrays
+//   id, label, description, associatedNodeID: N-by-1 cell arrays of strings
+//
+// Columns are expected in the order that Slicer writes them:
+//   id,x,y,z,ow,ox,oy,oz,vis,sel,lock,label,desc,associatedNodeID
+// Header lines (starting with #) and empty lines are skipped. Empty numeric fields are read as NaN (positions
+// and orientations) or 0 (flags), the same way as textscan reads them.
+//
+// The file is read at once and numbers are parsed directly into the preallocated output arrays.
+// String columns are only extracted if they are requested (nargout>5), as creating millions of Matlab strings
+// takes much longer than parsing the numbers. Fields may be quoted ("" in a quoted field is a quote character).
+
+#include "mex.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const int NUMBER_OF_POSITION_COLUMNS=3;
+const int NUMBER_OF_ORIENTATION_COLUMNS=4;
+const int NUMBER_OF_FLAG_COLUMNS=3;
+const int NUMBER_OF_STRING_COLUMNS=4;
+// Output index of the first string column (id)
+const int FIRST_STRING_OUTPUT=2+NUMBER_OF_FLAG_COLUMNS;
+
+bool ReadFile(const char* filename, std::vector<char>& content)
+{
+  FILE* file=fopen(filename, "rb");
+  if (file==NULL)
+  {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long fileSize=ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (fileSize<0)
+  {
+    fclose(file);
+    return false;
+  }
+  // Terminating zero, so that numbers at the end of the file can be parsed by strtod
+  content.resize(static_cast<size_t>(fileSize)+1);
+  size_t readSize=fread(&content[0], 1, static_cast<size_t>(fileSize), file);
+  fclose(file);
+  content[readSize]=0;
+  content.resize(readSize+1);
+  return true;
+}
+
+// Returns true if the line contains a point (not a header or empty line)
+bool IsPointLine(const char* lineStart, const char* lineEnd)
+{
+  return lineStart<lineEnd && *lineStart!='#' && *lineStart!='\r';
+}
+
+const char* GetLineEnd(const char* lineStart, const char* contentEnd)
+{
+  const char* lineEnd=static_cast<const char*>(memchr(lineStart, '\n', contentEnd-lineStart));
+  return lineEnd==NULL ? contentEnd : lineEnd;
+}
+
+// Returns the start of the next field in the line (or lineEnd if there are no more fields)
+const char* SkipField(const char* position, const char* lineEnd)
+{
+  const char* separator=static_cast<const char*>(memchr(position, ',', lineEnd-position));
+  return separator==NULL ? lineEnd : separator+1;
+}
+
+// Parse a number, returns the start of the next field
+const char* ParseNumber(const char* position, const char* lineEnd, double emptyValue, double& value)
+{
+  while (position<lineEnd && (*position==' ' || *position=='\t'))
+  {
+    position++;
+  }
+  value=emptyValue;
+  if (position<lineEnd && *position!=',' && *position!='\r')
+  {
+    char* numberEnd=NULL;
+    double parsedValue=strtod(position, &numberEnd);
+    if (numberEnd!=position && numberEnd<=lineEnd)
+    {
+      value=parsedValue;
+      position=numberEnd;
+    }
+  }
+  return SkipField(position, lineEnd);
+}
+
+// Parse a string field, returns the start of the next field
+const char* ParseString(const char* position, const char* lineEnd, std::string& value)
+{
+  value.clear();
+  if (position>=lineEnd)
+  {
+    return lineEnd;
+  }
+  if (*position=='"')
+  {
+    // Quoted field, may contain separators
+    for (position++; position<lineEnd; position++)
+    {
+      if (*position=='"')
+      {
+        if (position+1<lineEnd && position[1]=='"')
+        {
+          position++;
+        }
+        else
+        {
+          position++;
+          break;
+        }
+      }
+      value.push_back(*position);
+    }
+    return SkipField(position, lineEnd);
+  }
+  const char* fieldEnd=static_cast<const char*>(memchr(position, ',', lineEnd-position));
+  if (fieldEnd==NULL)
+  {
+    fieldEnd=lineEnd;
+    if (fieldEnd>position && fieldEnd[-1]=='\r')
+    {
+      fieldEnd--;
+    }
+  }
+  value.assign(position, fieldEnd);
+  return SkipField(position, lineEnd);
+}
+
+} // namespace
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs!=1 || !mxIsChar(prhs[0]) || nlhs>FIRST_STRING_OUTPUT+NUMBER_OF_STRING_COLUMNS)
+  {
+    mexErrMsgIdAndTxt("fcsvread_mex:invalidArgument",
+      "Usage: [position, orientation, visibility, selected, locked, id, label, description, associatedNodeID] = fcsvread_mex(filename)");
+  }
+  char* filename=mxArrayToString(prhs[0]);
+  std::vector<char> content;
+  bool readSuccess=ReadFile(filename, content);
+  mxFree(filename);
+  if (!readSuccess)
+  {
+    mexErrMsgIdAndTxt("fcsvread_mex:readError", "Could not open file.");
+  }
+  const char* contentStart=&content[0];
+  const char* contentEnd=contentStart+content.size()-1;
+
+  // Count the points to preallocate the outputs
+  size_t numberOfPoints=0;
+  for (const char* lineStart=contentStart; lineStart<contentEnd; )
+  {
+    const char* lineEnd=GetLineEnd(lineStart, contentEnd);
+    if (IsPointLine(lineStart, lineEnd))
+    {
+      numberOfPoints++;
+    }
+    lineStart=lineEnd+1;
+  }
+
+  mxArray* positionArray=mxCreateDoubleMatrix(numberOfPoints, NUMBER_OF_POSITION_COLUMNS, mxREAL);
+  mxArray* orientationArray=mxCreateDoubleMatrix(numberOfPoints, NUMBER_OF_ORIENTATION_COLUMNS, mxREAL);
+  double* position=mxGetPr(positionArray);
+  double* orientation=mxGetPr(orientationArray);
+  mxArray* flagArrays[NUMBER_OF_FLAG_COLUMNS];
+  int* flags[NUMBER_OF_FLAG_COLUMNS];
+  for (int flagIndex=0; flagIndex<NUMBER_OF_FLAG_COLUMNS; flagIndex++)
+  {
+    flagArrays[flagIndex]=mxCreateNumericMatrix(numberOfPoints, 1, mxINT32_CLASS, mxREAL);
+    flags[flagIndex]=static_cast<int*>(mxGetData(flagArrays[flagIndex]));
+  }
+  const int numberOfStringOutputs=(nlhs>FIRST_STRING_OUTPUT ? nlhs-FIRST_STRING_OUTPUT : 0);
+  mxArray* stringArrays[NUMBER_OF_STRING_COLUMNS]={NULL};
+  for (int stringIndex=0; stringIndex<numberOfStringOutputs; stringIndex++)
+  {
+    stringArrays[stringIndex]=mxCreateCellMatrix(numberOfPoints, 1);
+  }
+
+  const double nan=std::numeric_limits<double>::quiet_NaN();
+  std::string stringValue;
+  size_t pointIndex=0;
+  for (const char* lineStart=contentStart; lineStart<contentEnd && pointIndex<numberOfPoints; )
+  {
+    const char* lineEnd=GetLineEnd(lineStart, contentEnd);
+    if (!IsPointLine(lineStart, lineEnd))
+    {
+      lineStart=lineEnd+1;
+      continue;
+    }
+    const char* field=lineStart;
+    // id
+    if (numberOfStringOutputs>0)
+    {
+      field=ParseString(field, lineEnd, stringValue);
+      mxSetCell(stringArrays[0], pointIndex, mxCreateString(stringValue.c_str()));
+    }
+    else
+    {
+      field=SkipField(field, lineEnd);
+    }
+    double value=0;
+    for (int column=0; column<NUMBER_OF_POSITION_COLUMNS; column++)
+    {
+      field=ParseNumber(field, lineEnd, nan, position[column*numberOfPoints+pointIndex]);
+    }
+    for (int column=0; column<NUMBER_OF_ORIENTATION_COLUMNS; column++)
+    {
+      field=ParseNumber(field, lineEnd, nan, orientation[column*numberOfPoints+pointIndex]);
+    }
+    for (int flagIndex=0; flagIndex<NUMBER_OF_FLAG_COLUMNS; flagIndex++)
+    {
+      field=ParseNumber(field, lineEnd, 0, value);
+      flags[flagIndex][pointIndex]=static_cast<int>(value);
+    }
+    // label, description, associatedNodeID
+    for (int stringIndex=1; stringIndex<numberOfStringOutputs; stringIndex++)
+    {
+      field=ParseString(field, lineEnd, stringValue);
+      mxSetCell(stringArrays[stringIndex], pointIndex, mxCreateString(stringValue.c_str()));
+    }
+    pointIndex++;
+    lineStart=lineEnd+1;
+  }
+
+  mxArray* outputs[FIRST_STRING_OUTPUT]={positionArray, orientationArray, flagArrays[0], flagArrays[1], flagArrays[2]};
+  for (int outputIndex=0; outputIndex<FIRST_STRING_OUTPUT; outputIndex++)
+  {
+    if (outputIndex<nlhs || outputIndex==0)
+    {
+      plhs[outputIndex]=outputs[outputIndex];
+    }
+    else
+    {
+      mxDestroyArray(outputs[outputIndex]);
+    }
+  }
+  for (int stringIndex=0; stringIndex<numberOfStringOutputs; stringIndex++)
+  {
+    plhs[FIRST_STRING_OUTPUT+stringIndex]=stringArrays[stringIndex];
+  }
+}
@@ -0,0 +1,136 @@
+// MEX function for merging duplicate vertices of a triangle mesh
+//
+//   [vertices, indices] = weldvertices_mex(cornerVertices)
+//
+//   cornerVertices: N-by-3 double array of vertex positions (e.g., one vertex for each triangle corner, as read from STL files)
+//   vertices: M-by-3 double array of the distinct vertex positions, in the order of their first occurrence
+//   indices: N-by-1 double array, cornerVertices(i,:) is equal to vertices(indices(i),:)
+//
+// Vertices are merged if their coordinates are exactly the same (STL files store the corners of each triangle
+// separately, so corners of neighbor triangles have identical coordinates). Vertices are looked up in a hash table,
+// so the computation time is linear in the number of vertices, which is several times faster than unique(...,'rows').
+
+#include "mex.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+typedef unsigned long long WordType;
+
+const unsigned int EMPTY_SLOT=0xFFFFFFFF;
+
+// Bit pattern of a coordinate value. Negative zero is stored as zero, so that they are merged.
+WordType GetCoordinateBits(double value)
+{
+  if (value==0.0)
+  {
+    value=0.0;
+  }
+  WordType bits=0;
+  memcpy(&bits, &value, sizeof(value));
+  return bits;
+}
+
+WordType MixBits(WordType hash)
+{
+  hash^=hash>>33;
+  hash*=0xFF51AFD7ED558CCDULL;
+  hash^=hash>>33;
+  hash*=0xC4CEB9FE1A85EC53ULL;
+  hash^=hash>>33;
+  return hash;
+}
+
+struct VertexKey
+{
+  WordType Coordinates[3];
+  bool operator==(const VertexKey& other) const
+  {
+    return this->Coordinates[0]==other.Coordinates[0] && this->Coordinates[1]==other.Coordinates[1]
+      && this->Coordinates[2]==other.Coordinates[2];
+  }
+  WordType GetHash() const
+  {
+    return MixBits(this->Coordinates[0] ^ MixBits(this->Coordinates[1] ^ MixBits(this->Coordinates[2])));
+  }
+};
+
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs!=1 || nlhs>2)
+  {
+    mexErrMsgIdAndTxt("weldvertices_mex:invalidArgument", "Usage: [vertices, indices] = weldvertices_mex(cornerVertices)");
+  }
+  if (mxGetClassID(prhs[0])!=mxDOUBLE_CLASS || mxIsComplex(prhs[0]) || mxGetNumberOfDimensions(prhs[0])!=2 || mxGetN(prhs[0])!=3)
+  {
+    mexErrMsgIdAndTxt("weldvertices_mex:invalidArgument", "cornerVertices must be an N-by-3 real double array");
+  }
+  const size_t numberOfCorners=mxGetM(prhs[0]);
+  if (numberOfCorners>=EMPTY_SLOT)
+  {
+    mexErrMsgIdAndTxt("weldvertices_mex:invalidArgument", "Too many vertices");
+  }
+  const double* corners=mxGetPr(prhs[0]);
+
+  // Open addressing hash table, at most half full. Slots store the index of the first corner that has the position.
+  size_t tableSize=1024;
+  while (tableSize<2*numberOfCorners)
+  {
+    tableSize*=2;
+  }
+  std::vector<unsigned int> table(tableSize, EMPTY_SLOT);
+  // Index of the merged vertex of each slot
+  std::vector<unsigned int> slotVertexIndices(tableSize);
+  // Index of the first corner of each merged vertex
+  std::vector<unsigned int> vertexCornerIndices;
+  vertexCornerIndices.reserve(numberOfCorners/4+1);
+
+  plhs[1]=mxCreateDoubleMatrix(numberOfCorners, 1, mxREAL);
+  double* indices=mxGetPr(plhs[1]);
+  for (size_t cornerIndex=0; cornerIndex<numberOfCorners; cornerIndex++)
+  {
+    VertexKey key;
+    for (int component=0; component<3; component++)
+    {
+      key.Coordinates[component]=GetCoordinateBits(corners[component*numberOfCorners+cornerIndex]);
+    }
+    size_t slot=static_cast<size_t>(key.GetHash()) & (tableSize-1);
+    while (table[slot]!=EMPTY_SLOT)
+    {
+      VertexKey slotKey;
+      for (int component=0; component<3; component++)
+      {
+        slotKey.Coordinates[component]=GetCoordinateBits(corners[component*numberOfCorners+table[slot]]);
+      }
+      if (slotKey==key)
+      {
+        break;
+      }
+      slot=(slot+1) & (tableSize-1);
+    }
+    if (table[slot]==EMPTY_SLOT)
+    {
+      // new vertex
+      table[slot]=static_cast<unsigned int>(cornerIndex);
+      slotVertexIndices[slot]=static_cast<unsigned int>(vertexCornerIndices.size());
+      vertexCornerIndices.push_back(static_cast<unsigned int>(cornerIndex));
+    }
+    indices[cornerIndex]=slotVertexIndices[slot]+1;
+  }
+
+  const size_t numberOfVertices=vertexCornerIndices.size();
+  plhs[0]=mxCreateDoubleMatrix(numberOfVertices, 3, mxREAL);
+  double* vertices=mxGetPr(plhs[0]);
+  for (size_t vertexIndex=0; vertexIndex<numberOfVertices; vertexIndex++)
+  {
+    for (int component=0; component<3; component++)
+    {
+      vertices[component*numberOfVertices+vertexIndex]=corners[component*numberOfCorners+vertexCornerIndices[vertexIndex]];
+    }
+  }
+}
@@ -82,3 +82,12 @@ cli_imagewrite(inputParams.outputvolume, img);
 %    Important: in the CLI definition file the following attribute shall be added to the geometry element: fileExtensions=".stl"
 %    See https://github.com/PerkLab/SlicerMatlabBridge/tree/master/Examples/MeshScale for a complete example.
 %
+%
+%
+% Reporting progress
+%
+%  Progress of long computations can be displayed on the module's progress bar while the module is running:
+%    cli_progress(fraction); % fraction is between 0 and 1
+%    cli_progress(fraction, 'status message');
+%    cli_progress([], 'status message');
+%
@@ -18,6 +18,7 @@
 // Qt includes
 #include <QDebug> 
 #include <QDir>
+#include <QProcess>
 #include <QSettings> 
 
 // VTK includes
@@ -246,6 +247,18 @@ void qSlicerMatlabModuleGeneratorModule::setup()
   vtksys::SystemTools::PutEnv(scriptEnvVar.c_str());
   std::string commanderEnvVar=std::string("SLICER_MATLAB_COMMANDER_PATH=")+moduleGeneratorLogic->GetMatlabCommanderPath();
   vtksys::SystemTools::PutEnv(commanderEnvVar.c_str());
+
+  // Start Matlab in the background now, so that the first Matlab module execution does not have to wait for Matlab startup
+  QSettings settings;
+  if (settings.value("Matlab/StartMatlabOnApplicationStartup",false).toBool())
+  {
+    qDebug("Starting Matlab");
+    QString matlabCommanderPath=QString::fromLatin1(moduleGeneratorLogic->GetMatlabCommanderPath());
+    if (!QProcess::startDetached(matlabCommanderPath, QStringList() << "--start-matlab"))
+    {
+      qWarning("Failed to start Matlab using %s", qPrintable(matlabCommanderPath));
+    }
+  }
 }
 
 //-----------------------------------------------------------------------------
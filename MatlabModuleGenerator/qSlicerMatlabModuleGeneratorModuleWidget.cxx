@@ -103,9 +103,12 @@ void qSlicerMatlabModuleGeneratorModuleWidget::setup()
     settings.setValue("Matlab/ExitMatlabOnApplicationExit",true);
   }
 
+  d->checkBox_StartMatlab->setChecked(settings.value("Matlab/StartMatlabOnApplicationStartup",false).toBool());
+
   connect( QCoreApplication::instance(), SIGNAL(aboutToQuit()), this, SLOT(applicationAboutToQuit()) );
 
   connect( d->lineEdit_MatlabExecutablePath, SIGNAL(currentPathChanged(QString)), this, SLOT(matlabExecutablePathChanged(QString)) );
+  connect( d->checkBox_StartMatlab, SIGNAL(stateChanged(int)), this, SLOT(startMatlabChanged(int)) );
   connect( d->checkBox_ExitMatlab, SIGNAL(stateChanged(int)), this, SLOT(exitMatlabChanged(int)) );
 
   connect( d->pushButton_GenerateModule, SIGNAL(clicked()), this, SLOT(generateModuleClicked()) );
@@ -157,6 +160,13 @@ void qSlicerMatlabModuleGeneratorModuleWidget::matlabExecutablePathChanged(QStri
   d->logic()->SetMatlabExecutablePath(path.toLatin1());
 }
 
+//-----------------------------------------------------------------------------
+void qSlicerMatlabModuleGeneratorModuleWidget::startMatlabChanged(int state)
+{
+  QSettings settings;
+  settings.setValue("Matlab/StartMatlabOnApplicationStartup",state==Qt::Checked);
+}
+
 //-----------------------------------------------------------------------------
 void qSlicerMatlabModuleGeneratorModuleWidget::exitMatlabChanged(int state)
 {
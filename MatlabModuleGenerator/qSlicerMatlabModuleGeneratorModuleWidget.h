@@ -45,6 +45,7 @@ protected slots:
   void applicationAboutToQuit();
 
   void matlabExecutablePathChanged(QString path);
+  void startMatlabChanged(int state);
   void exitMatlabChanged(int state);
   void generateModuleClicked();
 
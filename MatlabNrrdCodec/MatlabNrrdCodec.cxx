@@ -0,0 +1,499 @@
+#include "MatlabNrrdCodec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "zlib.h"
+
+namespace
+{
+
+// Size of the blocks that are read from/written to the file and passed to zlib.
+// Keeps the memory usage small even for very large volumes.
+const size_t FILE_BLOCK_SIZE=4*1024*1024;
+
+// Windows bits for zlib: 15 is the maximum window size, +32 selects gzip/zlib header autodetection
+const int GZIP_READ_WINDOW_BITS=15+32;
+
+bool IsGzipEncoding(const std::string& encoding)
+{
+  return encoding=="gzip" || encoding=="gz";
+}
+
+// Closes the file when it goes out of scope
+class FileCloser
+{
+public:
+  FileCloser(FILE* file) : File(file) {}
+  ~FileCloser() { if (this->File!=NULL) { fclose(this->File); } }
+private:
+  FILE* File;
+};
+
+bool SeekFile(FILE* file, long long offset, int origin=SEEK_SET)
+{
+#ifdef _WIN32
+  return _fseeki64(file, offset, origin)==0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), origin)==0;
+#endif
+}
+
+// Sequential reader of raw or gzip encoded pixel data. Compressed data is decompressed
+// in blocks, so reading any part of the data needs a constant amount of extra memory.
+class PixelDataReader
+{
+public:
+  PixelDataReader(FILE* file, bool gzipEncoding)
+    : File(file), GzipEncoding(gzipEncoding), StreamInitialized(false), EndOfFile(false)
+  {
+    memset(&this->Stream, 0, sizeof(this->Stream));
+  }
+
+  ~PixelDataReader()
+  {
+    if (this->StreamInitialized)
+    {
+      inflateEnd(&this->Stream);
+    }
+  }
+
+  // Read the next bufferSize bytes of pixel data into buffer
+  bool Read(char* buffer, size_t bufferSize, std::string& errorMessage)
+  {
+    return this->GzipEncoding ? this->ReadGzip(buffer, bufferSize, errorMessage) : this->ReadRaw(buffer, bufferSize, errorMessage);
+  }
+
+  // Skip the next numberOfBytes bytes of pixel data
+  bool Skip(long long numberOfBytes, std::string& errorMessage)
+  {
+    if (!this->GzipEncoding)
+    {
+      if (!SeekFile(this->File, numberOfBytes, SEEK_CUR))
+      {
+        errorMessage="Failed to seek in pixel data";
+        return false;
+      }
+      return true;
+    }
+    // Compressed data has to be decompressed to find the position
+    std::vector<char> skippedBlock(static_cast<size_t>(std::min<long long>(numberOfBytes, FILE_BLOCK_SIZE)));
+    for (long long bytesSkipped=0; bytesSkipped<numberOfBytes; bytesSkipped+=skippedBlock.size())
+    {
+      size_t bytesToSkip=static_cast<size_t>(std::min<long long>(skippedBlock.size(), numberOfBytes-bytesSkipped));
+      if (!this->ReadGzip(&skippedBlock[0], bytesToSkip, errorMessage))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  bool ReadRaw(char* buffer, size_t bufferSize, std::string& errorMessage)
+  {
+    size_t totalBytesRead=0;
+    while (totalBytesRead<bufferSize)
+    {
+      size_t bytesToRead=std::min(FILE_BLOCK_SIZE, bufferSize-totalBytesRead);
+      size_t bytesRead=fread(buffer+totalBytesRead, 1, bytesToRead, this->File);
+      totalBytesRead+=bytesRead;
+      if (bytesRead<bytesToRead)
+      {
+        errorMessage="Unexpected end of file while reading pixel data";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool ReadGzip(char* buffer, size_t bufferSize, std::string& errorMessage)
+  {
+    if (!this->StreamInitialized)
+    {
+      if (inflateInit2(&this->Stream, GZIP_READ_WINDOW_BITS)!=Z_OK)
+      {
+        errorMessage="Failed to initialize gzip decompression";
+        return false;
+      }
+      this->StreamInitialized=true;
+      this->CompressedBlock.resize(FILE_BLOCK_SIZE);
+    }
+    z_stream& stream=this->Stream;
+    size_t totalBytesDecompressed=0;
+    while (totalBytesDecompressed<bufferSize)
+    {
+      if (stream.avail_in==0 && !this->EndOfFile)
+      {
+        size_t bytesRead=fread(&this->CompressedBlock[0], 1, this->CompressedBlock.size(), this->File);
+        this->EndOfFile=(bytesRead==0);
+        stream.next_in=&this->CompressedBlock[0];
+        stream.avail_in=static_cast<uInt>(bytesRead);
+      }
+      // avail_out is limited to the range of uInt
+      size_t bytesToDecompress=std::min(FILE_BLOCK_SIZE, bufferSize-totalBytesDecompressed);
+      stream.next_out=reinterpret_cast<Bytef*>(buffer+totalBytesDecompressed);
+      stream.avail_out=static_cast<uInt>(bytesToDecompress);
+      int result=inflate(&stream, Z_NO_FLUSH);
+      size_t bytesDecompressed=bytesToDecompress-stream.avail_out;
+      totalBytesDecompressed+=bytesDecompressed;
+      if (this->EndOfFile && bytesDecompressed==0 && totalBytesDecompressed<bufferSize)
+      {
+        errorMessage="Unexpected end of file while reading compressed pixel data";
+        return false;
+      }
+      if (result==Z_STREAM_END)
+      {
+        // Data may be stored in multiple concatenated gzip streams
+        if (inflateReset(&stream)!=Z_OK)
+        {
+          errorMessage="Failed to decompress pixel data";
+          return false;
+        }
+      }
+      else if (result!=Z_OK && result!=Z_BUF_ERROR)
+      {
+        errorMessage=std::string("Failed to decompress pixel data: ")+(stream.msg!=NULL ? stream.msg : "unknown error");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  FILE* File;
+  bool GzipEncoding;
+  z_stream Stream;
+  bool StreamInitialized;
+  bool EndOfFile;
+  std::vector<unsigned char> CompressedBlock;
+};
+
+// Open the file and seek to the pixel data. Returns NULL in case of failure.
+FILE* OpenPixelDataFile(const std::string& filename, long long dataOffset, const std::string& encoding, std::string& errorMessage)
+{
+  if (!IsNrrdEncodingSupported(encoding))
+  {
+    errorMessage="Unsupported encoding: "+encoding;
+    return NULL;
+  }
+  FILE* file=fopen(filename.c_str(), "rb");
+  if (file==NULL)
+  {
+    errorMessage="Could not open file: "+filename;
+    return NULL;
+  }
+  if (!SeekFile(file, dataOffset))
+  {
+    errorMessage="Failed to seek to the pixel data in file: "+filename;
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+// Returns the block of data that is written to the file. If byte swapping is requested then
+// the block is copied to swapBuffer and swapped, otherwise the original data is used.
+const char* GetOutputBlock(const char* data, size_t blockSize, size_t componentSize, bool swapBytes, std::vector<char>& swapBuffer)
+{
+  if (!swapBytes || blockSize==0)
+  {
+    return data;
+  }
+  swapBuffer.resize(blockSize);
+  memcpy(&swapBuffer[0], data, blockSize);
+  SwapNrrdPixelDataBytes(&swapBuffer[0], blockSize/componentSize, componentSize);
+  return &swapBuffer[0];
+}
+
+bool WriteRawPixelData(FILE* file, const char* data, size_t dataSize, size_t blockSize, size_t componentSize, bool swapBytes,
+  std::string& errorMessage)
+{
+  std::vector<char> swapBuffer;
+  for (size_t blockStart=0; blockStart<dataSize; blockStart+=blockSize)
+  {
+    size_t bytesToWrite=std::min(blockSize, dataSize-blockStart);
+    const char* block=GetOutputBlock(data+blockStart, bytesToWrite, componentSize, swapBytes, swapBuffer);
+    if (fwrite(block, 1, bytesToWrite, file)!=bytesToWrite)
+    {
+      errorMessage="Failed to write pixel data";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Size of the blocks that are compressed independently by the compression threads.
+// Smaller blocks slightly decrease the compression ratio, larger blocks increase the memory usage.
+const size_t GZIP_COMPRESSION_BLOCK_SIZE=1024*1024;
+
+// Number of blocks that each compression thread processes before the compressed data is written to file.
+// Limits memory usage to (number of threads)*(blocks per thread)*(block size).
+const size_t GZIP_COMPRESSION_BLOCKS_PER_THREAD=4;
+
+// Operating system code in the gzip header: unknown
+const unsigned char GZIP_OS_UNKNOWN=255;
+
+struct CompressedBlock
+{
+  std::vector<unsigned char> Data;
+  uLong Crc;
+  bool Success;
+};
+
+// Compress a block into a raw deflate stream that can be concatenated with the other blocks
+// (each block ends on a byte boundary, only the last block is marked as final).
+void CompressBlock(const char* data, size_t dataSize, size_t componentSize, bool swapBytes, int compressionLevel,
+  bool lastBlock, CompressedBlock& compressedBlock)
+{
+  std::vector<char> swapBuffer;
+  const char* block=GetOutputBlock(data, dataSize, componentSize, swapBytes, swapBuffer);
+  compressedBlock.Crc=crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(block), static_cast<uInt>(dataSize));
+  compressedBlock.Success=false;
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // Negative window bits: raw deflate stream, without header and trailer
+  if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+  {
+    return;
+  }
+  // Bound is increased to leave space for the flush marker
+  compressedBlock.Data.resize(deflateBound(&stream, static_cast<uLong>(dataSize))+16);
+  stream.next_in=reinterpret_cast<Bytef*>(const_cast<char*>(block));
+  stream.avail_in=static_cast<uInt>(dataSize);
+  stream.next_out=&compressedBlock.Data[0];
+  stream.avail_out=static_cast<uInt>(compressedBlock.Data.size());
+  int result=deflate(&stream, lastBlock ? Z_FINISH : Z_SYNC_FLUSH);
+  if ((lastBlock && result==Z_STREAM_END) || (!lastBlock && result==Z_OK && stream.avail_in==0 && stream.avail_out>0))
+  {
+    compressedBlock.Data.resize(compressedBlock.Data.size()-stream.avail_out);
+    compressedBlock.Success=true;
+  }
+  deflateEnd(&stream);
+}
+
+void WriteLittleEndianUint32(FILE* file, uLong value)
+{
+  unsigned char bytes[4]={
+    static_cast<unsigned char>(value & 0xff), static_cast<unsigned char>((value>>8) & 0xff),
+    static_cast<unsigned char>((value>>16) & 0xff), static_cast<unsigned char>((value>>24) & 0xff) };
+  fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+// Writes a single gzip stream. The data is split into blocks that are compressed in parallel
+// (similarly to pigz), and the compressed blocks are concatenated into one deflate stream.
+bool WriteGzipPixelData(FILE* file, const char* data, size_t dataSize, size_t componentSize, bool swapBytes,
+  int compressionLevel, int numberOfThreads, std::string& errorMessage)
+{
+  // Blocks must contain whole components so that they can be byte-swapped independently
+  const size_t blockSize=std::max<size_t>(componentSize, GZIP_COMPRESSION_BLOCK_SIZE-GZIP_COMPRESSION_BLOCK_SIZE%componentSize);
+  const size_t numberOfBlocks=std::max<size_t>(1, (dataSize+blockSize-1)/blockSize);
+  const size_t threadCount=std::min<size_t>(numberOfBlocks, static_cast<size_t>(GetNrrdCompressionThreadCount(numberOfThreads)));
+
+  const unsigned char gzipHeader[10]={ 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, GZIP_OS_UNKNOWN };
+  if (fwrite(gzipHeader, 1, sizeof(gzipHeader), file)!=sizeof(gzipHeader))
+  {
+    errorMessage="Failed to write compressed pixel data";
+    return false;
+  }
+
+  uLong crc=crc32(0L, Z_NULL, 0);
+  std::vector<CompressedBlock> compressedBlocks(threadCount*GZIP_COMPRESSION_BLOCKS_PER_THREAD);
+  for (size_t batchStartBlock=0; batchStartBlock<numberOfBlocks; batchStartBlock+=compressedBlocks.size())
+  {
+    const size_t batchBlockCount=std::min(compressedBlocks.size(), numberOfBlocks-batchStartBlock);
+    // Each thread compresses every threadCount-th block of the batch
+    std::vector<std::thread> threads;
+    for (size_t threadIndex=0; threadIndex<threadCount; threadIndex++)
+    {
+      threads.push_back(std::thread([=, &compressedBlocks]()
+      {
+        for (size_t batchBlockIndex=threadIndex; batchBlockIndex<batchBlockCount; batchBlockIndex+=threadCount)
+        {
+          size_t blockIndex=batchStartBlock+batchBlockIndex;
+          size_t blockStart=blockIndex*blockSize;
+          size_t blockBytes=std::min(blockSize, dataSize-blockStart);
+          CompressBlock(data+blockStart, blockBytes, componentSize, swapBytes, compressionLevel,
+            blockIndex+1==numberOfBlocks, compressedBlocks[batchBlockIndex]);
+        }
+      }));
+    }
+    for (size_t threadIndex=0; threadIndex<threadCount; threadIndex++)
+    {
+      threads[threadIndex].join();
+    }
+    for (size_t batchBlockIndex=0; batchBlockIndex<batchBlockCount; batchBlockIndex++)
+    {
+      const CompressedBlock& compressedBlock=compressedBlocks[batchBlockIndex];
+      if (!compressedBlock.Success)
+      {
+        errorMessage="Failed to compress pixel data";
+        return false;
+      }
+      if (fwrite(&compressedBlock.Data[0], 1, compressedBlock.Data.size(), file)!=compressedBlock.Data.size())
+      {
+        errorMessage="Failed to write compressed pixel data";
+        return false;
+      }
+      size_t blockStart=(batchStartBlock+batchBlockIndex)*blockSize;
+      crc=crc32_combine(crc, compressedBlock.Crc, static_cast<z_off_t>(std::min(blockSize, dataSize-blockStart)));
+    }
+  }
+
+  // Trailer: CRC32 and size of the uncompressed data (modulo 2^32)
+  WriteLittleEndianUint32(file, crc);
+  WriteLittleEndianUint32(file, static_cast<uLong>(dataSize & 0xffffffffUL));
+  if (ferror(file))
+  {
+    errorMessage="Failed to write compressed pixel data";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+bool IsNrrdEncodingSupported(const std::string& encoding)
+{
+  return encoding=="raw" || IsGzipEncoding(encoding);
+}
+
+//----------------------------------------------------------------------------
+void SwapNrrdPixelDataBytes(void* data, size_t numberOfComponents, size_t componentSize)
+{
+  if (componentSize<2)
+  {
+    return;
+  }
+  char* component=static_cast<char*>(data);
+  for (size_t componentIndex=0; componentIndex<numberOfComponents; componentIndex++, component+=componentSize)
+  {
+    std::reverse(component, component+componentSize);
+  }
+}
+
+//----------------------------------------------------------------------------
+int GetNrrdCompressionThreadCount(int requestedNumberOfThreads)
+{
+  if (requestedNumberOfThreads>0)
+  {
+    return requestedNumberOfThreads;
+  }
+  int hardwareThreads=static_cast<int>(std::thread::hardware_concurrency());
+  return hardwareThreads>0 ? hardwareThreads : 1;
+}
+
+//----------------------------------------------------------------------------
+bool ReadNrrdPixelData(const std::string& filename, long long dataOffset, const std::string& encoding,
+  void* buffer, size_t bufferSize, size_t componentSize, bool swapBytes, std::string& errorMessage)
+{
+  FILE* file=OpenPixelDataFile(filename, dataOffset, encoding, errorMessage);
+  if (file==NULL)
+  {
+    return false;
+  }
+  FileCloser fileCloser(file);
+  PixelDataReader reader(file, IsGzipEncoding(encoding));
+  if (!reader.Read(static_cast<char*>(buffer), bufferSize, errorMessage))
+  {
+    return false;
+  }
+  if (swapBytes)
+  {
+    SwapNrrdPixelDataBytes(buffer, bufferSize/componentSize, componentSize);
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ReadNrrdPixelDataFrame(const std::string& filename, long long dataOffset, const std::string& encoding,
+  void* buffer, size_t numberOfFrameComponents, size_t componentSize, size_t numberOfFrames, size_t frameIndex,
+  bool framesInterleaved, bool swapBytes, std::string& errorMessage)
+{
+  if (frameIndex>=numberOfFrames)
+  {
+    errorMessage="Frame index is out of range";
+    return false;
+  }
+  FILE* file=OpenPixelDataFile(filename, dataOffset, encoding, errorMessage);
+  if (file==NULL)
+  {
+    return false;
+  }
+  FileCloser fileCloser(file);
+  PixelDataReader reader(file, IsGzipEncoding(encoding));
+  char* frameBytes=static_cast<char*>(buffer);
+  const size_t frameSize=numberOfFrameComponents*componentSize;
+  if (!framesInterleaved)
+  {
+    // Frames are stored one after the other
+    if (!reader.Skip(static_cast<long long>(frameIndex)*frameSize, errorMessage)
+      || !reader.Read(frameBytes, frameSize, errorMessage))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    // Components of all frames are stored for each voxel, read the voxels in blocks and pick the frame's component
+    const size_t voxelSize=numberOfFrames*componentSize;
+    const size_t numberOfVoxelsPerBlock=std::max<size_t>(1, FILE_BLOCK_SIZE/voxelSize);
+    std::vector<char> block(numberOfVoxelsPerBlock*voxelSize);
+    for (size_t blockStartVoxel=0; blockStartVoxel<numberOfFrameComponents; blockStartVoxel+=numberOfVoxelsPerBlock)
+    {
+      size_t numberOfVoxels=std::min(numberOfVoxelsPerBlock, numberOfFrameComponents-blockStartVoxel);
+      if (!reader.Read(&block[0], numberOfVoxels*voxelSize, errorMessage))
+      {
+        return false;
+      }
+      const char* component=&block[frameIndex*componentSize];
+      char* frameComponent=frameBytes+blockStartVoxel*componentSize;
+      for (size_t voxelIndex=0; voxelIndex<numberOfVoxels; voxelIndex++, component+=voxelSize, frameComponent+=componentSize)
+      {
+        memcpy(frameComponent, component, componentSize);
+      }
+    }
+  }
+  if (swapBytes)
+  {
+    SwapNrrdPixelDataBytes(buffer, numberOfFrameComponents, componentSize);
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool WriteNrrdPixelData(const std::string& filename, const std::string& encoding,
+  const void* data, size_t dataSize, size_t componentSize, bool swapBytes, std::string& errorMessage,
+  int compressionLevel/*=-1*/, int numberOfThreads/*=0*/)
+{
+  if (!IsNrrdEncodingSupported(encoding))
+  {
+    errorMessage="Unsupported encoding: "+encoding;
+    return false;
+  }
+  FILE* file=fopen(filename.c_str(), "ab");
+  if (file==NULL)
+  {
+    errorMessage="Could not open file: "+filename;
+    return false;
+  }
+  FileCloser fileCloser(file);
+  componentSize=std::max<size_t>(componentSize, 1);
+  if (compressionLevel<Z_DEFAULT_COMPRESSION || compressionLevel>Z_BEST_COMPRESSION)
+  {
+    errorMessage="Invalid compression level";
+    return false;
+  }
+  const char* dataBytes=static_cast<const char*>(data);
+  if (IsGzipEncoding(encoding))
+  {
+    return WriteGzipPixelData(file, dataBytes, dataSize, componentSize, swapBytes, compressionLevel, numberOfThreads, errorMessage);
+  }
+  // Blocks must contain whole components so that they can be byte-swapped independently
+  size_t blockSize=std::max<size_t>(componentSize, FILE_BLOCK_SIZE-FILE_BLOCK_SIZE%componentSize);
+  return WriteRawPixelData(file, dataBytes, dataSize, blockSize, componentSize, swapBytes, errorMessage);
+}
@@ -0,0 +1,51 @@
+#ifndef __MatlabNrrdCodec_h
+#define __MatlabNrrdCodec_h
+
+#include <cstddef>
+#include <string>
+
+// Reading and writing of the pixel data section of NRRD files (see http://teem.sourceforge.net/nrrd/format.html).
+// The header is parsed and written by nrrdread.m/nrrdwrite.m, these functions only transfer the voxels,
+// which is the time-consuming part for large volumes. Compressed data is streamed through zlib
+// in blocks, so no temporary copy of the entire compressed or uncompressed data is created.
+
+/// Returns true if the pixel data encoding is supported ("raw", "gzip", or "gz")
+bool IsNrrdEncodingSupported(const std::string& encoding);
+
+/// Reverse the byte order of numberOfComponents values of componentSize bytes each, in place
+void SwapNrrdPixelDataBytes(void* data, size_t numberOfComponents, size_t componentSize);
+
+/// Read pixel data starting at dataOffset bytes from the beginning of the file.
+/// Exactly bufferSize bytes are read into buffer. If swapBytes is true then the byte order
+/// of each component is reversed after reading.
+/// Returns true if successful. In case of failure the reason is returned in errorMessage.
+bool ReadNrrdPixelData(const std::string& filename, long long dataOffset, const std::string& encoding,
+  void* buffer, size_t bufferSize, size_t componentSize, bool swapBytes, std::string& errorMessage);
+
+/// Read a single frame of a 4D volume, without loading the other frames into memory.
+/// The volume consists of numberOfFrames frames of numberOfFrameComponents components each.
+/// If framesInterleaved is false then frames are stored one after the other (the frame axis is the slowest,
+/// e.g., kinds: domain domain domain list), and frames of raw encoded data are accessed by seeking in the file.
+/// If framesInterleaved is true then the frame axis is the fastest (e.g., kinds: list domain domain domain).
+/// The frameIndex-th (zero-based) frame is read into buffer, which must be numberOfFrameComponents*componentSize bytes.
+/// Returns true if successful. In case of failure the reason is returned in errorMessage.
+bool ReadNrrdPixelDataFrame(const std::string& filename, long long dataOffset, const std::string& encoding,
+  void* buffer, size_t numberOfFrameComponents, size_t componentSize, size_t numberOfFrames, size_t frameIndex,
+  bool framesInterleaved, bool swapBytes, std::string& errorMessage);
+
+/// Returns the number of threads used for compression. If requestedNumberOfThreads is not positive
+/// then all the processor cores are used.
+int GetNrrdCompressionThreadCount(int requestedNumberOfThreads);
+
+/// Append pixel data to the end of the file (that already contains the NRRD header).
+/// If swapBytes is true then the byte order of each component is reversed while writing
+/// (the input data is not modified).
+/// Gzip encoded data is compressed in blocks on numberOfThreads threads (all processor cores if not positive).
+/// The result is a single standard gzip stream. compressionLevel is the zlib compression level:
+/// 1 (fastest) to 9 (best compression), 0 (no compression), or -1 (zlib default).
+/// Returns true if successful. In case of failure the reason is returned in errorMessage.
+bool WriteNrrdPixelData(const std::string& filename, const std::string& encoding,
+  const void* data, size_t dataSize, size_t componentSize, bool swapBytes, std::string& errorMessage,
+  int compressionLevel=-1, int numberOfThreads=0);
+
+#endif
@@ -0,0 +1,127 @@
+// Measures the throughput of NRRD pixel data reading and writing for raw and gzip encodings.
+//
+//   MatlabNrrdCodecBenchmark [sizeMB] [workingDirectory] [compressionLevel]
+//
+// A synthetic int16 volume of sizeMB megabytes (default: 256) is written to a temporary NRRD file
+// in workingDirectory (default: current directory), read back, and verified. Throughput is reported
+// in MB/s of uncompressed pixel data. Gzip compression (with the specified compressionLevel, default: -1)
+// is measured with 1 to 32 threads to show how compression scales with the number of threads.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MatlabNrrdCodec.h"
+
+namespace
+{
+
+double GetTimeSec()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Write a minimal NRRD header, pixel data is appended after that. Returns the size of the header.
+long long WriteHeader(const std::string& filename, const std::string& encoding, size_t numberOfVoxels)
+{
+  FILE* file=fopen(filename.c_str(), "wb");
+  if (file==NULL)
+  {
+    return -1;
+  }
+  fprintf(file, "NRRD0005\ntype: int16\ndimension: 3\nsizes: %lu 1 1\nendian: little\nencoding: %s\n\n",
+    static_cast<unsigned long>(numberOfVoxels), encoding.c_str());
+  long long headerSize=ftell(file);
+  fclose(file);
+  return headerSize;
+}
+
+bool RunBenchmark(const std::string& filename, const std::string& encoding, const std::vector<short>& pixelData, bool swapBytes,
+  int compressionLevel=-1, int numberOfThreads=0)
+{
+  const size_t dataSize=pixelData.size()*sizeof(short);
+  const double dataSizeMB=dataSize/(1024.0*1024.0);
+  std::string errorMessage;
+
+  long long dataOffset=WriteHeader(filename, encoding, pixelData.size());
+  if (dataOffset<0)
+  {
+    std::cerr << "ERROR: Failed to write file " << filename << std::endl;
+    return false;
+  }
+  double startTime=GetTimeSec();
+  if (!WriteNrrdPixelData(filename, encoding, &pixelData[0], dataSize, sizeof(short), swapBytes, errorMessage,
+    compressionLevel, numberOfThreads))
+  {
+    std::cerr << "ERROR: " << errorMessage << std::endl;
+    return false;
+  }
+  double writeTimeSec=GetTimeSec()-startTime;
+
+  std::vector<short> readPixelData(pixelData.size());
+  startTime=GetTimeSec();
+  if (!ReadNrrdPixelData(filename, dataOffset, encoding, &readPixelData[0], dataSize, sizeof(short), swapBytes, errorMessage))
+  {
+    std::cerr << "ERROR: " << errorMessage << std::endl;
+    return false;
+  }
+  double readTimeSec=GetTimeSec()-startTime;
+  FILE* file=fopen(filename.c_str(), "rb");
+  fseek(file, 0, SEEK_END);
+  double fileSizeMB=(ftell(file)-dataOffset)/(1024.0*1024.0);
+  fclose(file);
+  remove(filename.c_str());
+
+  if (readPixelData!=pixelData)
+  {
+    std::cerr << "ERROR: Pixel data read from " << encoding << " file is different from the written data" << std::endl;
+    return false;
+  }
+
+  std::cout << encoding << (swapBytes ? " (byte swapped)" : "");
+  if (encoding=="gzip")
+  {
+    std::cout << " (level " << compressionLevel << ", " << GetNrrdCompressionThreadCount(numberOfThreads) << " threads)";
+  }
+  std::cout << ": write " << dataSizeMB/writeTimeSec << " MB/s, "
+    << "read " << dataSizeMB/readTimeSec << " MB/s, "
+    << "compression ratio " << dataSizeMB/fileSizeMB << std::endl;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  size_t sizeMB=(argc>1) ? static_cast<size_t>(atoi(argv[1])) : 256;
+  std::string workingDirectory=(argc>2) ? argv[2] : ".";
+  int compressionLevel=(argc>3) ? atoi(argv[3]) : -1;
+  if (sizeMB==0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [sizeMB] [workingDirectory] [compressionLevel]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string filename=workingDirectory+"/MatlabNrrdCodecBenchmark.nrrd";
+
+  // Smooth synthetic image with some noise, to have a realistic compression ratio
+  std::vector<short> pixelData(sizeMB*1024*1024/sizeof(short));
+  unsigned int randomState=12345;
+  for (size_t i=0; i<pixelData.size(); i++)
+  {
+    randomState=randomState*1103515245+12345;
+    pixelData[i]=static_cast<short>((i/512)%1024+((randomState>>16)&0x0f));
+  }
+
+  std::cout << "Pixel data size: " << sizeMB << " MB" << std::endl;
+  std::cout << "Processor cores: " << GetNrrdCompressionThreadCount(0) << std::endl;
+  bool success=RunBenchmark(filename, "raw", pixelData, false)
+    && RunBenchmark(filename, "raw", pixelData, true);
+  for (int numberOfThreads=1; success && numberOfThreads<=32; numberOfThreads*=2)
+  {
+    success=RunBenchmark(filename, "gzip", pixelData, false, compressionLevel, numberOfThreads);
+  }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
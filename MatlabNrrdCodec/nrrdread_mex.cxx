@@ -0,0 +1,99 @@
+// MEX function for reading the pixel data section of a NRRD file
+//
+//   data = nrrdread_mex(filename, dataOffset, encoding, datatype, numberOfElements, swapBytes)
+//   frameData = nrrdread_mex(filename, dataOffset, encoding, datatype, numberOfElements, swapBytes,
+//     numberOfFrames, frameIndex, framesInterleaved)
+//
+//   filename: NRRD file name
+//   dataOffset: position of the pixel data in the file (in bytes, e.g., as returned by ftell after reading the header)
+//   encoding: 'raw', 'gzip', or 'gz'
+//   datatype: Matlab class name of the voxels (e.g., 'int16', 'single')
+//   numberOfElements: number of voxels
+//   swapBytes: if true then the byte order of the voxels is reversed after reading
+//   numberOfFrames: number of frames of a 4D volume, numberOfElements is the number of voxels in one frame
+//   frameIndex: index of the frame to read (one-based)
+//   framesInterleaved: true if the frame axis is the fastest axis, false if it is the slowest
+//   data: column vector of numberOfElements voxels of the specified datatype
+//
+// Voxels are read (and decompressed) directly into the returned array, without using the Java heap.
+// If a frame is read then only that frame is kept in memory.
+
+#include <string>
+
+#include "mex.h"
+
+#include "MatlabNrrdCodec.h"
+
+namespace
+{
+
+std::string GetStringArgument(const mxArray* arg, const char* argName)
+{
+  char* str=mxArrayToString(arg);
+  if (str==NULL)
+  {
+    mexErrMsgIdAndTxt("nrrdread_mex:invalidArgument", "%s must be a string", argName);
+  }
+  std::string result(str);
+  mxFree(str);
+  return result;
+}
+
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if ((nrhs!=6 && nrhs!=9) || nlhs>1)
+  {
+    mexErrMsgIdAndTxt("nrrdread_mex:invalidArgument",
+      "Usage: data = nrrdread_mex(filename, dataOffset, encoding, datatype, numberOfElements, swapBytes"
+      " [, numberOfFrames, frameIndex, framesInterleaved])");
+  }
+  std::string filename=GetStringArgument(prhs[0], "filename");
+  long long dataOffset=static_cast<long long>(mxGetScalar(prhs[1]));
+  std::string encoding=GetStringArgument(prhs[2], "encoding");
+  std::string datatype=GetStringArgument(prhs[3], "datatype");
+  mwSize numberOfElements=static_cast<mwSize>(mxGetScalar(prhs[4]));
+  bool swapBytes=(mxGetScalar(prhs[5])!=0);
+
+  mxClassID classId=mxUNKNOWN_CLASS;
+  const char* classNames[]={"int8","uint8","int16","uint16","int32","uint32","int64","uint64","single","double"};
+  const mxClassID classIds[]={mxINT8_CLASS,mxUINT8_CLASS,mxINT16_CLASS,mxUINT16_CLASS,mxINT32_CLASS,mxUINT32_CLASS,
+    mxINT64_CLASS,mxUINT64_CLASS,mxSINGLE_CLASS,mxDOUBLE_CLASS};
+  for (size_t classIndex=0; classIndex<sizeof(classIds)/sizeof(classIds[0]); classIndex++)
+  {
+    if (datatype==classNames[classIndex])
+    {
+      classId=classIds[classIndex];
+      break;
+    }
+  }
+  if (classId==mxUNKNOWN_CLASS)
+  {
+    mexErrMsgIdAndTxt("nrrdread_mex:invalidArgument", "Unsupported datatype: %s", datatype.c_str());
+  }
+
+  mxArray* data=mxCreateNumericMatrix(numberOfElements, 1, classId, mxREAL);
+  size_t componentSize=mxGetElementSize(data);
+  std::string errorMessage;
+  bool success=false;
+  if (nrhs==9)
+  {
+    size_t numberOfFrames=static_cast<size_t>(mxGetScalar(prhs[6]));
+    size_t frameIndex=static_cast<size_t>(mxGetScalar(prhs[7]))-1;
+    bool framesInterleaved=(mxGetScalar(prhs[8])!=0);
+    success=ReadNrrdPixelDataFrame(filename, dataOffset, encoding, mxGetData(data), numberOfElements,
+      componentSize, numberOfFrames, frameIndex, framesInterleaved, swapBytes, errorMessage);
+  }
+  else
+  {
+    success=ReadNrrdPixelData(filename, dataOffset, encoding, mxGetData(data), numberOfElements*componentSize,
+      componentSize, swapBytes, errorMessage);
+  }
+  if (!success)
+  {
+    mxDestroyArray(data);
+    mexErrMsgIdAndTxt("nrrdread_mex:readFailed", "%s", errorMessage.c_str());
+  }
+  plhs[0]=data;
+}
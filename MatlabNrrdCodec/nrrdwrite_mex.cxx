@@ -0,0 +1,53 @@
+// MEX function for writing the pixel data section of a NRRD file
+//
+//   nrrdwrite_mex(filename, pixelData, encoding, swapBytes, compressionLevel, numberOfThreads)
+//
+//   filename: NRRD file name, the file must already contain the header, the pixel data is appended to it
+//   pixelData: numeric array of voxels
+//   encoding: 'raw', 'gzip', or 'gz'
+//   swapBytes: if true then the byte order of the voxels is reversed in the file
+//   compressionLevel: optional, zlib compression level for gzip encoding (1: fastest, 9: best compression, -1: default)
+//   numberOfThreads: optional, number of threads used for gzip compression (0: all processor cores, default)
+//
+// Voxels are written (and compressed) directly from the input array, without using the Java heap.
+
+#include <string>
+
+#include "mex.h"
+
+#include "MatlabNrrdCodec.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs<4 || nrhs>6 || nlhs>0)
+  {
+    mexErrMsgIdAndTxt("nrrdwrite_mex:invalidArgument",
+      "Usage: nrrdwrite_mex(filename, pixelData, encoding, swapBytes, compressionLevel, numberOfThreads)");
+  }
+  if (!mxIsNumeric(prhs[1]) || mxIsComplex(prhs[1]) || mxIsSparse(prhs[1]))
+  {
+    mexErrMsgIdAndTxt("nrrdwrite_mex:invalidArgument", "pixelData must be a real, full numeric array");
+  }
+  char* filename=mxArrayToString(prhs[0]);
+  char* encoding=mxArrayToString(prhs[2]);
+  if (filename==NULL || encoding==NULL)
+  {
+    mxFree(filename);
+    mxFree(encoding);
+    mexErrMsgIdAndTxt("nrrdwrite_mex:invalidArgument", "filename and encoding must be strings");
+  }
+  bool swapBytes=(mxGetScalar(prhs[3])!=0);
+  int compressionLevel=(nrhs>4) ? static_cast<int>(mxGetScalar(prhs[4])) : -1;
+  int numberOfThreads=(nrhs>5) ? static_cast<int>(mxGetScalar(prhs[5])) : 0;
+
+  size_t componentSize=mxGetElementSize(prhs[1]);
+  std::string errorMessage;
+  bool success=WriteNrrdPixelData(filename, encoding, mxGetData(prhs[1]), mxGetNumberOfElements(prhs[1])*componentSize,
+    componentSize, swapBytes, errorMessage, compressionLevel, numberOfThreads);
+  mxFree(filename);
+  mxFree(encoding);
+  if (!success)
+  {
+    mexErrMsgIdAndTxt("nrrdwrite_mex:writeFailed", "%s", errorMessage.c_str());
+  }
+}